@@ -0,0 +1,348 @@
+#include "Arduino.h"
+#include <AsyncTS.hpp>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+
+HardwareSerial Serial;
+
+static uint64_t monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+unsigned long millis()
+{
+    return (uint32_t)((monotonicMicros() - startMicros) / 1000);
+}
+
+unsigned long micros()
+{
+    return (uint32_t)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms)
+{
+    usleep(ms * 1000);
+}
+
+void yield()
+{
+}
+
+long random(long howbig)
+{
+    return howbig > 0 ? ::random() % howbig : 0;
+}
+
+long random(long howsmall, long howbig)
+{
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+    if (seed)
+        srandom(seed);
+}
+
+static char* formatUnsigned(unsigned long value, char* result, int base)
+{
+    char digits[sizeof(value) * 8 + 1];
+    int n = 0;
+    if (base < 2 || base > 36)
+        base = 10;
+    do
+    {
+        int digit = value % base;
+        digits[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    for (int i = 0; i < n; i++)
+        result[i] = digits[n - 1 - i];
+    result[n] = 0;
+    return result;
+}
+
+char* ltoa(long value, char* result, int base)
+{
+    if (value < 0 && base == 10)
+    {
+        result[0] = '-';
+        formatUnsigned(-(unsigned long)value, result + 1, base);
+        return result;
+    }
+    return formatUnsigned((unsigned long)value, result, base);
+}
+
+char* itoa(int value, char* result, int base)
+{
+    if (value < 0 && base != 10)
+        return formatUnsigned((unsigned)value, result, base);
+    return ltoa(value, result, base);
+}
+
+char* utoa(unsigned value, char* result, int base)
+{
+    return formatUnsigned(value, result, base);
+}
+
+char* ultoa(unsigned long value, char* result, int base)
+{
+    return formatUnsigned(value, result, base);
+}
+
+char* dtostrf(double number, signed char width, unsigned char prec, char* s)
+{
+    sprintf(s, "%*.*f", width, prec, number);
+    return s;
+}
+
+String::String(unsigned char value, unsigned char base) : String((unsigned long)value, base) {}
+String::String(int value, unsigned char base) : String((long)value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+
+String::String(long value, unsigned char base)
+{
+    char buf[2 + 8 * sizeof(long)];
+    _s = ltoa(value, buf, base);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+    char buf[1 + 8 * sizeof(unsigned long)];
+    _s = ultoa(value, buf, base);
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned char decimalPlaces)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    _s = buf;
+}
+
+bool String::endsWith(const String& suffix) const
+{
+    return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+}
+
+void String::getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index) const
+{
+    if (!bufsize || !buf)
+        return;
+    size_t n = index < _s.size() ? _s.copy((char*)buf, bufsize - 1, index) : 0;
+    buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+    size_t at = _s.find(ch, fromIndex);
+    return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const
+{
+    size_t at = _s.find(str._s, fromIndex);
+    return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::lastIndexOf(char ch) const
+{
+    size_t at = _s.rfind(ch);
+    return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::lastIndexOf(const String& str) const
+{
+    size_t at = _s.rfind(str._s);
+    return at == std::string::npos ? -1 : (int)at;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    if (beginIndex > endIndex)
+        std::swap(beginIndex, endIndex);
+    if (beginIndex >= _s.size())
+        return String();
+    return String(_s.substr(beginIndex, endIndex - beginIndex));
+}
+
+void String::replace(const String& find, const String& replace)
+{
+    if (find._s.empty())
+        return;
+    for (size_t at = _s.find(find._s); at != std::string::npos; at = _s.find(find._s, at + replace._s.size()))
+        _s.replace(at, find._s.size(), replace._s);
+}
+
+void String::toLowerCase()
+{
+    for (char& c : _s)
+        c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase()
+{
+    for (char& c : _s)
+        c = toupper((unsigned char)c);
+}
+
+void String::trim()
+{
+    size_t begin = 0;
+    size_t end = _s.size();
+    while (begin < end && isspace((unsigned char)_s[begin]))
+        begin++;
+    while (end > begin && isspace((unsigned char)_s[end - 1]))
+        end--;
+    _s = _s.substr(begin, end - begin);
+}
+
+String operator+(const String& lhs, const String& rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String& lhs, const char* rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const char* lhs, const String& rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+String operator+(const String& lhs, char rhs)
+{
+    String result(lhs);
+    result.concat(rhs);
+    return result;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+static size_t vprint(Print& out, const char* format, va_list args)
+{
+    char buf[256];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+    if (len < 0)
+        return 0;
+    if ((size_t)len < sizeof(buf))
+        return out.write((const uint8_t*)buf, len);
+    std::string big(len + 1, 0);
+    vsnprintf(&big[0], big.size(), format, args);
+    return out.write((const uint8_t*)big.data(), len);
+}
+
+size_t Print::printf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t n = vprint(*this, format, args);
+    va_end(args);
+    return n;
+}
+
+size_t Print::printf_P(PGM_P format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t n = vprint(*this, format, args);
+    va_end(args);
+    return n;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+#if ATS_ALLOC_STATS
+// Every operator new of the program is counted for the allocation statistics of AsyncTS:
+// String, std::function, std::any and the xbuf segments all come from here.
+static atsHeapCount heapCount;
+
+atsHeapCount atsHeapCounter()
+{
+    return heapCount;
+}
+
+static void* countedNew(size_t size)
+{
+    heapCount.allocs++;
+    heapCount.bytes += size;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size)
+{
+    return countedNew(size);
+}
+
+void* operator new[](size_t size)
+{
+    return countedNew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    heapCount.allocs++;
+    heapCount.bytes += size;
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+#endif
@@ -0,0 +1,85 @@
+#include "AsyncHost.h"
+#include "Ticker.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <vector>
+
+#define HOST_EVENTS 16  // Socket events taken by one epoll_wait()
+
+static int epollFd = -1;
+
+static std::vector<AsyncHostSocket*>& sockets()
+{
+    static std::vector<AsyncHostSocket*> list;
+    return list;
+}
+
+static bool alive(AsyncHostSocket* socket)
+{
+    std::vector<AsyncHostSocket*>& list = sockets();
+    return std::find(list.begin(), list.end(), socket) != list.end();
+}
+
+AsyncHostSocket::AsyncHostSocket()
+{
+    sockets().push_back(this);
+}
+
+AsyncHostSocket::~AsyncHostSocket()
+{
+    std::vector<AsyncHostSocket*>& list = sockets();
+    list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+bool AsyncHostSocket::_hostWatch(int fd, uint32_t events)
+{
+    if (epollFd < 0)
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+        return false;
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = this;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return true;
+    return errno == ENOENT && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void AsyncHostSocket::_hostForget(int fd)
+{
+    if (epollFd >= 0)
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/**
+ * @brief Run one round of the event loop.
+ * @param maxWait Max time to wait for an event, in milli seconds.
+*/
+void hostLoop(uint32_t maxWait)
+{
+    uint32_t wait = Ticker::service(maxWait);
+    uint32_t now = millis();
+    // A socket may be destroyed by a callback of another one, walk a copy.
+    std::vector<AsyncHostSocket*> list = sockets();
+    for (AsyncHostSocket* socket : list)
+    {
+        if (alive(socket))
+            wait = std::min(wait, socket->_service(now));
+    }
+
+    struct epoll_event events[HOST_EVENTS];
+    int count = 0;
+    if (epollFd >= 0)
+        count = epoll_wait(epollFd, events, HOST_EVENTS, wait);
+    else if (wait)
+        delay(wait);
+    for (int i = 0; i < count; i++)
+    {
+        AsyncHostSocket* socket = (AsyncHostSocket*)events[i].data.ptr;
+        if (alive(socket))
+            socket->_onEvents(events[i].events);
+    }
+    Ticker::service(0);
+}
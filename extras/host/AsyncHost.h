@@ -0,0 +1,43 @@
+/*
+AsyncHost.h - event loop of the host build.
+
+hostLoop() waits for socket events or the next Ticker, then runs the due
+callbacks of the AsyncClients and Tickers. Call it in a loop, e.g.
+
+    while (running)
+        hostLoop();
+
+Everything runs in the calling thread.
+*/
+
+#ifndef ASYNCHOST_H_HOST
+#define ASYNCHOST_H_HOST
+
+#include "Arduino.h"
+
+#define ASYNC_HOST_MAX_WAIT 1000    // Max time hostLoop() blocks, in milli seconds
+
+// A socket driven by hostLoop().
+class AsyncHostSocket
+{
+    public:
+    AsyncHostSocket();
+    virtual ~AsyncHostSocket();
+
+    protected:
+    friend void hostLoop(uint32_t maxWait);
+
+    // Register or drop the fd in the epoll set, events are EPOLLIN/EPOLLOUT bits.
+    bool _hostWatch(int fd, uint32_t events);
+    void _hostForget(int fd);
+
+    // Socket events of the fd.
+    virtual void _onEvents(uint32_t events) = 0;
+
+    // Called in every loop, returns the ms until it needs to be called again.
+    virtual uint32_t _service(uint32_t now) = 0;
+};
+
+void hostLoop(uint32_t maxWait = ASYNC_HOST_MAX_WAIT);
+
+#endif /* ASYNCHOST_H_HOST */
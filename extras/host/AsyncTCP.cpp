@@ -0,0 +1,349 @@
+#include "AsyncTCP.h"
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+
+static int8_t lwipError(int error)
+{
+    switch (error)
+    {
+    case ETIMEDOUT:
+        return ERR_TIMEOUT;
+    case ECONNRESET:
+    case ECONNREFUSED:
+        return ERR_RST;
+    case EPIPE:
+        return ERR_CLSD;
+    default:
+        return ERR_CONN;
+    }
+}
+
+AsyncClient::AsyncClient()
+{
+}
+
+AsyncClient::~AsyncClient()
+{
+    _closeSocket();
+}
+
+/**
+ * @brief Start connecting to host:port. The name is resolved before the call returns.
+ * @return False if the name couldn't be resolved or the socket couldn't be started,
+ * no callback comes then.
+*/
+bool AsyncClient::connect(const char* host, uint16_t port)
+{
+    if (_state != CLOSED)
+        return false;
+    _discardPending = false;
+
+    std::string node = host;
+    std::string service = std::to_string(port);
+    const char* redirect = getenv("ATS_HOST_SERVER");
+    if (redirect && *redirect)
+    {
+        std::string target = redirect;
+        size_t colon = target.rfind(':');
+        node = target.substr(0, colon);
+        if (colon != std::string::npos)
+            service = target.substr(colon + 1);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(node.c_str(), service.c_str(), &hints, &result) != 0 || !result)
+        return false;
+    _fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+    {
+        freeaddrinfo(result);
+        return false;
+    }
+    if (_noDelay)
+        setNoDelay(true);
+    int rc = ::connect(_fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (rc < 0 && errno != EINPROGRESS)
+    {
+        _closeSocket();
+        return false;
+    }
+    _state = CONNECTING;
+    _tx.clear();
+    _inKernel = 0;
+    _watch(true);
+    return true;
+}
+
+/**
+ * @brief Close the connection. onDisconnect comes from the next round of the loop.
+ * @param now Unused, the socket is closed at once anyway.
+*/
+void AsyncClient::close(bool now)
+{
+    (void)now;
+    if (_state == CLOSED)
+        return;
+    _closeSocket();
+    _discardPending = true;
+}
+
+/**
+ * @brief Drop the connection without any callback.
+*/
+int8_t AsyncClient::abort()
+{
+    if (_fd >= 0)
+    {
+        // Reset instead of the orderly close, like tcp_abort().
+        struct linger lin = {1, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    }
+    _closeSocket();
+    _discardPending = false;
+    return ERR_ABRT;
+}
+
+size_t AsyncClient::space()
+{
+    if (_state != CONNECTED)
+        return 0;
+    size_t used = _tx.size() + _inKernel;
+    return used < ASYNC_HOST_SND_BUF ? ASYNC_HOST_SND_BUF - used : 0;
+}
+
+size_t AsyncClient::add(const char* data, size_t size, uint8_t apiflags)
+{
+    (void)apiflags;
+    size_t room = space();
+    if (size > room)
+        size = room;
+    _tx.append(data, size);
+    return size;
+}
+
+bool AsyncClient::send()
+{
+    if (_state != CONNECTED)
+        return false;
+    _flush();
+    return _state == CONNECTED;
+}
+
+size_t AsyncClient::write(const char* data, size_t size, uint8_t apiflags)
+{
+    size_t added = add(data, size, apiflags);
+    if (!added || !send())
+        return 0;
+    return added;
+}
+
+void AsyncClient::setNoDelay(bool nodelay)
+{
+    _noDelay = nodelay;
+    if (_fd >= 0)
+    {
+        int flag = nodelay;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+}
+
+const char* AsyncClient::errorToString(int8_t error)
+{
+    switch (error)
+    {
+    case 0:
+        return "OK";
+    case ERR_TIMEOUT:
+        return "Timeout";
+    case ERR_CONN:
+        return "Not Connected";
+    case ERR_ABRT:
+        return "Connection Aborted";
+    case ERR_RST:
+        return "Connection Reset";
+    case ERR_CLSD:
+        return "Connection Closed";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+void AsyncClient::_closeSocket()
+{
+    if (_fd >= 0)
+    {
+        _hostForget(_fd);
+        ::close(_fd);
+        _fd = -1;
+    }
+    _state = CLOSED;
+    _tx.clear();
+    _inKernel = 0;
+}
+
+// The connection is lost: onError, then onDisconnect like the lwIP clients.
+void AsyncClient::_fail(int error)
+{
+    _closeSocket();
+    _discardPending = false;
+    if (_errorCb)
+        _errorCb(_errorArg, this, lwipError(error));
+    if (_discardCb)
+        _discardCb(_discardArg, this);
+}
+
+void AsyncClient::_watch(bool writable)
+{
+    _hostWatch(_fd, (_state == CONNECTING ? 0 : EPOLLIN) | (writable ? EPOLLOUT : 0) | EPOLLRDHUP);
+}
+
+// Hand the added bytes to the kernel.
+void AsyncClient::_flush()
+{
+    while (!_tx.empty())
+    {
+        ssize_t n = ::send(_fd, _tx.data(), _tx.size(), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            _fail(errno);
+            return;
+        }
+        if (!_inKernel)
+            _sentAt = millis();
+        _inKernel += n;
+        _tx.erase(0, n);
+    }
+    _watch(!_tx.empty());
+}
+
+// Report the bytes which left the send queue of the socket as acknowledged.
+void AsyncClient::_checkAcks(uint32_t now)
+{
+    if (!_inKernel)
+        return;
+    int queued = 0;
+    if (ioctl(_fd, SIOCOUTQ, &queued) < 0)
+        queued = 0;
+    if ((size_t)queued >= _inKernel)
+        return;
+    size_t acked = _inKernel - queued;
+    uint32_t time = now - _sentAt;
+    _inKernel = queued;
+    _sentAt = now;
+    if (_ackCb)
+        _ackCb(_ackArg, this, acked, time);
+}
+
+void AsyncClient::_onEvents(uint32_t events)
+{
+    if (_state == CONNECTING)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+            error = errno;
+        if (error)
+        {
+            _fail(error);
+            return;
+        }
+        if (!(events & EPOLLOUT))
+            return;
+        _state = CONNECTED;
+        _lastRx = _lastPoll = millis();
+        _watch(false);
+        if (_connectCb)
+            _connectCb(_connectArg, this);
+        return;
+    }
+    if (_state != CONNECTED)
+        return;
+
+    if (events & EPOLLOUT)
+        _flush();
+    if (_state == CONNECTED && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+        char slice[ASYNC_HOST_RX_SLICE];
+        while (_state == CONNECTED)
+        {
+            ssize_t n = recv(_fd, slice, sizeof(slice), 0);
+            if (n > 0)
+            {
+                _lastRx = millis();
+                _checkAcks(_lastRx); // The response proves the request has arrived.
+                if (_dataCb)
+                    _dataCb(_dataArg, this, slice, n);
+                continue;
+            }
+            if (n == 0)
+            {
+                // Closed by the peer.
+                _closeSocket();
+                if (_discardCb)
+                    _discardCb(_discardArg, this);
+                return;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                _fail(errno);
+            return;
+        }
+    }
+}
+
+uint32_t AsyncClient::_service(uint32_t now)
+{
+    if (_discardPending)
+    {
+        _discardPending = false;
+        if (_discardCb)
+            _discardCb(_discardArg, this);
+        return ASYNC_HOST_POLL_MS;
+    }
+    if (_state != CONNECTED)
+        return ASYNC_HOST_POLL_MS;
+
+    _checkAcks(now);
+    if (_state != CONNECTED)
+        return ASYNC_HOST_POLL_MS;
+    uint32_t wait = _inKernel ? 10 : ASYNC_HOST_POLL_MS; // Acks are polled, not signalled.
+    if (now - _lastPoll < ASYNC_HOST_POLL_MS)
+        return std::min(wait, (uint32_t)(ASYNC_HOST_POLL_MS - (now - _lastPoll)));
+    _lastPoll = now;
+
+    // The checks of the poll callback of the lwIP clients.
+    if (_inKernel && _ackTimeout && now - _sentAt >= _ackTimeout)
+    {
+        uint32_t time = now - _sentAt;
+        _sentAt = now;
+        if (_timeoutCb)
+            _timeoutCb(_timeoutArg, this, time);
+        return wait;
+    }
+    if (_rxTimeout && now - _lastRx >= _rxTimeout * 1000)
+    {
+        close();
+        return 0;
+    }
+    if (_pollCb)
+        _pollCb(_pollArg, this);
+    return wait;
+}
@@ -0,0 +1,128 @@
+/*
+AsyncTCP.h - AsyncClient of the host build, on non-blocking sockets and epoll.
+
+The callback interface is the one of AsyncTCP (ESP32) and ESPAsyncTCP, and the
+callbacks come the same way the lwIP based clients deliver them:
+
+ - connect() resolves the name (blocking getaddrinfo) and starts the TCP
+   connect, onConnect or onError + onDisconnect follows.
+ - add() copies into a send window of ASYNC_HOST_SND_BUF bytes, send()
+   hands it to the kernel. onAck reports the bytes acknowledged by the peer
+   (the send queue of the socket shrank, SIOCOUTQ).
+ - onData gets the received bytes in slices of at most ASYNC_HOST_RX_SLICE.
+ - onPoll comes every ASYNC_HOST_POLL_MS while connected.
+ - close() shuts the socket at once, onDisconnect comes from the next loop.
+   abort() shuts it without any callback.
+
+Every callback runs from hostLoop() (AsyncHost.h), one thread drives the
+sockets and the Tickers, so AsyncTS needs no semaphore here.
+
+The environment variable ATS_HOST_SERVER=host:port redirects every connect()
+to another server, e.g. a local stand-in of ThingSpeak.
+*/
+
+#ifndef ASYNCTCP_H_HOST
+#define ASYNCTCP_H_HOST
+
+#include "Arduino.h"
+#include "AsyncHost.h"
+
+#ifndef ASYNC_HOST_SND_BUF
+#define ASYNC_HOST_SND_BUF 5744     // TCP_SND_BUF of the ESP32 lwIP
+#endif
+#ifndef ASYNC_HOST_RX_SLICE
+#define ASYNC_HOST_RX_SLICE 1460    // A TCP segment
+#endif
+#define ASYNC_HOST_POLL_MS 500
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+#define ASYNC_MAX_ACK_TIME 5000
+
+// Error codes of lwIP passed to onError.
+#define ERR_TIMEOUT -3
+#define ERR_CONN -11
+#define ERR_ABRT -13
+#define ERR_RST -14
+#define ERR_CLSD -15
+
+class AsyncClient;
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, int8_t error)> AcErrorHandler;
+typedef std::function<void(void*, AsyncClient*, void *data, size_t len)> AcDataHandler;
+typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
+
+class AsyncClient : public AsyncHostSocket
+{
+    public:
+    AsyncClient();
+    ~AsyncClient();
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    bool connect(const char* host, uint16_t port);
+    void close(bool now = false);
+    void stop() { close(false); }
+    int8_t abort();
+
+    bool connecting() const { return _state == CONNECTING; }
+    bool connected() const { return _state == CONNECTED; }
+    bool disconnecting() const { return _discardPending; }
+    bool freeable() const { return _state == CLOSED && !_discardPending; }
+    bool canSend() { return space() > 0; }
+    size_t space();
+    size_t add(const char* data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+    bool send();
+    size_t write(const char* data) { return write(data, strlen(data)); }
+    size_t write(const char* data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+
+    void setRxTimeout(uint32_t timeout) { _rxTimeout = timeout; }   // In seconds, 0: off
+    uint32_t getRxTimeout() { return _rxTimeout; }
+    void setAckTimeout(uint32_t timeout) { _ackTimeout = timeout; } // In milli seconds, 0: off
+    uint32_t getAckTimeout() { return _ackTimeout; }
+    void setNoDelay(bool nodelay);
+
+    void onConnect(AcConnectHandler cb, void* arg = 0) { _connectCb = cb; _connectArg = arg; }
+    void onDisconnect(AcConnectHandler cb, void* arg = 0) { _discardCb = cb; _discardArg = arg; }
+    void onAck(AcAckHandler cb, void* arg = 0) { _ackCb = cb; _ackArg = arg; }
+    void onError(AcErrorHandler cb, void* arg = 0) { _errorCb = cb; _errorArg = arg; }
+    void onData(AcDataHandler cb, void* arg = 0) { _dataCb = cb; _dataArg = arg; }
+    void onTimeout(AcTimeoutHandler cb, void* arg = 0) { _timeoutCb = cb; _timeoutArg = arg; }
+    void onPoll(AcConnectHandler cb, void* arg = 0) { _pollCb = cb; _pollArg = arg; }
+
+    static const char* errorToString(int8_t error);
+
+    protected:
+    void _onEvents(uint32_t events) override;
+    uint32_t _service(uint32_t now) override;
+
+    private:
+    enum { CLOSED, CONNECTING, CONNECTED } _state = CLOSED;
+    int         _fd = -1;
+    bool        _discardPending = false;   // onDisconnect is due from the loop
+    bool        _noDelay = false;
+    std::string _tx;                       // Added, not handed to the kernel yet
+    size_t      _inKernel = 0;             // Handed to the kernel, not acknowledged yet
+    uint32_t    _rxTimeout = 0;
+    uint32_t    _ackTimeout = ASYNC_MAX_ACK_TIME;
+    uint32_t    _lastRx = 0;
+    uint32_t    _sentAt = 0;               // millis() of the oldest unacknowledged send
+    uint32_t    _lastPoll = 0;
+
+    AcConnectHandler _connectCb;  void* _connectArg = nullptr;
+    AcConnectHandler _discardCb;  void* _discardArg = nullptr;
+    AcAckHandler     _ackCb;      void* _ackArg = nullptr;
+    AcErrorHandler   _errorCb;    void* _errorArg = nullptr;
+    AcDataHandler    _dataCb;     void* _dataArg = nullptr;
+    AcTimeoutHandler _timeoutCb;  void* _timeoutArg = nullptr;
+    AcConnectHandler _pollCb;     void* _pollArg = nullptr;
+
+    void _closeSocket();
+    void _fail(int error);
+    void _flush();
+    void _checkAcks(uint32_t now);
+    void _watch(bool writable);
+};
+
+#endif /* ASYNCTCP_H_HOST */
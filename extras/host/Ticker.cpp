@@ -0,0 +1,73 @@
+#include "Ticker.h"
+#include <algorithm>
+#include <vector>
+
+static std::vector<Ticker*>& tickers()
+{
+    static std::vector<Ticker*> list;
+    return list;
+}
+
+Ticker::~Ticker()
+{
+    detach();
+}
+
+void Ticker::_attach(uint32_t milliseconds, bool repeat, callback_function_t callback)
+{
+    detach();
+    if (!callback)
+        return;
+    _callback = callback;
+    _period = milliseconds;
+    _repeat = repeat;
+    _due = millis() + milliseconds;
+    tickers().push_back(this);
+}
+
+void Ticker::detach()
+{
+    if (!_callback)
+        return;
+    _callback = nullptr;
+    std::vector<Ticker*>& list = tickers();
+    list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+/**
+ * @brief Fire the due timers.
+ * @param maxWait Upper limit of the return value.
+ * @return Milli seconds until the next timer is due.
+*/
+uint32_t Ticker::service(uint32_t maxWait)
+{
+    std::vector<Ticker*> due;
+    uint32_t now = millis();
+    for (Ticker* ticker : tickers())
+    {
+        if ((int32_t)(now - ticker->_due) >= 0)
+            due.push_back(ticker);
+    }
+    for (Ticker* ticker : due)
+    {
+        // An earlier callback may have detached, re-armed or destroyed it.
+        std::vector<Ticker*>& list = tickers();
+        if (std::find(list.begin(), list.end(), ticker) == list.end() || (int32_t)(now - ticker->_due) < 0)
+            continue;
+        callback_function_t callback = ticker->_callback;
+        if (ticker->_repeat)
+            ticker->_due = now + ticker->_period;
+        else
+            ticker->detach();
+        callback();
+    }
+
+    uint32_t wait = maxWait;
+    now = millis();
+    for (Ticker* ticker : tickers())
+    {
+        int32_t left = ticker->_due - now;
+        wait = std::min(wait, left > 0 ? (uint32_t)left : 0);
+    }
+    return wait;
+}
@@ -0,0 +1,55 @@
+/*
+Ticker.h - timers of the host build.
+
+Same interface as the Ticker of the ESP8266/ESP32 cores, but the callbacks run
+from hostLoop() (AsyncHost.h), in the thread which drives the sockets, like
+the callbacks of AsyncClient. A timer may fire late, never early.
+*/
+
+#ifndef TICKER_H_HOST
+#define TICKER_H_HOST
+
+#include "Arduino.h"
+
+class Ticker
+{
+    public:
+    typedef std::function<void(void)> callback_function_t;
+
+    Ticker() {}
+    ~Ticker();
+    Ticker(const Ticker&) = delete;
+    Ticker& operator=(const Ticker&) = delete;
+
+    void attach(float seconds, callback_function_t callback) { _attach(seconds * 1000, true, callback); }
+    void attach_ms(uint32_t milliseconds, callback_function_t callback) { _attach(milliseconds, true, callback); }
+    void once(float seconds, callback_function_t callback) { _attach(seconds * 1000, false, callback); }
+    void once_ms(uint32_t milliseconds, callback_function_t callback) { _attach(milliseconds, false, callback); }
+
+    template <typename TArg>
+    void attach_ms(uint32_t milliseconds, void (*callback)(TArg), TArg arg)
+    {
+        _attach(milliseconds, true, [callback, arg]() { callback(arg); });
+    }
+
+    template <typename TArg>
+    void once_ms(uint32_t milliseconds, void (*callback)(TArg), TArg arg)
+    {
+        _attach(milliseconds, false, [callback, arg]() { callback(arg); });
+    }
+
+    void detach();
+    bool active() const { return (bool)_callback; }
+
+    static uint32_t service(uint32_t maxWait);
+
+    private:
+    callback_function_t _callback;
+    uint32_t _period = 0;
+    uint32_t _due = 0;
+    bool _repeat = false;
+
+    void _attach(uint32_t milliseconds, bool repeat, callback_function_t callback);
+};
+
+#endif /* TICKER_H_HOST */
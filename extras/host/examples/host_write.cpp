@@ -0,0 +1,38 @@
+/*
+host_write - write a value to field 1 of a channel from Linux.
+
+    ./build/host_write <channel> <write API key> <value>
+
+Set ATS_HOST_SERVER=host:port to send the request to a local stand-in server.
+*/
+
+#include <AsyncTS.h>
+#include <AsyncHost.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s <channel> <write API key> <value>\n", argv[0]);
+        return 2;
+    }
+    AsyncClient client;
+    AsyncTS ats;
+    ats.begin(client);
+    ats.setDebug(getenv("ATS_DEBUG") != nullptr);
+
+    bool done = false;
+    int result = 0;
+    ats.setField(1, String(argv[3]));
+    if (!ats.writeFields(strtoul(argv[1], nullptr, 10), argv[2], [&](int code)
+                         { result = code; done = true; }))
+    {
+        fprintf(stderr, "request not queued: %d\n", ats.getLastTSErrorCode());
+        return 1;
+    }
+    while (!done)
+        hostLoop();
+
+    printf("response: %d\n", result);
+    return result == TS_OK_SUCCESS ? 0 : 1;
+}
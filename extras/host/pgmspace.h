@@ -0,0 +1,22 @@
+/*
+pgmspace.h - the host has one address space, the PROGMEM helpers are plain memory access.
+*/
+
+#ifndef PGMSPACE_H_HOST
+#define PGMSPACE_H_HOST
+
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+#endif /* PGMSPACE_H_HOST */
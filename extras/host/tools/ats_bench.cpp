@@ -0,0 +1,371 @@
+/*
+ats_bench - end-to-end load test of AsyncTS against ts_mock (or any stand-in).
+
+    ./build/ats_bench [-s host:port] [-n instances] [-d seconds] [-q depth] [-k] [-p] [-t] [-b samples] [-a apis] [-A allocs]
+
+    -s  Server, 127.0.0.1:18080 by default (sets ATS_HOST_SERVER)
+    -n  AsyncTS instances, each with its own connection and channel (default 4)
+    -d  Duration of the run in seconds (default 10)
+    -q  Requests kept outstanding per instance (default 1, max ATS_QUEUE_SIZE)
+    -k  Keep the connections alive
+    -p  Pipeline the outstanding requests (needs -k)
+    -t  Register the channels, so the request heads are pre-rendered
+    -b  Samples per bulk update (default 10)
+    -a  Comma separated APIs to cycle through: update,field,feed,bulk (default), typed:
+        field 2 read by readField<int>() instead of readIntField(), and bulkcsv: bulk
+        updates in the CSV format (setBatchFormat())
+    -A  Fail (exit code 3) if a request type needs more heap allocations per request
+
+Every instance runs a closed loop: when one of its requests completes the next
+one is queued. The latency is measured from the call to the callback, the
+breakdown by request step comes from the latency statistics of AsyncTS. The body
+size of the bulk updates is printed for both formats (getBatchSize()). Start the
+mock with -r 0 (no rate limit), or the writes get "0" and count as errors.
+*/
+
+#include <AsyncTS.h>
+#include <AsyncHost.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum benchApi
+{
+    API_UPDATE,
+    API_FIELD,
+    API_FEED,
+    API_BULK,
+    API_TYPED,
+    API_BULK_CSV,
+    API_COUNT
+};
+
+static const char* apiNames[API_COUNT] = {"update", "field", "feed", "bulk", "typed", "bulkcsv"};
+
+struct ApiStats
+{
+    std::vector<uint32_t> latency;  // Micro seconds of the successful requests
+    uint32_t errors = 0;
+    uint32_t rejected = 0;          // Calls which returned false
+    std::map<int, uint32_t> codes;  // Codes of the failed requests
+};
+
+struct Instance
+{
+    AsyncClient client;
+    AsyncTS ats;
+    unsigned long channel = 0;
+    std::string key;
+    uint8_t outstanding = 0;
+    uint32_t completed = 0;
+    size_t next = 0;                // Index into the API cycle
+    std::deque<uint32_t> typedStarts; // Start of the outstanding typed reads, they complete in order
+};
+
+static ApiStats stats[API_COUNT];
+static uint32_t bulkSamples = 10;
+static uint64_t bulkBytes[2];       // Body bytes of the bulk updates sent, measured as JSON and as CSV
+static uint32_t bulkUpdates = 0;
+
+static void finish(Instance& in, benchApi api, uint32_t start, int code, bool ok)
+{
+    uint32_t elapsed = micros() - start;
+    in.outstanding--;
+    in.completed++;
+    if (ok)
+        stats[api].latency.push_back(elapsed);
+    else
+    {
+        stats[api].errors++;
+        stats[api].codes[code]++;
+    }
+}
+
+static void typedDone(int code, int value, void* arg)
+{
+    Instance& in = *(Instance*)arg;
+    uint32_t start = in.typedStarts.front();
+    in.typedStarts.pop_front();
+    finish(in, API_TYPED, start, code, code == TS_OK_SUCCESS);
+}
+
+static bool issue(Instance& in, benchApi api)
+{
+    uint32_t start = micros();
+    Instance* p = &in;
+    switch (api)
+    {
+    case API_UPDATE:
+        in.ats.setField(1, (float)(start % 1000) / 10);
+        in.ats.setField(2, (long)start);
+        in.ats.setStatus("bench");
+        return in.ats.writeFields(in.channel, in.key.c_str(), [p, start](int code)
+                                  { finish(*p, API_UPDATE, start, code, code == TS_OK_SUCCESS); });
+    case API_FIELD:
+        return in.ats.readIntField(in.channel, 2, [p, start](int code, std::any*)
+                                   { finish(*p, API_FIELD, start, code, code == TS_OK_SUCCESS); });
+    case API_FEED:
+        return in.ats.readMultipleFields(in.channel, [p, start](int code, std::any*)
+                                         { finish(*p, API_FEED, start, code, code == TS_OK_SUCCESS); });
+    case API_TYPED:
+        in.typedStarts.push_back(start);
+        if (in.ats.readField<int>(in.channel, 2, typedDone, p))
+            return true;
+        in.typedStarts.pop_back();
+        return false;
+    default:
+        in.ats.setBatchFormat(in.channel, api == API_BULK_CSV ? AsyncTS::BATCH_CSV : AsyncTS::BATCH_JSON);
+        for (uint32_t i = 0; i < bulkSamples; i++)
+        {
+            in.ats.setField(1, (float)i / 4);
+            in.ats.setField(2, (long)(start + i));
+            if (!in.ats.batchFields(in.channel, in.key.c_str(), [p, api, start](int code)
+                                    { finish(*p, api, start, code, code == 202); }))
+                return false;
+        }
+        size_t json = in.ats.getBatchSize(AsyncTS::BATCH_JSON);
+        size_t csv = in.ats.getBatchSize(AsyncTS::BATCH_CSV);
+        if (!in.ats.flushBatch())
+            return false;
+        bulkBytes[0] += json;
+        bulkBytes[1] += csv;
+        bulkUpdates++;
+        return true;
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t at = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[at];
+}
+
+static std::vector<benchApi> parseApis(const char* list)
+{
+    std::vector<benchApi> apis;
+    std::string s = list;
+    size_t at = 0;
+    while (at <= s.size())
+    {
+        size_t end = s.find(',', at);
+        if (end == std::string::npos)
+            end = s.size();
+        std::string name = s.substr(at, end - at);
+        for (int i = 0; i < API_COUNT; i++)
+        {
+            if (name == apiNames[i])
+                apis.push_back((benchApi)i);
+        }
+        at = end + 1;
+    }
+    return apis;
+}
+
+int main(int argc, char** argv)
+{
+    const char* server = "127.0.0.1:18080";
+    int instances = 4;
+    uint32_t seconds = 10;
+    int depth = 1;
+    bool keepAlive = false;
+    bool pipelining = false;
+    bool templates = false;
+    std::vector<benchApi> apis = {API_UPDATE, API_FIELD, API_FEED, API_BULK};
+    double maxAllocs = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:d:q:kptb:a:A:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': server = optarg; break;
+        case 'n': instances = std::max(1, atoi(optarg)); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'q': depth = std::min(std::max(1, atoi(optarg)), ATS_QUEUE_SIZE); break;
+        case 'k': keepAlive = true; break;
+        case 'p': pipelining = true; break;
+        case 't': templates = true; break;
+        case 'b': bulkSamples = std::max(1, atoi(optarg)); break;
+        case 'a': apis = parseApis(optarg); break;
+        case 'A': maxAllocs = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s host:port] [-n instances] [-d seconds] [-q depth] [-k] [-p] [-t] [-b samples] [-a apis] [-A allocs]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (apis.empty())
+    {
+        fprintf(stderr, "no API selected\n");
+        return 2;
+    }
+    setenv("ATS_HOST_SERVER", server, 1);
+
+    std::vector<std::unique_ptr<Instance>> pool;
+    for (int i = 0; i < instances; i++)
+    {
+        pool.emplace_back(new Instance);
+        Instance& in = *pool.back();
+        in.channel = 1000 + i;
+        in.key = std::to_string(in.channel); // ts_mock takes the key as the channel
+        in.next = i;                         // Spread the APIs over the instances
+        in.ats.begin(in.client);
+        in.ats.setKeepAlive(keepAlive);
+        in.ats.setPipelining(pipelining, depth);
+        in.ats.setBatchLimits(0, 0, 0);
+        in.ats.setLatencyStats(true);
+        if (templates)
+            in.ats.registerChannel(in.channel, NULL, in.key.c_str()); // The reads are public
+    }
+
+    // Something to read back.
+    for (auto& in : pool)
+    {
+        bool done = false;
+        in->ats.setField(2, 42);
+        in->ats.writeFields(in->channel, in->key.c_str(), [&done](int)
+                            { done = true; });
+        while (!done)
+            hostLoop(10);
+        in->ats.resetLatencyStats();
+#if ATS_ALLOC_STATS
+        in->ats.resetAllocStats();
+#endif
+    }
+
+    printf("ats_bench: %d instances, depth %d, %s%s, %u s against %s\n", instances, depth,
+           keepAlive ? "keep-alive" : "close", pipelining ? " pipelined" : "", seconds, server);
+    uint32_t begin = millis();
+    while (millis() - begin < seconds * 1000)
+    {
+        for (auto& in : pool)
+        {
+            while (in->outstanding < depth)
+            {
+                benchApi api = apis[in->next % apis.size()];
+                uint32_t completed = in->completed;
+                in->outstanding++;
+                if (!issue(*in, api))
+                {
+                    if (in->completed == completed)
+                    {
+                        // Not ready or the queue is full, try again after the loop.
+                        in->outstanding--;
+                        stats[api].rejected++;
+                    }
+                    break;
+                }
+                in->next++;
+            }
+        }
+        hostLoop(10);
+    }
+    uint32_t elapsed = millis() - begin;
+    // Let the outstanding requests complete, so they are not counted as lost.
+    uint32_t drain = millis();
+    for (;;)
+    {
+        int outstanding = 0;
+        for (auto& in : pool)
+            outstanding += in->outstanding;
+        if (!outstanding || millis() - drain > 10000)
+            break;
+        hostLoop(10);
+    }
+
+    printf("%-8s %9s %7s %8s %10s %9s %9s %9s\n", "api", "ok", "errors", "rejected", "req/s", "p50 ms", "p99 ms", "p999 ms");
+    std::vector<uint32_t> all;
+    uint32_t errors = 0;
+    for (int i = 0; i < API_COUNT; i++)
+    {
+        ApiStats& s = stats[i];
+        if (s.latency.empty() && !s.errors && !s.rejected)
+            continue;
+        std::sort(s.latency.begin(), s.latency.end());
+        all.insert(all.end(), s.latency.begin(), s.latency.end());
+        errors += s.errors;
+        printf("%-8s %9zu %7u %8u %10.1f %9.3f %9.3f %9.3f\n", apiNames[i], s.latency.size(), s.errors, s.rejected,
+               s.latency.size() * 1000.0 / elapsed, percentile(s.latency, 0.5) / 1000.0,
+               percentile(s.latency, 0.99) / 1000.0, percentile(s.latency, 0.999) / 1000.0);
+        for (auto& code : s.codes)
+            printf("         code %d: %u\n", code.first, code.second);
+    }
+    std::sort(all.begin(), all.end());
+    printf("%-8s %9zu %7u %8s %10.1f %9.3f %9.3f %9.3f\n", "all", all.size(), errors, "",
+           all.size() * 1000.0 / elapsed, percentile(all, 0.5) / 1000.0, percentile(all, 0.99) / 1000.0,
+           percentile(all, 0.999) / 1000.0);
+
+    uint32_t connects = 0, reuses = 0;
+    for (auto& in : pool)
+    {
+        connects += in->ats.getConnectCount();
+        reuses += in->ats.getReuseCount();
+    }
+    printf("connections: %u opened, %u reused\n", connects, reuses);
+    if (bulkUpdates)
+        printf("bulk body per update of %u samples: %.1f bytes as JSON, %.1f bytes as CSV\n", bulkSamples,
+               (double)bulkBytes[0] / bulkUpdates, (double)bulkBytes[1] / bulkUpdates);
+
+    // Where the time goes, merged over the instances.
+    static const char* latencyApis[ATS_LATENCY_APIS] = {"write", "read", "raw"};
+    printf("\n%-8s %-22s %-22s %-22s %-22s %-22s\n", "p50/p99", "queue ms", "connect ms", "first byte ms", "headers ms", "body ms");
+    for (int api = 0; api < ATS_LATENCY_APIS; api++)
+    {
+        tsLatencyHistogram merged[ATS_LATENCY_SPANS] = {};
+        for (auto& in : pool)
+        {
+            for (int span = 0; span < ATS_LATENCY_SPANS; span++)
+            {
+                const tsLatencyHistogram* h = in->ats.getLatencyHistogram((AsyncTS::latencyApi)api, (AsyncTS::latencySpan)span);
+                AsyncTS::mergeLatency(merged[span], *h);
+            }
+        }
+        if (!merged[AsyncTS::SPAN_TOTAL].count)
+            continue;
+        printf("%-8s", latencyApis[api]);
+        for (int span = AsyncTS::SPAN_QUEUE; span < AsyncTS::SPAN_TOTAL; span++)
+        {
+            latencySummary summary = AsyncTS::summarizeLatency(merged[span]);
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%.3f/%.3f", summary.p50 / 1000.0, summary.p99 / 1000.0);
+            printf(" %-22s", cell);
+        }
+        printf("\n");
+    }
+
+    int result = errors ? 1 : 0;
+#if ATS_ALLOC_STATS
+    // Allocations of the library per request, the run fails if they grow over -A.
+    printf("\n%-8s %9s %11s %11s %10s\n", "heap", "requests", "allocs/req", "bytes/req", "peak segs");
+    for (int api = 0; api < ATS_LATENCY_APIS; api++)
+    {
+        allocStats total = {};
+        for (auto& in : pool)
+        {
+            allocStats a = in->ats.getAllocStats((AsyncTS::latencyApi)api);
+            total.requests += a.requests;
+            total.allocs += a.allocs;
+            total.bytes += a.bytes;
+            total.peakSegments = std::max(total.peakSegments, a.peakSegments);
+        }
+        if (!total.requests)
+            continue;
+        double allocs = (double)total.allocs / total.requests;
+        printf("%-8s %9u %11.1f %11.1f %10u\n", latencyApis[api], total.requests, allocs,
+               (double)total.bytes / total.requests, total.peakSegments);
+        if (maxAllocs > 0 && allocs > maxAllocs)
+        {
+            printf("FAIL: %s requests need %.1f allocations, the limit is %.1f\n", latencyApis[api], allocs, maxAllocs);
+            result = 3;
+        }
+    }
+#else
+    if (maxAllocs > 0)
+        fprintf(stderr, "-A needs a build with ATS_ALLOC_STATS\n");
+#endif
+    return result;
+}
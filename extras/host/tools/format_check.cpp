@@ -0,0 +1,150 @@
+/*
+format_check - compare the number formatting of AsyncTS with printf, and time it.
+
+    ./build/format_check [-d decimals] [-s stride] [-x] [-b]
+
+    -d  Decimals of the float check, default 5 and 6 (setField() and the location)
+    -s  Check every stride-th float bit pattern and int, default 251
+    -x  Exhaustive: every float bit pattern and every 32-bit int (minutes per decimals)
+    -b  Microbenchmark instead of the check
+
+Exits with 1 at the first mismatch.
+*/
+
+#include <AsyncTSFormat.h>
+#include <unistd.h>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+static bool checkFloat(uint32_t bits, int decimals)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    if (std::isnan(value))
+        return true; // The sign of NaN is printed differently by the libc versions.
+    char expected[ATS_FORMAT_FLOAT_SIZE + 16];
+    char got[ATS_FORMAT_FLOAT_SIZE];
+    snprintf(expected, sizeof(expected), "%.*f", decimals, (double)value);
+    size_t len = atsFormatFloat(got, value, decimals);
+    if (len == strlen(got) && strcmp(expected, got) == 0)
+        return true;
+    printf("MISMATCH float 0x%08x %.9g decimals %d: printf \"%s\" ats \"%s\" (%zu)\n", bits, value, decimals, expected, got, len);
+    return false;
+}
+
+static bool checkLong(long value)
+{
+    char expected[32];
+    char got[ATS_FORMAT_INT_SIZE];
+    snprintf(expected, sizeof(expected), "%ld", value);
+    size_t len = atsFormatLong(got, value);
+    if (len == strlen(got) && strcmp(expected, got) == 0)
+        return true;
+    printf("MISMATCH long %ld: printf \"%s\" ats \"%s\"\n", value, expected, got);
+    return false;
+}
+
+static int check(const std::vector<int>& decimals, uint64_t stride)
+{
+    // Edges: zeros, ties, rounding carries, the limits of the kernel.
+    const float edges[] = {0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -2.5f, 0.125f, 0.375f, 9.999995f, 99.999999f, 0.000005f,
+                           1e-6f, 1e-7f, 1e-8f, 1e-30f, 1.4e-45f, 999999000000.0f, -999999000000.0f, 1.8e12f,
+                           1.9e12f, 1e13f, 3.4e38f, INFINITY, -INFINITY};
+    for (int d = 0; d <= ATS_FLOAT_DECIMALS_MAX; d++)
+    {
+        for (float edge : edges)
+        {
+            uint32_t bits;
+            memcpy(&bits, &edge, sizeof(bits));
+            for (int delta = -2; delta <= 2; delta++)
+            {
+                if (!checkFloat(bits + delta, d))
+                    return 1;
+            }
+        }
+    }
+    const long longs[] = {0, 1, -1, 9, 10, 99, 100, 4294967295L, 4294967296L, 999999999, 1000000000,
+                          LONG_MAX, LONG_MIN, LONG_MAX - 1, LONG_MIN + 1};
+    for (long value : longs)
+    {
+        if (!checkLong(value))
+            return 1;
+    }
+
+    uint64_t checked = 0;
+    for (int d : decimals)
+    {
+        for (uint64_t bits = 0; bits <= UINT32_MAX; bits += stride, checked++)
+        {
+            if (!checkFloat((uint32_t)bits, d))
+                return 1;
+        }
+        printf("floats with %d decimals: ok\n", d);
+    }
+    for (uint64_t i = 0; i <= UINT32_MAX; i += stride, checked++)
+    {
+        // Every 32-bit int, and the same pattern shifted over the 64-bit range.
+        if (!checkLong((int32_t)i) || !checkLong((long)(i * 2147483649ULL)))
+            return 1;
+    }
+    printf("integers: ok\n%llu values checked\n", (unsigned long long)checked);
+    return 0;
+}
+
+template <typename F>
+static double timeIt(F f, int rounds)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        f(i);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / rounds;
+}
+
+static int bench()
+{
+    const int rounds = 2000000;
+    char buf[64];
+    volatile size_t sink = 0;
+    // Sensor-like values: a few digits before the point.
+    auto sensor = [](int i) { return (float)(((unsigned)i * 7919u) % 200000) / 1000.0f - 50.0f; };
+    printf("%-34s %8s\n", "ns per call", "ns");
+    printf("%-34s %8.1f\n", "dtostrf(value, 1, 5)", timeIt([&](int i) { dtostrf(sensor(i), 1, 5, buf); sink += buf[0]; }, rounds));
+    printf("%-34s %8.1f\n", "snprintf(\"%.5f\")", timeIt([&](int i) { sink += snprintf(buf, sizeof(buf), "%.5f", sensor(i)); }, rounds));
+    printf("%-34s %8.1f\n", "atsFormatFloat(value, 5)", timeIt([&](int i) { sink += atsFormatFloat(buf, sensor(i), 5); }, rounds));
+    printf("%-34s %8.1f\n", "String(value, 6)", timeIt([&](int i) { sink += String(sensor(i), 6).length(); }, rounds));
+    printf("%-34s %8.1f\n", "atsFormatFloat(value, 6)", timeIt([&](int i) { sink += atsFormatFloat(buf, sensor(i), 6); }, rounds));
+    printf("%-34s %8.1f\n", "ltoa(value)", timeIt([&](int i) { ltoa(i * 7919L - 1000000, buf, 10); sink += buf[0]; }, rounds));
+    printf("%-34s %8.1f\n", "atsFormatLong(value)", timeIt([&](int i) { sink += atsFormatLong(buf, i * 7919L - 1000000); }, rounds));
+    return sink == 0;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<int> decimals;
+    uint64_t stride = 251;
+    bool benchmark = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:xb")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': decimals.push_back(atoi(optarg)); break;
+        case 's': stride = strtoull(optarg, nullptr, 10); break;
+        case 'x': stride = 1; break;
+        case 'b': benchmark = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-d decimals] [-s stride] [-x] [-b]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (benchmark)
+        return bench();
+    if (decimals.empty())
+        decimals = {5, 6};
+    if (!stride)
+        stride = 1;
+    return check(decimals, stride);
+}
@@ -0,0 +1,222 @@
+/*
+json_check - check the JSON tokenizer of AsyncTS, and time it against the old key search.
+
+    ./build/json_check [-b]
+
+    -b  Benchmark of decoding a readMultipleFields() response instead of the check
+
+Exits with 1 at the first mismatch.
+*/
+
+#include <AsyncTS.hpp>
+#include <AsyncTSJson.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <string>
+
+typedef std::map<std::string, std::string> members;
+
+static void collect(void *context, const char *key, const char *value, size_t len)
+{
+    (*(members *)context)[key] = value ? std::string(value, len) : std::string("<null>");
+}
+
+static members parseSlices(const std::string &json, size_t split)
+{
+    members got;
+    AsyncTSJson tokenizer(collect, &got);
+    tokenizer.parse(json.data(), split);
+    tokenizer.parse(json.data() + split, json.size() - split);
+    return got;
+}
+
+static std::string show(const members &m)
+{
+    std::string out;
+    for (auto &kv : m)
+        out += kv.first + "=" + kv.second + " ";
+    return out;
+}
+
+static bool expect(const char *json, const members &expected)
+{
+    std::string text(json);
+    // Every cut in two slices, and the segments of a small xbuf.
+    for (size_t split = 0; split <= text.size(); split++)
+    {
+        members got = parseSlices(text, split);
+        if (got != expected)
+        {
+            printf("MISMATCH %s split at %zu:\n  got      %s\n  expected %s\n", json, split, show(got).c_str(), show(expected).c_str());
+            return false;
+        }
+    }
+    xbuf buf(8);
+    buf.write(json);
+    members got;
+    AsyncTSJson tokenizer(collect, &got);
+    tokenizer.parse(buf);
+    if (got != expected || buf.available() != text.size())
+    {
+        printf("MISMATCH %s from xbuf:\n  got      %s\n  expected %s\n", json, show(got).c_str(), show(expected).c_str());
+        return false;
+    }
+    return true;
+}
+
+static const char feedEntry[] =
+    "{\"created_at\":\"2024-01-31T10:20:30Z\",\"entry_id\":4242,\"field1\":\"21.50000\",\"field2\":\"45.20000\","
+    "\"field3\":\"1013.25000\",\"field4\":null,\"field5\":\"on\",\"field6\":\"3\",\"field7\":\"-0.12500\","
+    "\"field8\":\"text \\\"with\\\" quotes\",\"latitude\":\"47.497913\",\"longitude\":\"19.040236\","
+    "\"elevation\":\"96\",\"status\":\"all good\"}";
+
+static int check()
+{
+    bool ok = expect(feedEntry, {{"created_at", "2024-01-31T10:20:30Z"}, {"entry_id", "4242"}, {"field1", "21.50000"},
+                                 {"field2", "45.20000"}, {"field3", "1013.25000"}, {"field4", "<null>"}, {"field5", "on"},
+                                 {"field6", "3"}, {"field7", "-0.12500"}, {"field8", "text \"with\" quotes"},
+                                 {"latitude", "47.497913"}, {"longitude", "19.040236"}, {"elevation", "96"},
+                                 {"status", "all good"}}) &&
+              expect("{ \"a\" : \"x\\\\y\\/z\" , \"b\" : -1.5e3 ,\n \"c\":true,\"d\":null }",
+                     {{"a", "x\\y/z"}, {"b", "-1.5e3"}, {"c", "true"}, {"d", "<null>"}}) &&
+              expect("{\"e\":\"\\b\\f\\n\\r\\t\"}", {{"e", "\b\f\n\r\t"}}) &&
+              expect("{\"u\":\"caf\\u00e9 \\u20AC \\ud83d\\ude00 \\u0041\"}", {{"u", "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 A"}}) &&
+              expect("{\"u\":\"\\ud83d-\\ude00\"}", {{"u", "\xef\xbf\xbd-\xef\xbf\xbd"}}) &&
+              expect("{\"u\":\"\\ud83d\\ud83d\\ude00\"}", {{"u", "\xef\xbf\xbd\xf0\x9f\x98\x80"}}) &&
+              expect("{\"u\":\"\\ud83d\"}", {{"u", "\xef\xbf\xbd"}}) &&
+              expect("{\"n\":{\"x\":\"}\",\"y\":[1,{\"z\":2}]},\"a\":[\"]\"],\"k\":\"v\"}", {{"k", "v"}}) &&
+              expect("{\"a_key_longer_than_the_buffer\":\"skipped\",\"k\":\"\"}", {{"k", ""}}) &&
+              expect("{\"k\":\"v\"} {\"k\":\"after\"}", {{"k", "v"}}) &&
+              expect("-1", {}) && expect("", {}) && expect("{}", {});
+    if (!ok)
+        return 1;
+
+    std::string longValue(ATS_JSON_VALUE_MAX + 20, 'x');
+    std::string json = "{\"k\":\"" + longValue + "\"}";
+    if (!expect(json.c_str(), {{"k", longValue.substr(0, ATS_JSON_VALUE_MAX)}}))
+        return 1;
+    printf("json: ok\n");
+    return 0;
+}
+
+// The search of readMultipleFields() before the tokenizer, one scan per key.
+static String parseValues(String &multiContent, String key)
+{
+    if (multiContent.length() == 0)
+    {
+        return String("");
+    }
+
+    String searchPhrase = String("\"");
+    searchPhrase.concat(key);
+    searchPhrase.concat("\":\"");
+
+    int fromPosition = multiContent.indexOf(searchPhrase, 0);
+
+    if (fromPosition == -1)
+    {
+        return String("");
+    }
+
+    fromPosition = fromPosition + searchPhrase.length();
+
+    int toPosition = multiContent.indexOf("\"", fromPosition);
+
+    if (toPosition == -1)
+    {
+        return String("");
+    }
+
+    return multiContent.substring(fromPosition, toPosition);
+}
+
+static void feedMember(void *context, const char *key, const char *value, size_t len)
+{
+    feed *entry = (feed *)context;
+    if (!value)
+        return;
+    if (!memcmp(key, "field", 5) && key[5] >= '1' && key[5] <= '8' && !key[6])
+        entry->nextReadField[key[5] - '1'] = value;
+    else if (!strcmp(key, "created_at"))
+        entry->nextReadCreatedAt = value;
+    else if (!strcmp(key, "entry_id"))
+        entry->nextReadEntryId = strtoul(value, nullptr, 10);
+    else if (!strcmp(key, "status"))
+        entry->nextReadStatus = value;
+    else if (!strcmp(key, "latitude"))
+        entry->nextReadLatitude = value;
+    else if (!strcmp(key, "longitude"))
+        entry->nextReadLongitude = value;
+    else if (!strcmp(key, "elevation"))
+        entry->nextReadElevation = value;
+}
+
+template <typename F>
+static void timeIt(const char *name, F f, int rounds)
+{
+#if ATS_ALLOC_STATS
+    atsHeapCount before = atsHeapCounter();
+#endif
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        f();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    printf("%-34s %10.1f", name, elapsed.count() / rounds);
+#if ATS_ALLOC_STATS
+    atsHeapCount after = atsHeapCounter();
+    printf(" %10.1f %10.1f", (double)(after.allocs - before.allocs) / rounds, (double)(after.bytes - before.bytes) / rounds);
+#endif
+    printf("\n");
+}
+
+static int bench()
+{
+    const int rounds = 200000;
+    static const char *const keys[] = {"field1", "field2", "field3", "field4", "field5", "field6", "field7",
+                                       "field8", "created_at", "latitude", "longitude", "elevation", "status"};
+    volatile size_t sink = 0;
+    feed entry;
+    printf("%-34s %10s %10s %10s\n", "per response", "ns", "allocs", "bytes");
+    // The response arrives in an xbuf in both cases, like _body.
+    timeIt("_parseValues x13 (String body)", [&]() {
+        xbuf body;
+        body.write(feedEntry);
+        String multiContent = body.readString();
+        for (int k = 0; k < 8; k++)
+            entry.nextReadField[k] = parseValues(multiContent, keys[k]);
+        entry.nextReadCreatedAt = parseValues(multiContent, keys[8]);
+        entry.nextReadLatitude = parseValues(multiContent, keys[9]);
+        entry.nextReadLongitude = parseValues(multiContent, keys[10]);
+        entry.nextReadElevation = parseValues(multiContent, keys[11]);
+        entry.nextReadStatus = parseValues(multiContent, keys[12]);
+        sink += entry.nextReadField[0].length();
+    }, rounds);
+    timeIt("AsyncTSJson (xbuf segments)", [&]() {
+        xbuf body;
+        body.write(feedEntry);
+        entry = feed();
+        AsyncTSJson json(feedMember, &entry);
+        json.parse(body);
+        body.flush();
+        sink += entry.nextReadField[0].length();
+    }, rounds);
+    return sink == 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool benchmark = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': benchmark = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+            return 2;
+        }
+    }
+    return benchmark ? bench() : check();
+}
@@ -0,0 +1,331 @@
+/*
+spool_check - check what AsyncTSSpool::begin() recovers from a damaged log.
+
+    ./build/spool_check [-p path] [-s host:port -x status]
+
+    -p  Path of the log under test, default /tmp/spool_check.log
+    -s  Also drain a spool to ts_mock at host:port
+    -x  Status the mock answers the bulk updates with (its -x), 202 by default
+
+Writes a log, then truncates, corrupts and commits it in every way a power
+loss can leave it, and compares the records read back after begin() with
+the ones written. With -s, AsyncTS spools writes while the server can't be
+reached, then drains them to the mock after a restart: the records are sent
+on 202, dropped on a refusal (4xx but 429), and kept on 429 or 5xx. Exits
+with 1 at the first mismatch.
+*/
+
+#include <AsyncTS.h>
+#include <AsyncTSSpool.h>
+#include <AsyncHost.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define RECORDS 5
+#define FRAME 8 // magic, type, length, CRC-32 around every payload
+
+static std::string path = "/tmp/spool_check.log";
+
+static std::string payload(int i)
+{
+    // Different lengths, so a cut lands on every part of the frames.
+    return "record " + std::to_string(i) + std::string(i * 7, 'a' + i);
+}
+
+static size_t fileSize()
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static std::string load()
+{
+    std::string data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return data;
+    char chunk[256];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        data.append(chunk, n);
+    fclose(f);
+    return data;
+}
+
+static void store(const std::string &data)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+static bool append(AsyncTSSpool &spool, const std::string &text)
+{
+    xbuf data(32);
+    data.write((const uint8_t *)text.data(), text.size());
+    return spool.append(data, text.size());
+}
+
+// A fresh log of the records first..last-1.
+static std::string build(int first, int last)
+{
+    ::remove(path.c_str());
+    AsyncTSSpool spool(path.c_str(), 4096);
+    spool.begin();
+    for (int i = first; i < last; i++)
+        append(spool, payload(i));
+    return load();
+}
+
+static std::vector<std::string> readAll(AsyncTSSpool &spool)
+{
+    std::vector<std::string> got;
+    size_t offset = spool.head();
+    xbuf data(32);
+    while (spool.read(offset, data))
+    {
+        got.push_back(std::string(data.readString().c_str()));
+    }
+    return got;
+}
+
+/**
+ * @brief Open the log as after a restart and check the recovered records.
+*/
+static bool expect(const char *what, int first, int last, uint32_t corrupt)
+{
+    AsyncTSSpool spool(path.c_str(), 4096);
+    if (!spool.begin())
+    {
+        printf("MISMATCH %s: begin() failed\n", what);
+        return false;
+    }
+    std::vector<std::string> expected;
+    size_t size = 0;
+    for (int i = first; i < last; i++)
+    {
+        expected.push_back(payload(i));
+        size += FRAME + payload(i).size();
+    }
+    std::vector<std::string> got = readAll(spool);
+    spoolStats stats = spool.getStats();
+    // The log is compacted to the unsent records, or removed if there is none.
+    if (got != expected || stats.recovered != expected.size() || stats.corrupt != corrupt ||
+        spool.size() != size || fileSize() != size || spool.head() != 0 || spool.pending() != !expected.empty())
+    {
+        printf("MISMATCH %s: %zu records (expected %zu), recovered %u, corrupt %u (expected %u), size %zu, file %zu (expected %zu)\n",
+               what, got.size(), expected.size(), stats.recovered, stats.corrupt, corrupt, spool.size(), fileSize(), size);
+        return false;
+    }
+    return true;
+}
+
+static bool checkRecovery()
+{
+    std::string log = build(0, RECORDS);
+    std::vector<size_t> ends; // End of every record
+    for (int i = 0, end = 0; i < RECORDS; i++)
+        ends.push_back(end += FRAME + payload(i).size());
+    if (log.size() != ends.back() || !expect("intact log", 0, RECORDS, 0))
+        return false;
+
+    // Power loss during the last append: a cut at every byte of its frame.
+    for (size_t cut = ends[RECORDS - 2]; cut < ends.back(); cut++)
+    {
+        store(log.substr(0, cut));
+        if (!expect("torn tail", 0, RECORDS - 1, cut - ends[RECORDS - 2]))
+            return false;
+    }
+    // Garbage after the last record, e.g. a block of the flash half written.
+    store(log + std::string("\xA5\x01\x30\x00garbage", 11));
+    if (!expect("garbage tail", 0, RECORDS, 11))
+        return false;
+
+    // A bit flip in a record drops it and everything after it.
+    for (size_t at = ends[1]; at < ends[2]; at++)
+    {
+        std::string damaged = log;
+        damaged[at] ^= 0x10;
+        store(damaged);
+        if (!expect("corrupted record", 0, 2, log.size() - ends[1]))
+            return false;
+    }
+    return true;
+}
+
+static bool checkCommit()
+{
+    std::string log = build(0, RECORDS);
+    size_t offset;
+    {
+        // Send the first two records.
+        AsyncTSSpool spool(path.c_str(), 4096);
+        spool.begin();
+        offset = spool.head();
+        xbuf data(32);
+        spool.read(offset, data);
+        spool.read(offset, data);
+        if (!spool.commit(offset) || spool.head() != offset || spool.getStats().sent != 2 || !spool.pending())
+        {
+            printf("MISMATCH commit: head %zu, sent %u\n", spool.head(), spool.getStats().sent);
+            return false;
+        }
+    }
+    std::string committed = load();
+    if (committed.size() != log.size() + FRAME + 4 || !expect("committed", 2, RECORDS, 0))
+        return false;
+
+    // A torn commit record is dropped, the records it covered are sent again.
+    for (size_t cut = log.size() + 1; cut < committed.size(); cut++)
+    {
+        store(committed.substr(0, cut));
+        if (!expect("torn commit", 0, RECORDS, cut - log.size()))
+            return false;
+    }
+
+    // Crash during the compaction: the temporary file is there, the log is the old one.
+    store(committed);
+    FILE *temp = fopen((path + ".tmp").c_str(), "wb");
+    fwrite(log.data(), 1, log.size() / 2, temp);
+    fclose(temp);
+    if (!expect("interrupted compaction", 2, RECORDS, 0))
+        return false;
+
+    // Everything sent: the log is removed.
+    {
+        AsyncTSSpool spool(path.c_str(), 4096);
+        spool.begin();
+        size_t end = spool.head();
+        xbuf data(32);
+        while (spool.read(end, data))
+            ;
+        if (!spool.commit(end) || spool.pending() || fileSize() != 0)
+        {
+            printf("MISMATCH commit of everything: the log is left, %zu bytes\n", fileSize());
+            return false;
+        }
+    }
+    return expect("empty", 0, 0, 0);
+}
+
+static bool checkFull()
+{
+    // Room for the first three records only.
+    size_t max = 0;
+    for (int i = 0; i < 3; i++)
+        max += FRAME + payload(i).size();
+    ::remove(path.c_str());
+    AsyncTSSpool spool(path.c_str(), max);
+    spool.begin();
+    for (int i = 0; i < 3; i++)
+        append(spool, payload(i));
+    if (append(spool, payload(3)) || spool.getStats().dropped != 1)
+    {
+        printf("MISMATCH full spool: the append wasn't refused\n");
+        return false;
+    }
+    // A commit frees room: the next append compacts the log first.
+    size_t offset = spool.head();
+    xbuf data(32);
+    spool.read(offset, data);
+    spool.read(offset, data);
+    spool.commit(offset);
+    if (!append(spool, payload(3)) || spool.head() != 0)
+    {
+        printf("MISMATCH full spool: no compaction after the commit, head %zu\n", spool.head());
+        return false;
+    }
+    return expect("compacted when full", 2, 4, 0);
+}
+
+static bool checkDrain(const char *server, int status)
+{
+    ::remove(path.c_str());
+    {
+        // Nothing listens on port 1: the writes end up in the spool.
+        setenv("ATS_HOST_SERVER", "127.0.0.1:1", 1);
+        AsyncTSSpool spool(path.c_str(), 4096);
+        spool.begin();
+        AsyncClient client;
+        AsyncTS ats;
+        ats.begin(client);
+        ats.setSpool(&spool);
+        ats.setSpoolDrain(100, 3600000);
+        for (int i = 0; i < RECORDS; i++)
+        {
+            int code = 0;
+            ats.setField(1, i);
+            if (ats.writeFields(1000, "1000", [&code](int c)
+                                { code = c; }))
+            {
+                for (uint32_t start = millis(); !code && millis() - start < 2000;)
+                    hostLoop(10);
+            }
+            if (code != TS_SPOOLED)
+            {
+                printf("MISMATCH drain: write %d got %d instead of %d\n", i, code, TS_SPOOLED);
+                return false;
+            }
+        }
+    }
+
+    // After a restart the server is there.
+    setenv("ATS_HOST_SERVER", server, 1);
+    AsyncTSSpool spool(path.c_str(), 4096);
+    spool.begin();
+    AsyncClient client;
+    AsyncTS ats;
+    ats.begin(client);
+    ats.setSpoolDrain(100, 3600000); // One drain, a kept batch waits for the next interval
+    ats.setSpool(&spool);
+    bool sent = status == 202;
+    bool rejected = status >= 400 && status < 500 && status != 429;
+    for (uint32_t start = millis(); millis() - start < 1000;)
+    {
+        spoolStats stats = spool.getStats();
+        if (stats.sent + stats.rejected >= RECORDS)
+            break;
+        hostLoop(10);
+    }
+    spoolStats stats = spool.getStats();
+    if (stats.recovered != RECORDS || stats.sent != (sent ? RECORDS : 0) || stats.rejected != (rejected ? RECORDS : 0) ||
+        spool.pending() != (!sent && !rejected))
+    {
+        printf("MISMATCH drain answered with %d: recovered %u, sent %u, rejected %u, pending %d\n", status,
+               stats.recovered, stats.sent, stats.rejected, spool.pending());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *server = nullptr;
+    int status = 202;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': path = optarg; break;
+        case 's': server = optarg; break;
+        case 'x': status = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-p path] [-s host:port -x status]\n", argv[0]);
+            return 2;
+        }
+    }
+    bool ok = checkRecovery() && checkCommit() && checkFull() && (!server || checkDrain(server, status));
+    ::remove(path.c_str());
+    ::remove((path + ".tmp").c_str());
+    if (!ok)
+        return 1;
+    printf("spool: ok\n");
+    return 0;
+}
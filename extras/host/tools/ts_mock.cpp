@@ -0,0 +1,459 @@
+/*
+ts_mock - local stand-in of the ThingSpeak API for tests and benchmarks.
+
+    ./build/ts_mock [-p port] [-l latency] [-j jitter] [-r ratelimit] [-c] [-k 0|1] [-m requests] [-x status] [-v]
+
+    -p  TCP port, 18080 by default
+    -l  Latency added to every response, in milli seconds
+    -j  Random extra latency, 0..jitter milli seconds
+    -r  Min time between /update writes of a channel in milli seconds, faster writes
+        get "0" like the rate limit of ThingSpeak (15000 for a free account). 0: off
+    -c  Send the bodies with chunked transfer encoding
+    -k  0: close the connection after every response, 1: keep it alive if the client asks (default)
+    -m  Close a kept-alive connection after this many requests, 0: never
+    -x  Answer the bulk updates with this HTTP status instead of 202, e.g. 400 as
+        for a bad row or 429 as for a busy server. The data is not stored then
+    -v  Log the requests
+
+Endpoints:
+
+    POST /update                                    entry id, or 0 if rate limited
+    POST /channels/<id>/bulk_update.json|.csv       202 {"success":true}
+    GET  /channels/<id>/fields/<n>/last             last value of the field
+    GET  /channels/<id>/feeds/last.txt              last entry as JSON
+
+The mock has no accounts: the write API key of /update is taken as the channel
+number, so write with key "<id>" and read channel <id>. Pipelined requests of a
+connection are answered in order.
+*/
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+
+#define MOCK_EVENTS 64
+#define MOCK_READ 4096
+#define MOCK_FIELDS 8
+
+struct MockOptions
+{
+    uint16_t port = 18080;
+    uint32_t latency = 0;
+    uint32_t jitter = 0;
+    uint32_t rateLimit = 0;
+    bool chunked = false;
+    bool keepAlive = true;
+    uint32_t maxRequests = 0;
+    int bulkStatus = 202;
+    bool verbose = false;
+};
+
+struct Channel
+{
+    uint32_t entryId = 0;
+    uint64_t lastUpdate = 0;
+    bool updated = false;
+    std::string field[MOCK_FIELDS];
+    std::string status;
+    std::string createdAt;
+};
+
+struct Response
+{
+    uint64_t due;           // Monotonic ms when it may be sent
+    std::string data;
+    bool close;
+};
+
+struct Connection
+{
+    std::string in;
+    std::string out;
+    std::deque<Response> pending;
+    uint32_t requests = 0;
+    bool closing = false;   // Close when out is sent
+};
+
+static MockOptions options;
+static std::map<unsigned long, Channel> channels;
+static std::map<int, Connection> connections;
+static std::mt19937 rng(1);
+static uint64_t served = 0;
+
+static uint64_t nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static std::string httpDate()
+{
+    char buf[40];
+    time_t t = time(nullptr);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+static std::string isoDate()
+{
+    char buf[24];
+    time_t t = time(nullptr);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+static std::string urlDecode(const std::string& s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '+')
+            out += ' ';
+        else if (s[i] == '%' && i + 2 < s.size())
+        {
+            out += (char)strtol(s.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        }
+        else
+            out += s[i];
+    }
+    return out;
+}
+
+static std::string jsonString(const std::string& s, bool present)
+{
+    if (!present)
+        return "null";
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string header(const std::string& headers, const char* name)
+{
+    std::string key = std::string("\r\n") + name + ":";
+    size_t at = 0;
+    while ((at = headers.find("\r\n", at)) != std::string::npos)
+    {
+        if (strncasecmp(headers.c_str() + at, key.c_str(), key.size()) == 0)
+        {
+            size_t begin = headers.find_first_not_of(' ', at + key.size());
+            size_t end = headers.find("\r\n", begin);
+            return headers.substr(begin, end - begin);
+        }
+        at += 2;
+    }
+    return "";
+}
+
+static std::string update(const std::string& apiKey, const std::string& body, int& status)
+{
+    Channel& ch = channels[strtoul(apiKey.c_str(), nullptr, 10)];
+    uint64_t now = nowMs();
+    status = 200;
+    if (options.rateLimit && ch.updated && now - ch.lastUpdate < options.rateLimit)
+        return "0";
+    ch.updated = true;
+    ch.lastUpdate = now;
+    ch.entryId++;
+    ch.createdAt = isoDate();
+    size_t at = 0;
+    while (at <= body.size())
+    {
+        size_t end = body.find('&', at);
+        if (end == std::string::npos)
+            end = body.size();
+        std::string pair = body.substr(at, end - at);
+        size_t eq = pair.find('=');
+        if (eq != std::string::npos)
+        {
+            std::string key = pair.substr(0, eq);
+            std::string value = urlDecode(pair.substr(eq + 1));
+            if (key.size() == 6 && key.compare(0, 5, "field") == 0 && key[5] >= '1' && key[5] <= '8')
+                ch.field[key[5] - '1'] = value;
+            else if (key == "status")
+                ch.status = value;
+        }
+        at = end + 1;
+    }
+    return std::to_string(ch.entryId);
+}
+
+static std::string route(const std::string& method, const std::string& path, const std::string& headers,
+                         const std::string& body, int& status)
+{
+    std::string target = path.substr(0, path.find('?'));
+    unsigned long id = 0;
+    unsigned field = 0;
+    char tail[32] = "";
+    status = 404;
+    if (method == "POST" && target == "/update")
+        return update(header(headers, "X-THINGSPEAKAPIKEY"), body, status);
+    if (method == "POST" && sscanf(target.c_str(), "/channels/%lu/%31s", &id, tail) == 2 &&
+        (strcmp(tail, "bulk_update.json") == 0 || strcmp(tail, "bulk_update.csv") == 0))
+    {
+        status = options.bulkStatus;
+        if (status != 202)
+            return "{\"success\":false}";
+        Channel& ch = channels[id];
+        ch.entryId++;
+        ch.createdAt = isoDate();
+        return "{\"success\":true}";
+    }
+    if (method == "GET" && sscanf(target.c_str(), "/channels/%lu/fields/%u/%31s", &id, &field, tail) == 3 &&
+        strcmp(tail, "last") == 0 && field >= 1 && field <= MOCK_FIELDS)
+    {
+        status = 200;
+        auto it = channels.find(id);
+        return it == channels.end() ? "-1" : it->second.field[field - 1];
+    }
+    if (method == "GET" && sscanf(target.c_str(), "/channels/%lu/feeds/%31s", &id, tail) == 2 &&
+        strcmp(tail, "last.txt") == 0)
+    {
+        status = 200;
+        auto it = channels.find(id);
+        if (it == channels.end())
+            return "-1";
+        Channel& ch = it->second;
+        std::string json = "{\"created_at\":" + jsonString(ch.createdAt, true) + ",\"entry_id\":" + std::to_string(ch.entryId);
+        for (int i = 0; i < MOCK_FIELDS; i++)
+            json += ",\"field" + std::to_string(i + 1) + "\":" + jsonString(ch.field[i], !ch.field[i].empty());
+        json += ",\"latitude\":null,\"longitude\":null,\"elevation\":null,\"status\":" + jsonString(ch.status, !ch.status.empty()) + "}";
+        return json;
+    }
+    return "Not Found";
+}
+
+static std::string respond(int status, const std::string& body, bool close)
+{
+    const char* reason = status == 200 ? "OK" : status == 202 ? "Accepted" : status == 400 ? "Bad Request"
+                       : status == 429 ? "Too Many Requests" : status >= 500 ? "Internal Server Error" : "Not Found";
+    std::string out = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+    out += "Date: " + httpDate() + "\r\n";
+    out += "Content-Type: text/plain; charset=utf-8\r\n";
+    out += close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+    if (!options.chunked)
+    {
+        out += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        return out;
+    }
+    // Two chunks, so the client has to join them.
+    out += "Transfer-Encoding: chunked\r\n\r\n";
+    size_t half = body.size() / 2;
+    char size[24];
+    for (const std::string& part : {body.substr(0, half), body.substr(half)})
+    {
+        if (part.empty())
+            continue;
+        snprintf(size, sizeof(size), "%zx\r\n", part.size());
+        out += size + part + "\r\n";
+    }
+    return out + "0\r\n\r\n";
+}
+
+// Parse the complete requests of the connection and queue their responses.
+static void parse(Connection& conn)
+{
+    while (!conn.closing)
+    {
+        size_t end = conn.in.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return;
+        std::string headers = conn.in.substr(0, end + 2);
+        size_t length = strtoul(header(headers, "Content-Length").c_str(), nullptr, 10);
+        if (conn.in.size() < end + 4 + length)
+            return;
+        std::string body = conn.in.substr(end + 4, length);
+        conn.in.erase(0, end + 4 + length);
+
+        char method[8] = "", path[256] = "";
+        sscanf(headers.c_str(), "%7s %255s", method, path);
+        int status;
+        std::string reply = route(method, path, headers, body, status);
+        conn.requests++;
+        bool close = !options.keepAlive || strcasecmp(header(headers, "Connection").c_str(), "close") == 0 ||
+                     (options.maxRequests && conn.requests >= options.maxRequests);
+        if (options.verbose)
+            fprintf(stderr, "%s %s -> %d %s\n", method, path, status, reply.c_str());
+
+        uint64_t due = nowMs() + options.latency + (options.jitter ? rng() % (options.jitter + 1) : 0);
+        if (!conn.pending.empty() && conn.pending.back().due > due)
+            due = conn.pending.back().due; // In order.
+        conn.pending.push_back({due, respond(status, reply, close), close});
+        if (close)
+            conn.closing = true;
+    }
+}
+
+static void drop(int epfd, int fd)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+// Send the due responses, return false if the connection was closed.
+static bool flush(int epfd, int fd, Connection& conn, uint64_t now)
+{
+    bool closeAfter = false;
+    while (!conn.pending.empty() && conn.pending.front().due <= now)
+    {
+        conn.out += conn.pending.front().data;
+        closeAfter = conn.pending.front().close;
+        conn.pending.pop_front();
+        served++;
+    }
+    while (!conn.out.empty())
+    {
+        ssize_t n = send(fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            drop(epfd, fd);
+            return false;
+        }
+        conn.out.erase(0, n);
+    }
+    if (conn.out.empty() && conn.closing && conn.pending.empty() && closeAfter)
+    {
+        drop(epfd, fd);
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | (conn.out.empty() ? 0 : EPOLLOUT);
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:j:r:ck:m:x:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': options.port = atoi(optarg); break;
+        case 'l': options.latency = atoi(optarg); break;
+        case 'j': options.jitter = atoi(optarg); break;
+        case 'r': options.rateLimit = atoi(optarg); break;
+        case 'c': options.chunked = true; break;
+        case 'k': options.keepAlive = atoi(optarg) != 0; break;
+        case 'm': options.maxRequests = atoi(optarg); break;
+        case 'x': options.bulkStatus = atoi(optarg); break;
+        case 'v': options.verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-l latency] [-j jitter] [-r ratelimit] [-c] [-k 0|1] [-m requests] [-x status] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 512) < 0)
+    {
+        perror("ts_mock: listen");
+        return 1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+    fprintf(stderr, "ts_mock: listening on 127.0.0.1:%u latency %u+%u ms, rate limit %u ms, %s, %s\n", options.port,
+            options.latency, options.jitter, options.rateLimit, options.chunked ? "chunked" : "content-length",
+            options.keepAlive ? "keep-alive" : "close");
+
+    struct epoll_event events[MOCK_EVENTS];
+    for (;;)
+    {
+        uint64_t now = nowMs();
+        int wait = -1;
+        for (auto& entry : connections)
+        {
+            if (!entry.second.pending.empty())
+            {
+                uint64_t due = entry.second.pending.front().due;
+                int left = due > now ? (int)(due - now) : 0;
+                wait = wait < 0 ? left : std::min(wait, left);
+            }
+        }
+        int count = epoll_wait(epfd, events, MOCK_EVENTS, wait);
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listener)
+            {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    connections[client];
+                    struct epoll_event cev = {};
+                    cev.events = EPOLLIN;
+                    cev.data.fd = client;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, client, &cev);
+                }
+                continue;
+            }
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            Connection& conn = it->second;
+            if (events[i].events & EPOLLIN)
+            {
+                char buf[MOCK_READ];
+                ssize_t n;
+                while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+                    conn.in.append(buf, n);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    drop(epfd, fd);
+                    continue;
+                }
+                parse(conn);
+            }
+            flush(epfd, fd, conn, nowMs());
+        }
+        // Responses whose latency has passed.
+        now = nowMs();
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            int fd = (it++)->first;
+            Connection& conn = connections[fd];
+            if (!conn.pending.empty() && conn.pending.front().due <= now)
+                flush(epfd, fd, conn, now);
+        }
+    }
+}
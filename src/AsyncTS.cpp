@@ -1,87 +1,127 @@
 #include "AsyncTS.hpp"
+#include "AsyncTSSpool.h"
+#include "AsyncTSJson.h"
 
-AsyncTS::AsyncTS()
+// Days since 1970-01-01 of a civil date.
+static int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d)
 {
-    _resetWriteFields();
-    _lastTSerrorcode = TS_OK_SUCCESS;
-    #ifdef ARDUINO_ARCH_ESP32
-    _xSemaphore = xSemaphoreCreateMutex();
-    #endif
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
 }
-AsyncTS::~AsyncTS()
+
+/**
+ * @brief Unix time of an HTTP date like "Sun, 06 Nov 1994 08:49:37 GMT", 0 if it can't be parsed.
+*/
+static uint32_t parseHTTPDate(const char *date)
 {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int day, year, hour, minute, second;
+    char month[4];
+    if (sscanf(date, "%*[^,], %d %3s %d %d:%d:%d", &day, month, &year, &hour, &minute, &second) != 6)
+        return 0;
+    const char *found = strstr(months, month);
+    if (!found || (found - months) % 3)
+        return 0;
+    uint32_t m = (found - months) / 3 + 1;
+    return daysFromCivil(year, m, day) * 86400UL + hour * 3600UL + minute * 60UL + second;
 }
 
- 
-int AsyncTS::_getWriteFieldsContentLength()
+/**
+ * @brief Format a Unix time as ISO 8601 in UTC, "2024-01-31T10:20:30Z". out has room for 21 characters.
+*/
+static void formatEpoch(uint32_t epoch, char *out)
 {
-    size_t iField;
-    int contentLen = 0;
-
-    for (iField = 0; iField < FIELDNUM_MAX; iField++)
-    {
-        if (this->_nextWriteField[iField].length() > 0)
-        {
-            contentLen = contentLen + 8 + this->_nextWriteField[iField].length(); // &fieldX=[value]
-
-            // future-proof in case ThingSpeak allows 999 fields someday
-            if (iField > 9)
-            {
-                contentLen = contentLen + 1;
-            }
-            else if (iField > 99)
-            {
-                contentLen = contentLen + 2;
-            }
-        }
-    }
-
-    if (!isnan(this->_nextWriteLatitude))
-    {
-        contentLen = contentLen + 5 + String(this->_nextWriteLatitude,6).length(); // &lat=[value]
-    }
-
-    if (!isnan(this->_nextWriteLongitude))
-    {
-        contentLen = contentLen + 6 + String(this->_nextWriteLongitude,6).length(); // &long=[value]
-    }
+    int32_t z = epoch / 86400 + 719468;
+    int32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int32_t y = yoe + era * 400;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t d = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t t = epoch % 86400;
+    sprintf(out, "%04ld-%02lu-%02luT%02lu:%02lu:%02luZ", (long)(y + (m <= 2)), (unsigned long)m, (unsigned long)d,
+            (unsigned long)(t / 3600), (unsigned long)(t / 60 % 60), (unsigned long)(t % 60));
+}
 
-    if (!isnan(this->_nextWriteElevation))
-    {
-        contentLen = contentLen + 11 + String(this->_nextWriteElevation,6).length(); // &elevation=[value]
-    }
 
-    if (this->_nextWriteStatus.length() > 0)
-    {
-        contentLen = contentLen + 8 + this->_nextWriteStatus.length(); // &status=[value]
-    }
+// Index of a text item of a write in tsWriteRecord::value.
+static inline uint8_t valueIndex(uint8_t item)
+{
+    return item < WRITE_ITEM_LATITUDE ? item : item - 3;
+}
 
-    if (this->_nextWriteTwitter.length() > 0)
+/**
+ * @brief Stage a text item of a write. An empty value unsets the item.
+ * @param value Terminated string of len bytes, at most FIELDLENGTH_MAX.
+*/
+static void setWriteValue(tsWriteRecord &write, uint8_t item, const char *value, size_t len)
+{
+    if (!len)
     {
-        contentLen = contentLen + 9 + this->_nextWriteTwitter.length(); // &twitter=[value]
+        write.set &= ~(1 << item);
+        return;
     }
-
-    if (this->_nextWriteTweet.length() > 0)
+    tsWriteValue &slot = write.value[valueIndex(item)];
+    if (len <= ATS_VALUE_INLINE)
     {
-        contentLen = contentLen + 7 + this->_nextWriteTweet.length(); // &tweet=[value]
+        memcpy(slot.text, value, len);
+        slot.text[len] = 0;
     }
+    else
+        slot.spill = value;
+    slot.length = len;
+    write.set |= 1 << item;
+}
 
-    if (this->_nextWriteCreatedAt.length() > 0)
-    {
-        contentLen = contentLen + 12 + this->_nextWriteCreatedAt.length(); // &created_at=[value]
-    }
+// Text of a staged value.
+static inline const char *writeValueText(const tsWriteValue &slot)
+{
+    return slot.length <= ATS_VALUE_INLINE ? slot.text : slot.spill.c_str();
+}
 
-    if (contentLen == 0)
+/**
+ * @brief Stage the latitude, longitude or elevation of a write. NAN unsets the item.
+*/
+static void setWriteLocation(tsWriteRecord &write, uint8_t item, float value)
+{
+    if (isnan(value))
     {
-        return 0;
+        write.set &= ~(1 << item);
+        return;
     }
+    write.location[item - WRITE_ITEM_LATITUDE] = value;
+    write.set |= 1 << item;
+}
 
-    contentLen = contentLen + 13; // add 14 for '&headers=false', subtract 1 for missing first '&'
 
-    return contentLen;
+AsyncTS::AsyncTS()
+{
+    _resetWriteFields();
+    memset(_fieldPrecision, DEFAULT_FIELD_DECIMALS, sizeof(_fieldPrecision));
+    _lastTSerrorcode = TS_OK_SUCCESS;
+    #ifdef ARDUINO_ARCH_ESP32
+    _xSemaphore = xSemaphoreCreateRecursiveMutex();
+    #endif
+}
+AsyncTS::~AsyncTS()
+{
+    delete _latency;
 }
 
-int AsyncTS::_convertFloatToChar(float value, char *valueString)
+ 
+/**
+ * @brief Format a float field value.
+ * @param decimals Digits right of the decimal point, see setFieldPrecision().
+ * @param valueString At least ATS_FORMAT_FLOAT_SIZE bytes.
+ * @return TS_OK_SUCCESS, or TS_ERR_OUT_OF_RANGE.
+*/
+int AsyncTS::_convertFloatToChar(float value, uint8_t decimals, char *valueString)
 {
     // Supported range is -999999000000 to 999999000000
     if (0 == isinf(value) && (value > 999999000000 || value < -999999000000))
@@ -89,13 +129,7 @@ int AsyncTS::_convertFloatToChar(float value, char *valueString)
         // Out of range
         return TS_ERR_OUT_OF_RANGE;
     }
-    // assume that 5 places right of decimal should be sufficient for most applications
-
-#if defined(ARDUINO_ARCH_SAMD) || defined(ARDUINO_ARCH_SAM)
-    sprintf(valueString, "%.5f", value);
-#else
-    dtostrf(value, 1, 5, valueString);
-#endif
+    atsFormatFloat(valueString, value, decimals);
     _lastTSerrorcode = TS_OK_SUCCESS;
     return TS_OK_SUCCESS;
 }
@@ -106,17 +140,29 @@ bool AsyncTS::_connectThingSpeak()
 
     if (!_client->connected())
     {
-        if (!_client->connect(THINGSPEAK_URL, _port))
+        _connectStart = millis();
+#if ASYNC_TCP_SSL_ENABLED
+        bool connecting = _secure ? _client->connect(THINGSPEAK_URL, _port, true) : _client->connect(THINGSPEAK_URL, _port);
+#else
+        bool connecting = _client->connect(THINGSPEAK_URL, _port);
+#endif
+        if (!connecting)
         {
             DEBUG_ATS("!client.connect failed\r\n");
             _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
             _setState(DISCONNECTED);
             return false;
         }
+        _connectCount++;
         _setState(CONNECTING);
+        _setPhase(PHASE_CONNECT);
     }
     else
     {
+        DEBUG_ATS("ats::_connectThingSpeak() reuse kept-alive connection.\r\n");
+        _reuseCount++;
+        if (_secure)
+            _tlsStats.keptAliveRequests++;
         _onConnect(_client);
     }
     _lastActivity = millis();
@@ -125,35 +171,151 @@ bool AsyncTS::_connectThingSpeak()
 
 bool AsyncTS::_writeHTTPHeader(const char *APIKey)
 {
-    _request.write("Host: api.thingspeak.com\r\n");
-    _request.write("User-Agent: ");
-    _request.write(TS_USER_AGENT);
-    _request.write("\r\n");
+    return _writeHTTPHeader(_request, APIKey);
+}
+
+bool AsyncTS::_writeHTTPHeader(xbuf &out, const char *APIKey)
+{
+    out.write("Host: api.thingspeak.com\r\n");
+    out.write("User-Agent: ");
+    out.write(TS_USER_AGENT);
+    out.write("\r\n");
 
     if (NULL != APIKey)
     {
-        _request.write("X-THINGSPEAKAPIKEY: ");
-        _request.write(APIKey);
-        _request.write("\r\n");
+        out.write("X-THINGSPEAKAPIKEY: ");
+        out.write(APIKey);
+        out.write("\r\n");
     }
+    out.write(_keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
     return true;
 }
 
+// Is key the API key registered as registered? NULL and "" are the same, no key.
+static bool sameKey(const String &registered, const char *key)
+{
+    return key ? registered == key : registered.length() == 0;
+}
+
+/**
+ * @brief Write the request line and the headers of a form POST to /update into _request.
+ * 
+ * The head of a registered channel is copied in one piece, see registerChannel().
+ * @param channelNumber Channel number
+ * @param writeAPIKey Write API key associated with the channel.
+ * @param contentLen Size of the form which follows.
+*/
+void AsyncTS::_writeFormHeader(unsigned long channelNumber, const char *writeAPIKey, size_t contentLen)
+{
+    char length[ATS_FORMAT_INT_SIZE];
+    size_t len = atsFormatULong(length, contentLen);
+
+    tsChannelTemplate *entry = _channelTemplate(channelNumber);
+    if (entry && sameKey(entry->writeAPIKey, writeAPIKey))
+        _request.write((const uint8_t *)entry->writeHead.c_str(), entry->writeHead.length());
+    else
+    {
+        _request.write("POST /update HTTP/1.1\r\n");
+        _writeHTTPHeader(writeAPIKey);
+        _request.write("Content-Type: application/x-www-form-urlencoded\r\n");
+        _request.write("Content-Length: ");
+    }
+    _request.write((const uint8_t *)length, len);
+    _request.write("\r\n\r\n");
+}
 
+/**
+ * @brief Find the pre-rendered request heads of a channel.
+ * @return nullptr if the channel is not registered.
+*/
+tsChannelTemplate *AsyncTS::_channelTemplate(unsigned long channelNumber)
+{
+    for (tsChannelTemplate &entry : _templates)
+    {
+        if (entry.channelNumber == channelNumber && channelNumber)
+            return &entry;
+    }
+    return nullptr;
+}
 
-void AsyncTS::_resetWriteFields()
+/**
+ * @brief Render the request heads of a registered channel with the current keep-alive setting.
+*/
+void AsyncTS::_renderTemplate(tsChannelTemplate &entry)
 {
-    for (size_t iField = 0; iField < FIELDNUM_MAX; iField++)
+    const char *readAPIKey = entry.readAPIKey.length() ? entry.readAPIKey.c_str() : NULL;
+    const char *writeAPIKey = entry.writeAPIKey.length() ? entry.writeAPIKey.c_str() : NULL;
+    char number[ATS_FORMAT_INT_SIZE];
+    xbuf head;
+
+    head.write("POST /update HTTP/1.1\r\n");
+    _writeHTTPHeader(head, writeAPIKey);
+    head.write("Content-Type: application/x-www-form-urlencoded\r\n");
+    head.write("Content-Length: ");
+    entry.writeHead = head.readString();
+
+    head.write("GET /channels/");
+    head.write((const uint8_t *)number, atsFormatULong(number, entry.channelNumber));
+    entry.readHead = head.readString();
+
+    head.write(" HTTP/1.1\r\n");
+    _writeHTTPHeader(head, readAPIKey);
+    head.write("\r\n");
+    entry.readTail = head.readString();
+}
+
+/**
+ * @brief Register the API keys of a channel, and render the constant heads of its requests once.
+ * 
+ * The reads and the form writes (writeField(), writeFields(), writeRaw()) of a registered channel
+ * copy the pre-rendered request line and headers in one piece, only the path suffix,
+ * Content-Length and the body are written per request. Requests with other keys than the
+ * registered ones are built as usual.
+ * @param channelNumber Channel number
+ * @param readAPIKey Read API key of the channel, NULL for a public channel.
+ * @param writeAPIKey Write API key of the channel, NULL if it is not written.
+ * @retval false: ATS_REGISTERED_CHANNELS channels are registered already.
+ * @retval true: the channel is registered.
+*/
+bool AsyncTS::registerChannel(unsigned long channelNumber, const char *readAPIKey, const char *writeAPIKey)
+{
+    DEBUG_ATS("ats::registerChannel(%lu)\r\n", channelNumber);
+    if (!channelNumber)
+        return false;
+    tsChannelTemplate *entry = _channelTemplate(channelNumber);
+    for (size_t i = 0; !entry && i < ATS_REGISTERED_CHANNELS; i++)
     {
-        _nextWriteField[iField] = "";
+        if (!_templates[i].channelNumber)
+            entry = &_templates[i];
     }
-    _nextWriteLatitude = NAN;
-    _nextWriteLongitude = NAN;
-    _nextWriteElevation = NAN;
-    _nextWriteStatus = "";
-    _nextWriteTwitter = "";
-    _nextWriteTweet = "";
-    _nextWriteCreatedAt = "";
+    if (!entry)
+        return false;
+    entry->channelNumber = channelNumber;
+    entry->readAPIKey = readAPIKey ? readAPIKey : "";
+    entry->writeAPIKey = writeAPIKey ? writeAPIKey : "";
+    _renderTemplate(*entry);
+    return true;
+}
+
+/**
+ * @brief Drop the pre-rendered request heads of a channel, see registerChannel().
+*/
+void AsyncTS::unregisterChannel(unsigned long channelNumber)
+{
+    tsChannelTemplate *entry = _channelTemplate(channelNumber);
+    if (!entry)
+        return;
+    entry->channelNumber = 0;
+    entry->readAPIKey = String();
+    entry->writeAPIKey = String();
+    entry->writeHead = String();
+    entry->readHead = String();
+    entry->readTail = String();
+}
+
+void AsyncTS::_resetWriteFields()
+{
+    _nextWrite.set = 0;
 }
 
 void AsyncTS::_setState(clientstate newState)
@@ -162,6 +324,20 @@ void AsyncTS::_setState(clientstate newState)
     {
         _state = newState;
         DEBUG_ATS("ats::_setState(%d)\r\n", _state);
+        switch (newState)
+        {
+        case CONNECTED:
+            _mark(_active, MARK_CONNECTED);
+            break;
+        case HEADERSRCVD:
+            _mark(_active, MARK_HEADERS);
+            break;
+        case RESCOMPLETE:
+            _mark(_active, MARK_COMPLETE);
+            break;
+        default:
+            break;
+        }
     }
 }
 
@@ -175,103 +351,159 @@ bool AsyncTS::_readStringFieldInternal(unsigned long channelNumber, unsigned int
     DEBUG_ATS("ats::readStringFieldInternal(channelNumber: %lu  field: %i readAPIkey: %s)\r\n", channelNumber, field, readAPIKey);
     if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
     {
-        _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
-        _response.flush();
-        if(_retValueSelector)
+        // Completed here, without the body and the response code of a request in flight.
+        if (!_active)
+            _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
+        if (_readDispatch)
         {
-            _retValueSelector();
+            tsRequest *outer = _dispatching;
+            _dispatching = nullptr;
+            _readDispatch(this, TS_ERR_INVALID_FIELD_NUM, nullptr, _readFn, _readArg);
+            _dispatching = outer;
         }
         return false;
     }
-    String suffixURL = String("/fields/");
-    suffixURL.concat(field);
-    suffixURL.concat("/last");
+    char suffixURL[] = "/fields/0/last";
+    suffixURL[8] = '0' + field;
     return _readRaw(channelNumber, suffixURL, readAPIKey);
 }
 
-float AsyncTS::_convertStringToFloat(String value)
+/**
+ * @brief Queue the read of a field with a typed completion.
+ * @param dispatch Instance of _dispatchValue() or _dispatchAny() for the type of the value.
+ * @param fn User's readValueUserCB, nullptr for _dispatchAny().
+ * @param arg Passed to fn.
+*/
+bool AsyncTS::_readValue(unsigned long channelNumber, unsigned int field, const char *readAPIKey, readDispatchCB dispatch, void (*fn)(), void *arg)
 {
-    // There's a bug in the AVR function strtod that it doesn't decode -INF correctly (it maps it to INF)
-    float result = value.toFloat();
-
-    if (1 == isinf(result) && *value.c_str() == '-')
-    {
-        result = (float)-INFINITY;
-    }
-
-    return result;
+    _retValueSelector = nullptr;
+    _readDispatch = dispatch;
+    _readFn = fn;
+    _readArg = arg;
+    bool queued = _readStringFieldInternal(channelNumber, field, readAPIKey);
+    _readDispatch = nullptr;
+    _readFn = nullptr;
+    _readArg = nullptr;
+    return queued;
 }
 
-String AsyncTS::_getJSONValueByKey(String textToSearch, String key)
+/**
+ * @brief Move the body of the response into text, terminated; the rest of a longer body is dropped.
+ * @param body nullptr gives an empty text.
+ * @return Length of the text.
+*/
+size_t AsyncTS::_bodyText(xbuf *body, char *text, size_t size)
 {
-    if (textToSearch.length() == 0)
-    {
-        return String("");
-    }
-
-    String searchPhrase = String("\"");
-    searchPhrase.concat(key);
-    searchPhrase.concat("\":\"");
-
-    int fromPosition = textToSearch.indexOf(searchPhrase, 0);
-
-    if (fromPosition == -1)
+    size_t len = 0;
+    if (body)
     {
-        // return because there is no status or it's null
-        return String("");
+        len = body->read((uint8_t *)text, size - 1);
+        body->flush();
     }
+    text[len] = 0;
+    return len;
+}
 
-    fromPosition = fromPosition + searchPhrase.length();
-
-    int toPosition = textToSearch.indexOf("\"", fromPosition);
+void AsyncTS::_decodeValue(xbuf *body, float &value)
+{
+    char text[FIELDLENGTH_MAX + 1];
+    _bodyText(body, text, sizeof(text));
+    value = _convertStringToFloat(text);
+}
 
-    if (toPosition == -1)
-    {
-        // return because there is no end quote
-        return String("");
-    }
+void AsyncTS::_decodeValue(xbuf *body, long &value)
+{
+    char text[FIELDLENGTH_MAX + 1];
+    _bodyText(body, text, sizeof(text));
+    value = atol(text);
+}
 
-    textToSearch.remove(toPosition);
+void AsyncTS::_decodeValue(xbuf *body, int &value)
+{
+    long number;
+    _decodeValue(body, number);
+    value = number;
+}
 
-    return textToSearch.substring(fromPosition);
+void AsyncTS::_decodeValue(xbuf *body, String &value)
+{
+    value = body ? body->readString() : String("");
 }
 
-String AsyncTS::_parseValues(String &multiContent, String key)
+// Completion of the readResponseUserCB API: the value read wrapped in std::any.
+template <typename T>
+void AsyncTS::_dispatchAny(AsyncTS *ats, int responsecode, xbuf *body, void (*fn)(), void *arg)
 {
-    if (multiContent.length() == 0)
+    T value;
+    _decodeValue(body, value);
+    if (ats->_readCB())
     {
-        return String("");
+        std::any a = std::move(value);
+        ats->_readCB()(responsecode, &a);
     }
+}
 
-    String searchPhrase = String("\"");
-    searchPhrase.concat(key);
-    searchPhrase.concat("\":\"");
-
-    int fromPosition = multiContent.indexOf(searchPhrase, 0);
+float AsyncTS::_convertStringToFloat(const char *value)
+{
+    // There's a bug in the AVR function strtod that it doesn't decode -INF correctly (it maps it to INF)
+    float result = atof(value);
 
-    if (fromPosition == -1)
+    if (1 == isinf(result) && *value == '-')
     {
-        // return because there is no status or it's null
-        return String("");
+        result = (float)-INFINITY;
     }
 
-    fromPosition = fromPosition + searchPhrase.length();
+    return result;
+}
 
-    int toPosition = multiContent.indexOf("\"", fromPosition);
+// Top level member of a feed entry, stored into the feed record. Null values are left empty.
+static void feedMember(void *context, const char *key, const char *value, size_t len)
+{
+    feed *entry = (feed *)context;
+    if (!value)
+        return;
+    if (!memcmp(key, "field", 5) && key[5] >= '1' && key[5] <= '8' && !key[6])
+        entry->nextReadField[key[5] - '1'] = value;
+    else if (!strcmp(key, "created_at"))
+        entry->nextReadCreatedAt = value;
+    else if (!strcmp(key, "entry_id"))
+        entry->nextReadEntryId = strtoul(value, nullptr, 10);
+    else if (!strcmp(key, "status"))
+        entry->nextReadStatus = value;
+    else if (!strcmp(key, "latitude"))
+        entry->nextReadLatitude = value;
+    else if (!strcmp(key, "longitude"))
+        entry->nextReadLongitude = value;
+    else if (!strcmp(key, "elevation"))
+        entry->nextReadElevation = value;
+}
 
-    if (toPosition == -1)
-    {
-        // return because there is no end quote
-        return String("");
-    }
+typedef struct xJsonLookup
+{
+    const char *key;
+    String value;
+} jsonLookup;
 
-    return multiContent.substring(fromPosition, toPosition);
+static void lookupMember(void *context, const char *key, const char *value, size_t len)
+{
+    jsonLookup *lookup = (jsonLookup *)context;
+    if (value && !strcmp(key, lookup->key))
+        lookup->value = value;
 }
 
+// Value of a top level member of the JSON object in body, empty if it is missing or null. The body is consumed.
+static String jsonValue(xbuf &body, const char *key)
+{
+    jsonLookup lookup = {key, String("")};
+    AsyncTSJson json(lookupMember, &lookup);
+    json.parse(body);
+    body.flush();
+    return lookup.value;
+}
 
 unsigned int AsyncTS::_send()
 {
-    if (_request.available() == 0)
+    if (!_active)
         return 0;
     if( ! _client->connected())
     {
@@ -282,23 +514,49 @@ unsigned int AsyncTS::_send()
     {
         return 0;
     }
-    DEBUG_ATS("_send() %d\r\n", _request.available());
 
-    size_t supply = _request.available();
-    size_t demand = _client->space();
-    if (supply > demand)
-        supply = demand;
+    // The last request in flight is the one under sending. When it is out and
+    // pipelining is on, the next queued one follows on the same connection.
+    // The segments of the request go straight to the client, which copies them.
+    // The request is kept until its response is in, a retry sends it again.
     size_t sent = 0;
-    uint8_t *temp = new uint8_t[100];
-    if (!temp) return 0;
-
-    while (supply)
+    while (true)
     {
-        size_t chunk = supply < 100 ? supply : 100;
-        supply -= _request.read(temp, chunk);
-        sent += _client->add((char *)temp, chunk);
+        tsRequest *tx = &_queue[(_qHead + _inFlight - 1) % ATS_QUEUE_SIZE];
+        if (tx->sent == tx->request.available())
+        {
+            if (!_pipelining || !_keepAlive || _inFlight >= _qCount || _inFlight >= _pipelineDepth)
+                break;
+            tx = &_queue[(_qHead + _inFlight) % ATS_QUEUE_SIZE];
+            if (tx->attempts && (int32_t)(tx->notBefore - millis()) > 0)
+                break; // Retry under backoff, the requests keep their order.
+            _inFlight++;
+            _countStart(*tx);
+            DEBUG_ATS("_send() pipelined request %u\r\n", _inFlight);
+        }
+        xbuf &request = tx->request;
+        DEBUG_ATS("_send() %d\r\n", request.available() - tx->sent);
+
+        const uint8_t *span;
+        size_t supply;
+        while ((supply = request.peekSpan(&span, tx->sent)) > 0)
+        {
+            size_t demand = _client->space();
+            if (supply > demand)
+                supply = demand;
+            if (!supply)
+                break;
+            size_t accepted = _client->add((const char *)span, supply);
+            tx->sent += accepted;
+            sent += accepted;
+            if (accepted < supply)
+                break;
+        }
+        if (tx->sent < request.available())
+            break; // Back-pressure, the rest goes from _onAck.
     }
-    delete temp;
+    if (!sent)
+        return 0;
 
     _client->send();
     DEBUG_ATS("*sent %d\r\n", sent);
@@ -310,10 +568,43 @@ void AsyncTS::_onConnect(AsyncClient *client)
 {
     DEBUG_ATS("ats::_onConnect handle \r\n");
     SEMAPHORE_TAKE();
+    if (!_active)
+    {
+        // Late connect of a request which already timed out.
+        DEBUG_ATS("ats::_onConnect no request in flight.\r\n");
+        _setState(DISCONNECTING);
+        _client->close();
+        SEMAPHORE_GIVE();
+        return;
+    }
+    if (_secure && _state == CONNECTING)
+    {
+        // The client calls back after the TLS handshake.
+        uint32_t handshake = millis() - _connectStart;
+        _tlsStats.fullHandshakes++;
+        _tlsStats.handshakeTime += handshake;
+        if (handshake > _tlsStats.maxHandshakeTime)
+            _tlsStats.maxHandshakeTime = handshake;
+        DEBUG_ATS("ats::_onConnect TLS handshake %u ms\r\n", handshake);
+#if ASYNC_TCP_SSL_ENABLED
+        if (ssl_match_fingerprint(_client->getSSL(), _fingerprint) != SSL_OK)
+        {
+            // Not the server of the pinned certificate, the request must not go out.
+            DEBUG_ATS("ats::_onConnect certificate fingerprint mismatch.\r\n");
+            _tlsStats.rejectedServers++;
+            _expire(TS_ERR_TLS_FINGERPRINT);
+            SEMAPHORE_GIVE();
+            return;
+        }
+#endif
+    }
     _setState(CONNECTED);
-    //_response = new xbuf;
-    _contentLength = 0;
-    //_chunked = false;
+    _setPhase(PHASE_FIRST_BYTE);
+    _resetParser();
+    if (_spool && !_draining && _spool->pending())
+    {
+        _armDrain(); // The network is back.
+    }
     _client->onAck([](void *obj, AsyncClient *client, size_t len, uint32_t time)
                    { ((AsyncTS *)(obj))->_onAck(len, time); },
                    this);
@@ -331,9 +622,53 @@ void AsyncTS::_onConnect(AsyncClient *client)
 void AsyncTS::_onDisconnect(AsyncClient *client)
 {
     DEBUG_ATS("ats::_onDisconnect\r\n")
+    SEMAPHORE_TAKE();
     _setState(DISCONNECTED);
+    _setPhase(PHASE_NONE);
+    _body.flush();
+    while (_active)
+    {
+        // Connection was lost while a request was in flight (e.g. the server
+        // dropped a kept-alive connection). Let the user know about it.
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        _finishActive();
+    }
+    _startQueued();
+    SEMAPHORE_GIVE();
+}
+
+void AsyncTS::_dispatchResponse(tsRequest &req)
+{
+    tsRequest *outer = _dispatching;
+    _dispatching = &req;
+    if (req.writesession)
+    {
+        if (req.scheduled)
+            _writeDone(req);
+        if ((_lastTSerrorcode == TS_ERR_CONNECT_FAILED || _lastTSerrorcode == TS_ERR_TIMEOUT) && req.sent == 0 && _saveToSpool(req))
+            _lastTSerrorcode = TS_SPOOLED;
+        if (req.writeCB)
+            req.writeCB(_lastTSerrorcode);
+    }
+    else if (req.bodySink)
+    {
+        if (req.streamCB)
+            req.streamCB(_lastTSerrorcode);
+    }
+    else if (req.dispatch)
+        req.dispatch(this, _lastTSerrorcode, &_body, req.readFn, req.readArg);
+    else
+    {
+        if (req.selector)
+            req.selector();
+    }
+    _dispatching = outer;
 }
 
+readResponseUserCB& AsyncTS::_readCB()
+{
+    return _dispatching ? _dispatching->readCB : _readResponseUserCB;
+}
 
 void AsyncTS::_onData(void *Vbuf, size_t len)
 {
@@ -341,108 +676,406 @@ void AsyncTS::_onData(void *Vbuf, size_t len)
     SEMAPHORE_TAKE();
     _lastActivity = millis();
 
-    // Transfer data to xbuf
-
-    _response.write((uint8_t *)Vbuf, len);
-
-    // if header not complete, collect it.
-    // if still not complete, just return.
-
-    while (_state == CONNECTED)
+    if (!_active)
     {
-        String headerLine = _response.readStringUntil("\r\n");
+        DEBUG_ATS("_onData no request in flight.\r\n");
+        SEMAPHORE_GIVE();
+        return;
+    }
 
-        // If no line, return.
+    // Headers are parsed in place, only the body is collected into _body.
+    // A segment can carry the end of one response and the beginning of the
+    // next pipelined one, so parse until the data runs out.
 
-        if (!headerLine.length())
+    const uint8_t *data = (const uint8_t *)Vbuf;
+    size_t left = len;
+    while (_active)
+    {
+        if (_phase == PHASE_FIRST_BYTE && left)
         {
-            _lastTSerrorcode = TS_ERR_BAD_RESPONSE;
-            SEMAPHORE_GIVE();
-            return;
+            _setPhase(PHASE_BODY);
         }
-
-        // If empty line, all headers are in, advance readyState.
-
-        if (headerLine.length() == 2)
+        if (_state == CONNECTED)
         {
-            _setState(HEADERSRCVD);
+            size_t used = _parseHeaders(data, left);
+            data += used;
+            left -= used;
+            if (_state == CONNECTED)
+            {
+                break; // Headers continue in the next segment.
+            }
         }
 
-        // If line is HTTP header, capture HTTPcode.
+        size_t used = _chunked ? _parseChunked(data, left) : _parseBody(data, left);
+        data += used;
+        left -= used;
 
-        else if (headerLine.substring(0, 8) == "HTTP/1.1")
+        if (used && _state != RESCOMPLETE)
         {
-            DEBUG_ATS("HTTP/1.1 found.\r\n");
-            _lastTSerrorcode = headerLine.substring(9, headerLine.indexOf(' ', 9)).toInt();
-            DEBUG_ATS("Response code: %d\r\n", _lastTSerrorcode);
+            _setState(RESONGOING);
         }
 
-        else if (headerLine.substring(0, 15) == "Content-Length:")
+        // If all data read, close it up.
+
+        if (!_bodyDone)
         {
-            _contentLength = headerLine.substring(16, headerLine.indexOf(' ', 16)).toInt();
-            DEBUG_ATS("Content-Length :%d\r\n", _contentLength);
+            break;
         }
-    }
-
-
-    if (_response.available() && _state != RESCOMPLETE)
-    {
-        _setState(RESONGOING);
-    }
-
-    // If not chunked and all data read, close it up.
 
-    if (_response.available() >= _contentLength)
-    {
-        if (_writesession)
+        // An update answers 200 with the entry ID, or "0" if the point was not inserted.
+        // Other statuses (202 of the bulk update, 4xx, 5xx) are kept as they are.
+        if (_active->writesession && _lastTSerrorcode == TS_OK_SUCCESS)
         {
-            if (_response.readString().toInt() == 0)
+            String entry = _body.readString();
+            entry.trim();
+            if (entry == "0")
             {
                 _lastTSerrorcode = TS_ERR_NOT_INSERTED;
             }
-            if (_writeResponseUserCB)
-                _writeResponseUserCB(_lastTSerrorcode);
         }
-        else
+        _setState(RESCOMPLETE);
+        _finishActive();
+        if (!_keepAlive || _serverClose)
         {
-            if (_retValueSelector)
-                _retValueSelector();
+            // The next request is started from _onDisconnect.
+            _setPhase(PHASE_NONE);
+            _setState(DISCONNECTING);
+            _client->stop();
+            break;
         }
-        _setState(RESCOMPLETE);
-        _setState(DISCONNECTING);
-        _client->stop();
-        
+        _resetParser();
+        if (_active)
+        {
+            // Next pipelined response.
+            _setState(CONNECTED);
+            _setPhase(PHASE_FIRST_BYTE);
+            _send();
+            continue;
+        }
+        // Keep the connection for the next request.
+        _setState(IDLE);
+        _setPhase(PHASE_NONE);
+        _startQueued();
     }
     SEMAPHORE_GIVE();
 }
 
-void AsyncTS::_onError(AsyncClient *client, int8_t error)
+void AsyncTS::_resetParser()
 {
-    DEBUG_ATS("ats::_onError:%d\r\n", error);
+    _contentLength = 0;
+    _serverClose = false;
+    _chunked = false;
+    _lineLen = 0;
 }
 
-void AsyncTS::_onPoll(AsyncClient *client)
+/**
+ * @brief Feed response bytes to the header parser. The parser keeps its state between calls.
+ * @return Number of bytes used. Less than len if the headers ended, then the state is HEADERSRCVD.
+*/
+size_t AsyncTS::_parseHeaders(const uint8_t *data, size_t len)
 {
-    
+    size_t used = 0;
+    while (used < len && _state == CONNECTED)
+    {
+        char c = data[used++];
+        if (c != '\n')
+        {
+            if (c != '\r' && _lineLen < ATS_HEADER_LINE_MAX - 1)
+            {
+                _line[_lineLen++] = c;
+            }
+            continue;
+        }
+        _line[_lineLen] = 0;
+
+        // If empty line, all headers are in, advance readyState.
+
+        if (_lineLen == 0)
+        {
+            _setState(HEADERSRCVD);
+            _bodyLeft = _contentLength;
+            _bodyDone = !_chunked && !_contentLength;
+            _chunkState = CHUNK_SIZE;
+            _chunkLeft = 0;
+        }
+        else if (!_parseHeaderLine())
+        {
+            _lastTSerrorcode = TS_ERR_BAD_RESPONSE;
+        }
+        _lineLen = 0;
+    }
+    return used;
 }
 
-void AsyncTS::_onAck(size_t len, uint32_t time)
+/**
+ * @brief Feed body bytes of a Content-Length framed response.
+ * @return Number of bytes used. The rest belongs to the next response.
+*/
+size_t AsyncTS::_parseBody(const uint8_t *data, size_t len)
 {
-    _send();
+    size_t used = len < _bodyLeft ? len : _bodyLeft;
+    _deliverBody(data, used);
+    _bodyLeft -= used;
+    _bodyDone = !_bodyLeft;
+    return used;
 }
 
 /**
- * @brief Initializes the ThingSpeak library and network settings using the ThingSpeak.com service.
- * @param  &client AsynClient reference. Created earlier in the sketch.
- * @return Always true.
- * 
- * This does not validate the information passed in, or generate any calls to ThingSpeak.
+ * @brief Feed body bytes of a "Transfer-Encoding: chunked" response. The decoder keeps its state between calls.
+ * @return Number of bytes used. The rest belongs to the next response.
+ * @note Chunk extensions and trailers are skipped. The response is complete after the zero-length chunk.
 */
-bool AsyncTS::begin(AsyncClient &client)
+size_t AsyncTS::_parseChunked(const uint8_t *data, size_t len)
+{
+    size_t used = 0;
+    while (used < len && !_bodyDone)
+    {
+        if (_chunkState == CHUNK_DATA)
+        {
+            size_t chunk = len - used < _chunkLeft ? len - used : _chunkLeft;
+            _deliverBody(data + used, chunk);
+            used += chunk;
+            _chunkLeft -= chunk;
+            if (!_chunkLeft)
+                _chunkState = CHUNK_DATA_END;
+            continue;
+        }
+
+        char c = data[used++];
+        switch (_chunkState)
+        {
+        case CHUNK_SIZE:
+            if (((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')) &&
+                _chunkLeft >> (sizeof(_chunkLeft) * 8 - 4))
+            {
+                // One more digit would shift out the top of the size.
+                DEBUG_ATS("ats::_parseChunked chunk size overflow.\r\n");
+                _lastTSerrorcode = TS_ERR_BAD_RESPONSE;
+                _serverClose = true;
+                _bodyDone = true;
+            }
+            else if (c >= '0' && c <= '9')
+                _chunkLeft = (_chunkLeft << 4) | (c - '0');
+            else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+                _chunkLeft = (_chunkLeft << 4) | ((c | 0x20) - 'a' + 10);
+            else if (c == ';')
+                _chunkState = CHUNK_EXTENSION;
+            else if (c == '\n')
+                _chunkState = _chunkLeft ? CHUNK_DATA : CHUNK_TRAILER;
+            else if (c != '\r' && c != ' ')
+            {
+                DEBUG_ATS("ats::_parseChunked bad chunk size.\r\n");
+                _lastTSerrorcode = TS_ERR_BAD_RESPONSE;
+                _serverClose = true; // Framing is lost, the connection can't be reused.
+                _bodyDone = true;
+            }
+            break;
+
+        case CHUNK_EXTENSION:
+            if (c == '\n')
+                _chunkState = _chunkLeft ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+
+        case CHUNK_DATA_END:
+            if (c == '\n')
+            {
+                _chunkState = CHUNK_SIZE;
+                _chunkLeft = 0;
+            }
+            break;
+
+        case CHUNK_TRAILER:
+            // Trailer lines end with an empty line.
+            if (c == '\n')
+            {
+                _bodyDone = _lineLen == 0;
+                _lineLen = 0;
+            }
+            else if (c != '\r')
+            {
+                _lineLen = 1;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+    return used;
+}
+
+/**
+ * @brief Take the decoded body bytes of the response. Every body byte goes through here.
+*/
+void AsyncTS::_deliverBody(const uint8_t *data, size_t len)
+{
+    if (!len)
+        return;
+    if (_active->bodySink)
+    {
+        // Streamed read: the slice goes to the user as it is, nothing is buffered.
+        _active->streamed = true;
+        _active->bodySink(data, len);
+        return;
+    }
+    _body.write(data, len);
+}
+
+bool AsyncTS::_parseHeaderLine()
+{
+    const char *value = strchr(_line, ':');
+    if (value)
+    {
+        value++;
+        while (*value == ' ')
+            value++;
+    }
+
+    // If line is HTTP header, capture HTTPcode.
+
+    if (strncmp(_line, "HTTP/1.", 7) == 0)
+    {
+        const char *code = strchr(_line, ' ');
+        if (!code)
+            return false;
+        _lastTSerrorcode = atoi(code + 1);
+        DEBUG_ATS("Response code: %d\r\n", _lastTSerrorcode);
+    }
+
+    else if (strncasecmp(_line, "Content-Length:", 15) == 0)
+    {
+        _contentLength = strtoul(value, nullptr, 10);
+        DEBUG_ATS("Content-Length :%d\r\n", _contentLength);
+    }
+
+    else if (strncasecmp(_line, "Transfer-Encoding:", 18) == 0)
+    {
+        _chunked = strstr(value, "chunked") != nullptr;
+    }
+
+    else if (strncasecmp(_line, "Connection:", 11) == 0)
+    {
+        _serverClose = strncasecmp(value, "close", 5) == 0;
+    }
+
+    else if (strncasecmp(_line, "Date:", 5) == 0)
+    {
+        strncpy(_serverDate, value, ATS_DATE_MAX - 1);
+        _serverDate[ATS_DATE_MAX - 1] = 0;
+        uint32_t epoch = parseHTTPDate(_serverDate);
+        if (epoch)
+        {
+            _dateEpoch = epoch;
+            _dateMillis = millis();
+        }
+    }
+    return true;
+}
+
+void AsyncTS::_onError(AsyncClient *client, int8_t error)
+{
+    DEBUG_ATS("ats::_onError:%d\r\n", error);
+}
+
+void AsyncTS::_onPoll(AsyncClient *client)
+{
+    _checkDeadline();
+    if (_state == IDLE && millis() - _lastActivity > _keepAliveTimeout)
+    {
+        DEBUG_ATS("ats::_onPoll keep-alive idle timeout.\r\n");
+        _setState(DISCONNECTING);
+        _client->close();
+    }
+}
+
+/**
+ * @brief Start the deadline of a request phase. The Ticker only runs while connecting,
+ * later the connection's poll checks the deadline.
+*/
+void AsyncTS::_setPhase(requestphase phase)
+{
+    _phase = phase;
+    _phaseStart = millis();
+    if (phase == PHASE_BODY)
+        _mark(_active, MARK_FIRST_BYTE);
+    switch (phase)
+    {
+    case PHASE_CONNECT:
+        // Name resolution can't be told apart from the connect, so they share one deadline.
+        _phaseTimeout = _timeouts.dns + _timeouts.connect;
+        _watchdog.attach_ms(ATS_WATCHDOG_PERIOD, &AsyncTS::_onWatchdog, this);
+        return;
+    case PHASE_FIRST_BYTE:
+        _phaseTimeout = _timeouts.firstByte;
+        break;
+    case PHASE_BODY:
+        _phaseTimeout = _timeouts.body;
+        break;
+    default:
+        break;
+    }
+    _watchdog.detach();
+}
+
+void AsyncTS::_onWatchdog(AsyncTS *self)
+{
+    self->_checkDeadline();
+}
+
+void AsyncTS::_checkDeadline()
+{
+    SEMAPHORE_TAKE();
+    if (_phase != PHASE_NONE && millis() - _phaseStart > _phaseTimeout)
+    {
+        DEBUG_ATS("ats::_checkDeadline phase %d expired.\r\n", _phase);
+        _expire(TS_ERR_TIMEOUT);
+    }
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Complete every request in flight with errorcode, abort the connection and go on with the queue.
+ * @param errorcode TS_ERR_TIMEOUT, or TS_ERR_TLS_FINGERPRINT
+*/
+void AsyncTS::_expire(int errorcode)
+{
+    _setPhase(PHASE_NONE);
+    _body.flush();
+    while (_active)
+    {
+        _lastTSerrorcode = errorcode;
+        _finishActive();
+    }
+    _setState(DISCONNECTING);
+    _client->abort();
+    if (_state == DISCONNECTING)
+    {
+        // No disconnect callback from the abort, the client is free anyway.
+        _setState(DISCONNECTED);
+        _startQueued();
+    }
+}
+
+void AsyncTS::_onAck(size_t len, uint32_t time)
+{
+    _send();
+}
+
+/**
+ * @brief Initializes the ThingSpeak library and network settings using the ThingSpeak.com service.
+ * @param  &client AsynClient reference. Created earlier in the sketch.
+ * @return Always true.
+ * 
+ * This does not validate the information passed in, or generate any calls to ThingSpeak.
+*/
+bool AsyncTS::begin(AsyncClient &client)
 {
     DEBUG_ATS("ats::begin\r\n");
-    _setPort(THINGSPEAK_PORT_NUMBER);
+    _setPort(_secure ? THINGSPEAK_HTTPS_PORT_NUMBER : THINGSPEAK_PORT_NUMBER);
     _client = &client;
+#if ATS_ALLOC_STATS
+    _heapSeen = atsHeapCounter();
+#endif
     _resetWriteFields();
     _setState(DISCONNECTED);
     _client->setRxTimeout(_timeout/1000);//convert to sec
@@ -476,6 +1109,28 @@ void AsyncTS::setTimeout(int milliseconds)
         _client->setAckTimeout(milliseconds);
     }
     _timeout = milliseconds;
+    _timeouts.firstByte = milliseconds;
+    _timeouts.body = milliseconds;
+}
+
+/**
+ * @brief Set the deadlines of the request phases in milliseconds.
+ * 
+ * If a phase doesn't finish in time, the requests in flight complete with -304 (TS_ERR_TIMEOUT),
+ * the connection is aborted, and the next queued request starts.
+ * @param dnsMs Name resolution of api.thingspeak.com.
+ * @param connectMs TCP connect. The name resolution and the connect share one deadline: dnsMs + connectMs.
+ * @param firstByteMs From connected (or from the previous response on a kept-alive connection) to the first byte of the response.
+ * @param bodyMs From the first byte to the end of the response.
+ * @note setTimeout() sets firstByteMs and bodyMs too.
+*/
+void AsyncTS::setTimeouts(uint32_t dnsMs, uint32_t connectMs, uint32_t firstByteMs, uint32_t bodyMs)
+{
+    DEBUG_ATS("setTimeouts(%u, %u, %u, %u)\r\n", dnsMs, connectMs, firstByteMs, bodyMs);
+    _timeouts.dns = dnsMs;
+    _timeouts.connect = connectMs;
+    _timeouts.firstByte = firstByteMs;
+    _timeouts.body = bodyMs;
 }
 
 /**
@@ -496,7 +1151,6 @@ bool AsyncTS::_writeRaw(unsigned long channelNumber, String postMessage, const c
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _response.flush();
     _request.flush();
     _writesession = true;
 
@@ -506,18 +1160,10 @@ bool AsyncTS::_writeRaw(unsigned long channelNumber, String postMessage, const c
 
     // Post data to thingspeak
 
-    _request.write("POST /update HTTP/1.1\r\n");
-    _writeHTTPHeader(writeAPIKey);
-    _request.write("Content-Type: application/x-www-form-urlencoded\r\n");
-    _request.write("Content-Length: ");
-    _request.write(String(postMessage.length()));
-    _request.write("\r\n\r\n");
-    _request.write(postMessage);
+    _writeFormHeader(channelNumber, writeAPIKey, postMessage.length());
+    _request.write((const uint8_t *)postMessage.c_str(), postMessage.length());
 
-    if (!_connectThingSpeak())
-        return false;
-    //_state = CONNECTING
-    return true;
+    return _submit(channelNumber);
 }
 
 /**
@@ -539,7 +1185,10 @@ bool AsyncTS::writeRaw(unsigned long channelNumber, String postMessage, const ch
     }
     if(wrucb)_writeResponseUserCB = wrucb;
     else {DEBUG_ATS("ats::writeRaw wrucb is null.");}
-    return _writeRaw(channelNumber,postMessage,writeAPIKey);
+    _rawRequest = true;
+    bool queued = _writeRaw(channelNumber,postMessage,writeAPIKey);
+    _rawRequest = false;
+    return queued;
 }
 
 /**
@@ -551,9 +1200,9 @@ bool AsyncTS::writeRaw(unsigned long channelNumber, String postMessage, const ch
   * @retval false: AsyncTS client is busy. Couldn't send the request.
   * @retval true: request is under sending.
  */
-bool AsyncTS::_readRaw(unsigned long channelNumber, String suffixURL, const char *readAPIKey)
+bool AsyncTS::_readRaw(unsigned long channelNumber, const char *suffixURL, const char *readAPIKey)
 {
-    DEBUG_ATS("ats::readRaw (channelNumber: %lu  readAPIkey: %s suffixURL: \"%s\r\n", channelNumber, readAPIKey, suffixURL.c_str());
+    DEBUG_ATS("ats::readRaw (channelNumber: %lu  readAPIkey: %s suffixURL: \"%s\r\n", channelNumber, readAPIKey, suffixURL);
     _lastTSerrorcode=TS_OK_SUCCESS;
     if (!_isReady())
     {
@@ -562,576 +1211,2452 @@ bool AsyncTS::_readRaw(unsigned long channelNumber, String suffixURL, const char
         return false;
     }
     _writesession = false;
-    _response.flush();
     _request.flush();
 
-    String readURL = String("/channels/");
-    readURL.concat(channelNumber);
-    readURL.concat(suffixURL);
-    DEBUG_ATS("ats::readRaw GET \"%s\"\r\n", readURL);
+    DEBUG_ATS("ats::readRaw GET \"/channels/%lu%s\"\r\n", channelNumber, suffixURL);
 
     // Get data from thingspeak
-    _request.write("GET ");
-    _request.write(readURL);
-    _request.write(" HTTP/1.1\r\n");
-    _writeHTTPHeader(readAPIKey);
-    _request.write("\r\n");
-
-    if (!_connectThingSpeak())return false;
-    //_state = CONNECTING
-    return true;
+    tsChannelTemplate *entry = _channelTemplate(channelNumber);
+    if (entry && sameKey(entry->readAPIKey, readAPIKey))
+    {
+        _request.write((const uint8_t *)entry->readHead.c_str(), entry->readHead.length());
+        _request.write(suffixURL);
+        _request.write((const uint8_t *)entry->readTail.c_str(), entry->readTail.length());
+    }
+    else
+    {
+        char number[ATS_FORMAT_INT_SIZE];
+        _request.write("GET /channels/");
+        _request.write((const uint8_t *)number, atsFormatULong(number, channelNumber));
+        _request.write(suffixURL);
+        _request.write(" HTTP/1.1\r\n");
+        _writeHTTPHeader(readAPIKey);
+        _request.write("\r\n");
+    }
+
+    return _submit(channelNumber);
 }
 
 bool AsyncTS::_isReady()
 {
-    return (_state==DISCONNECTED);
+    if (_qCount < ATS_QUEUE_SIZE || _queuePolicy != QUEUE_REJECT)
+        return true;
+    _queueStats.rejected++;
+    return false;
 }
 
 /**
-  * @brief Read a raw response from a private ThingSpeak channel
-  * @post User's callback need process std::any<String>*.
-  * @param channelNumber Channnel number
-  * @param suffixURL Raw URL to write to ThingSpeak as a String.  See the documentation at https://thingspeak.com/docs/channels#get_feed
-  * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
-  * @param ruscb User's callback function to process the server response.
-  * @return If false , client is busy or can't connect.
- */
-bool AsyncTS::readRaw(unsigned long channelNumber, String suffixURL, const char * readAPIKey, readResponseUserCB ruscb)
+ * @brief Move the request built in _request into the queue, and start it if the client is free.
+ * @param channelNumber Channel number of the request. Used by QUEUE_REPLACE_SAME_CHANNEL.
+ * @param scheduled The write is tracked by the update scheduler.
+ * @retval false: queue is full or the request couldn't be started.
+ * @retval true: request is queued or under sending.
+*/
+bool AsyncTS::_submit(unsigned long channelNumber, bool scheduled)
 {
-    if (!_isReady())
+    SEMAPHORE_TAKE();
+    uint8_t api = _rawRequest ? LATENCY_RAW : _writesession ? LATENCY_WRITE : LATENCY_READ;
+    tsRequest *slot = nullptr;
+    if (_qCount == ATS_QUEUE_SIZE)
     {
-        DEBUG_ATS("ats::ReadRaw Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        if (_queuePolicy == QUEUE_DROP_OLDEST)
+        {
+            // The oldest waiting one is right behind the request in flight.
+            if (_inFlight < _qCount)
+            {
+                tsRequest &oldest = _queue[(_qHead + _inFlight) % ATS_QUEUE_SIZE];
+                _dropRequest(oldest);
+                // Close the gap: shift the younger requests one slot towards the head.
+                size_t from = &oldest - _queue;
+                size_t tail = (_qHead + _qCount - 1) % ATS_QUEUE_SIZE;
+                while (from != tail)
+                {
+                    size_t next = (from + 1) % ATS_QUEUE_SIZE;
+                    _moveRequest(_queue[from], _queue[next]);
+                    from = next;
+                }
+                slot = &_queue[tail];
+            }
+        }
+        else if (_queuePolicy == QUEUE_REPLACE_SAME_CHANNEL)
+        {
+            slot = _findWaiting(channelNumber, _writesession);
+            if (slot)
+            {
+                _dropRequest(*slot);
+            }
+        }
+        if (!slot)
+        {
+            DEBUG_ATS("ats::_submit queue is full.\r\n");
+            _queueStats.rejected++;
+            _request.flush();
+            _spoolRecords.flush();
+            _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+#if ATS_ALLOC_STATS
+            _chargeAlloc(api, false);
+#endif
+            SEMAPHORE_GIVE();
+            return false;
+        }
+    }
+    else
+    {
+        slot = &_queue[(_qHead + _qCount) % ATS_QUEUE_SIZE];
+        _qCount++;
     }
-    if(ruscb)_readResponseUserCB = ruscb;
-    else {DEBUG_ATS("ats::readRaw ruscb is null.");}
-    _retValueSelector = [this](){ this->_readStringFieldCB(); };
-    return _readRaw(channelNumber,suffixURL,readAPIKey);
-}
-
 
-void AsyncTS::_readCreatedAtCB()
-{
-    if (_readResponseUserCB)
+    // The segments change hands, the slot's empty chain is left in _request.
+    slot->request.swap(_request);
+    _request.flush();
+    slot->spool.swap(_spoolRecords);
+    _spoolRecords.flush();
+    slot->writesession = _writesession;
+    slot->channelNumber = channelNumber;
+    slot->enqueued = millis();
+    slot->writeCB = _writeResponseUserCB;
+    slot->readCB = _readResponseUserCB;
+    slot->selector = _retValueSelector;
+    slot->dispatch = _readDispatch;
+    slot->readFn = _readFn;
+    slot->readArg = _readArg;
+    slot->bodySink = _bodySinkUserCB;
+    slot->streamCB = _streamResponseUserCB;
+    slot->scheduled = scheduled;
+    slot->sent = 0;
+    slot->streamed = false;
+    slot->attempts = 0;
+    slot->notBefore = 0;
+    slot->api = api;
+    slot->marks = 0;
+    _mark(slot, MARK_ENQUEUED);
+
+    _queueStats.enqueued++;
+    _queueStats.depth = _qCount;
+    if (_qCount > _queueStats.maxDepth)
+        _queueStats.maxDepth = _qCount;
+    DEBUG_ATS("ats::_submit queue depth: %u\r\n", _qCount);
+
+    if (_qCount == 1 && !_startNext())
     {
-        std::any res = String("");
-        if (_lastTSerrorcode == TS_OK_SUCCESS)
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        if (_retryable(*slot) && _scheduleRetry(*slot))
         {
-            res = _getJSONValueByKey(_response.readString(), "created_at");
+            // Same as a connect failure reported later: the retry timer starts it again.
+            _startQueued();
+            _lastTSerrorcode = TS_OK_SUCCESS;
+#if ATS_ALLOC_STATS
+            _chargeAlloc(api, false);
+#endif
+            SEMAPHORE_GIVE();
+            return true;
         }
-
-        _readResponseUserCB(_lastTSerrorcode, &res);
+        if (_saveToSpool(*slot))
+        {
+            // Network is down, the write is safe in the spool.
+            _lastTSerrorcode = TS_SPOOLED;
+            _dispatchResponse(*slot);
+            _popRequest();
+#if ATS_ALLOC_STATS
+            _chargeAlloc(api, true);
+#endif
+            SEMAPHORE_GIVE();
+            return true;
+        }
+        // Couldn't connect at all, the caller gets false like before queueing.
+        _popRequest();
+#if ATS_ALLOC_STATS
+        _chargeAlloc(api, false);
+#endif
+        SEMAPHORE_GIVE();
+        return false;
+    }
+    if (_active && _pipelining && _state != CONNECTING)
+    {
+        _send();
     }
+#if ATS_ALLOC_STATS
+    _chargeAlloc(api, false);
+#endif
+    SEMAPHORE_GIVE();
+    return true;
 }
+
 /**
- * @brief Read the created-at timestamp associated with the latest update to a private ThingSpeak channel
- * 
- * @post User's callback need process std::any<String>*.
- * 
- * @param channelNumber Channel number
- * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * @brief Start the request at the head of the queue if the client is free.
+ * @return False if the connection couldn't be started.
 */
-bool AsyncTS::_readCreatedAt(unsigned long channelNumber, const char *readAPIKey)
+bool AsyncTS::_startNext()
 {
-    if (!_isReady())
+    if (_active || !_qCount || (_state != DISCONNECTED && _state != IDLE))
+        return true;
+
+    tsRequest &req = _queue[_qHead];
+    int32_t backoff = req.notBefore - millis();
+    if (req.attempts && backoff > 0)
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        // A retry under backoff, the timer starts it.
+        _retryTimer.once_ms(backoff, &AsyncTS::_onRetryTimer, this);
+        return true;
     }
-    _retValueSelector = [this](){ this->_readCreatedAtCB();};
-    _request.flush();
-    _response.flush();
-    return _readRaw(channelNumber, "/feeds/last.txt", readAPIKey);
+    _countStart(req);
+
+    _active = &req;
+    _inFlight = 1;
+    _body.flush();
+    if (_connectThingSpeak())
+        return true;
+    _active = nullptr;
+    _inFlight = 0;
+    return false;
+}
+
+void AsyncTS::_countStart(tsRequest &req)
+{
+    req.marks &= 1 << MARK_ENQUEUED; // Every attempt is measured from its own start.
+    _mark(&req, MARK_START);
+    req.attempts++;
+    if (req.attempts > 1)
+        return; // Retries were counted at the first start.
+    uint32_t wait = millis() - req.enqueued;
+    _queueStats.started++;
+    _queueStats.totalWait += wait;
+    if (wait > _queueStats.maxWait)
+        _queueStats.maxWait = wait;
 }
 
 /**
- * @brief Read the created-at timestamp associated with the latest update to a private ThingSpeak channel
- * 
- * @param channelNumber Channel number
- * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @param ruscb User's callback function to process the server response.
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
- * @post User's callback need process std::any<String>*.
+ * @brief Start the next queued request. Requests which can't connect are completed with TS_ERR_CONNECT_FAILED.
 */
-bool AsyncTS::readCreatedAt(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb)
+void AsyncTS::_startQueued()
 {
-    if (!_isReady())
+    while (!_startNext())
     {
-        DEBUG_ATS("ats::readCreatedAt Clinet is busy.");
+        _active = &_queue[_qHead];
+        _inFlight = 1;
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        _finishActive();
     }
-    if(ruscb)_readResponseUserCB = ruscb;
-    else {DEBUG_ATS("ats::readCreatedAt ruscb is null.");}
-    return _readCreatedAt(channelNumber,readAPIKey);
 }
 
-
 /**
- * @brief Read the created-at timestamp associated with the latest update to a public ThingSpeak channel
- * 
- * 
- * @param channelNumber Channel number
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
- * @post User's callback need process std::any<String>*.
+ * @brief Complete the request in flight with _lastTSerrorcode and the content of _body, then remove it from the queue.
 */
-bool AsyncTS::_readCreatedAt(unsigned long channelNumber)
+void AsyncTS::_finishActive()
 {
-    return _readCreatedAt(channelNumber, NULL);
+    tsRequest *req = _active;
+    if (!req)
+        return;
+    if (!_retryable(*req) || !_scheduleRetry(*req))
+    {
+        _recordLatency(*req);
+        _dispatchResponse(*req);
+#if ATS_ALLOC_STATS
+        _chargeAlloc(req->api, true);
+#endif
+        _popRequest();
+    }
+    _body.flush();
+    _inFlight--;
+    _active = _inFlight ? &_queue[_qHead] : nullptr;
 }
 
 /**
- * @brief Read the created-at timestamp associated with the latest update to a public ThingSpeak channel
- * 
- * @param channelNumber Channel number
- * @param ruscb User's callback function to process the server response.
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
- * @post User's callback need process std::any<String>*.
+ * @brief Can the failure in _lastTSerrorcode be retried without side effects?
 */
-bool AsyncTS::readCreatedAt(unsigned long channelNumber, readResponseUserCB ruscb)
+bool AsyncTS::_retryable(tsRequest &req)
 {
-    if (!_isReady())
+    if (req.writesession)
     {
-        DEBUG_ATS("ats::readcreatedAt Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        // Rejected by the rate limit, or never reached the server.
+        return _lastTSerrorcode == TS_ERR_NOT_INSERTED ||
+               ((_lastTSerrorcode == TS_ERR_CONNECT_FAILED || _lastTSerrorcode == TS_ERR_TIMEOUT) && req.sent == 0);
     }
-    if(ruscb)_readResponseUserCB = ruscb;
-    else {DEBUG_ATS("ats::readcreatedAt ruscb is null.");}
-    return _readCreatedAt(channelNumber,NULL);
+    if (req.streamed)
+        return false; // The sink would get the body twice.
+    return _lastTSerrorcode == TS_ERR_CONNECT_FAILED || _lastTSerrorcode == TS_ERR_TIMEOUT ||
+           _lastTSerrorcode == TS_ERR_BAD_RESPONSE || _lastTSerrorcode >= 500;
 }
+
 /**
- * @brief  Set AsyncClient.
- * @param  &client AsynClient reference.
+ * @brief Is a write of the channel of req queued or in flight behind req, the head of the queue?
 */
-void AsyncTS::setClient(AsyncClient &client)
+bool AsyncTS::_laterWrite(tsRequest &req)
 {
-    _client = &client;
+    for (uint8_t i = 1; i < _qCount; i++)
+    {
+        tsRequest &later = _queue[(_qHead + i) % ATS_QUEUE_SIZE];
+        if (later.writesession && later.channelNumber == req.channelNumber)
+            return true;
+    }
+    return false;
 }
+
 /**
- * @brief Set on or off the bebug messages.
- * @param debug true/on , false/off
- * @note If you define the option "DONT_COMPILE_DEBUG_LINES_AsyncTS" in the Async.hpp file,
- * you can save extra flash memory, because the source file will not contain the error messages.
+ * @brief Retry the head of the queue after a backoff. A write stays at the head, unless
+ * pipelined requests are in flight behind it; a read goes to the tail of the queue.
+ * @return False if the attempts or the retry budget ran out, or a pipelined write of the same
+ * channel is behind it. The request is left as it was.
 */
-void AsyncTS::setDebug(bool debug)
+bool AsyncTS::_scheduleRetry(tsRequest &req)
 {
-    if (_debug || debug)
+    uint8_t cls = req.writesession ? WRITE_REQUESTS : READ_REQUESTS;
+    tsRetryPolicy &policy = _retryPolicy[cls];
+    if (policy.maxAttempts <= 1)
+        return false;
+    if (req.writesession && _inFlight > 1 && _laterWrite(req))
     {
-        DEBUG_ATS("ats::setDebug(%s) \r\n", debug ? "on" : "off");
+        // Pipelined requests are on their way behind it: sent again, the write
+        // would land after the next one of its channel.
+        DEBUG_ATS("ats::_scheduleRetry a later write of channel %lu is queued, no retry.\r\n", req.channelNumber);
+        return false;
+    }
 
-#ifdef DONT_COMPILE_DEBUG_LINES_AsyncTS
-        if (debug)
-        {
-            DEBUG_IOTA_PORT.printf("Sourcecode doesn't contain debug lines.");
-        }
-#endif
+    uint32_t now = millis();
+    if (now - _budgetStart[cls] >= policy.budgetWindow)
+    {
+        _budgetStart[cls] = now;
+        _budgetUsed[cls] = 0;
     }
-    _debug = debug;
+    if (req.attempts >= policy.maxAttempts || (policy.budget && _budgetUsed[cls] >= policy.budget))
+    {
+        DEBUG_ATS("ats::_scheduleRetry gave up after %u attempts.\r\n", req.attempts);
+        _retryStats[cls].giveUps++;
+        return false;
+    }
+    _budgetUsed[cls]++;
+    _retryStats[cls].retries++;
+
+    uint32_t backoff = policy.baseBackoff;
+    for (uint8_t i = 1; i < req.attempts && backoff < policy.maxBackoff; i++)
+        backoff *= 2;
+    if (backoff > policy.maxBackoff)
+        backoff = policy.maxBackoff;
+    uint32_t spread = backoff / 100 * policy.jitter;
+    if (spread)
+        backoff = backoff - spread + random(spread + 1);
+    if (req.writesession && _inFlight <= 1)
+    {
+        // A write keeps its place at the head, so the samples of its channel stay
+        // in order. _startNext() starts it when the backoff is over.
+        DEBUG_ATS("ats::_scheduleRetry attempt %u in %u ms.\r\n", req.attempts + 1, backoff);
+        req.sent = 0;
+        req.notBefore = now + backoff;
+        return true;
+    }
+    DEBUG_ATS("ats::_scheduleRetry attempt %u in %u ms.\r\n", req.attempts + 1, backoff);
+
+    // The request goes behind the waiting ones, the slot freed at the head
+    // takes it even if the queue is full.
+    tsRequest retry;
+    _moveRequest(retry, req);
+    _popRequest();
+    tsRequest &slot = _queue[(_qHead + _qCount) % ATS_QUEUE_SIZE];
+    _qCount++;
+    _queueStats.depth = _qCount;
+    _moveRequest(slot, retry);
+    slot.sent = 0;
+    slot.streamed = false;
+    slot.notBefore = now + backoff;
+    return true;
+}
+
+void AsyncTS::_onRetryTimer(AsyncTS *self)
+{
+    self->_retryDue();
+}
+
+void AsyncTS::_retryDue()
+{
+    SEMAPHORE_TAKE();
+    _startQueued();
+    SEMAPHORE_GIVE();
 }
 
 /**
- * @brief Write a String value to a single field in a ThingSpeak channel.
- * @param   channelNumber   Channel number.
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           String value.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * @brief Complete a waiting request with TS_ERR_QUEUE_DROPPED. The slot is left in the queue.
 */
-bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, String value, const char *writeAPIKey)
+void AsyncTS::_dropRequest(tsRequest &req)
 {
-    _lastTSerrorcode=TS_OK_SUCCESS;
-    DEBUG_ATS("ats::writeField begin \r\n")
-   if (!_isReady())
+    DEBUG_ATS("ats::_dropRequest channel: %lu\r\n", req.channelNumber);
+    int lastTSerrorcode = _lastTSerrorcode;
+    _lastTSerrorcode = TS_ERR_QUEUE_DROPPED;
+    _queueStats.dropped++;
+    _dispatchResponse(req);
+    _lastTSerrorcode = lastTSerrorcode;
+    req.request.flush();
+}
+
+void AsyncTS::_popRequest()
+{
+    tsRequest &req = _queue[_qHead];
+    req.request.flush();
+    req.spool.flush();
+    req.writeCB = nullptr;
+    req.readCB = nullptr;
+    req.selector = nullptr;
+    req.dispatch = nullptr;
+    req.bodySink = nullptr;
+    req.streamCB = nullptr;
+    _qHead = (_qHead + 1) % ATS_QUEUE_SIZE;
+    _qCount--;
+    _queueStats.depth = _qCount;
+}
+
+/**
+ * @brief Move a request to another slot. The xbufs hand over their segments, from is left empty.
+*/
+void AsyncTS::_moveRequest(tsRequest &to, tsRequest &from)
+{
+    to.request.swap(from.request);
+    from.request.flush();
+    to.writesession = from.writesession;
+    to.channelNumber = from.channelNumber;
+    to.enqueued = from.enqueued;
+    to.writeCB = std::move(from.writeCB);
+    to.readCB = std::move(from.readCB);
+    to.selector = std::move(from.selector);
+    to.dispatch = from.dispatch;
+    to.readFn = from.readFn;
+    to.readArg = from.readArg;
+    to.bodySink = std::move(from.bodySink);
+    to.streamCB = std::move(from.streamCB);
+    to.scheduled = from.scheduled;
+    to.sent = from.sent;
+    to.streamed = from.streamed;
+    to.attempts = from.attempts;
+    to.notBefore = from.notBefore;
+    to.api = from.api;
+    to.marks = from.marks;
+    memcpy(to.stamp, from.stamp, sizeof(to.stamp));
+    to.spool.swap(from.spool);
+    from.spool.flush();
+}
+
+tsRequest* AsyncTS::_findWaiting(unsigned long channelNumber, bool writesession)
+{
+    for (uint8_t i = _inFlight; i < _qCount; i++)
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        tsRequest &req = _queue[(_qHead + i) % ATS_QUEUE_SIZE];
+        if (req.channelNumber == channelNumber && req.writesession == writesession)
+            return &req;
+    }
+    return nullptr;
+}
+
+/**
+  * @brief Read a raw response from a private ThingSpeak channel
+  * @post User's callback need process std::any<String>*.
+  * @param channelNumber Channnel number
+  * @param suffixURL Raw URL to write to ThingSpeak as a String.  See the documentation at https://thingspeak.com/docs/channels#get_feed
+  * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
+  * @param ruscb User's callback function to process the server response.
+  * @return If false , client is busy or can't connect.
+ */
+bool AsyncTS::readRaw(unsigned long channelNumber, String suffixURL, const char * readAPIKey, readResponseUserCB ruscb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::ReadRaw Clinet is busy.");
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    // Invalid field number specified
-    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+    if(ruscb)_readResponseUserCB = ruscb;
+    else {DEBUG_ATS("ats::readRaw ruscb is null.");}
+    _retValueSelector = [this](){ this->_readStringFieldCB(); };
+    _rawRequest = true;
+    bool queued = _readRaw(channelNumber, suffixURL.c_str(), readAPIKey);
+    _rawRequest = false;
+    return queued;
+}
+
+
+/**
+  * @brief Read a raw response from a ThingSpeak channel, and receive the body slice by slice.
+  * 
+  * The body is not buffered: every slice goes to sink as soon as it arrives, chunked responses
+  * are decoded on the fly. This bounds the memory need of large reads (e.g. feeds with many results)
+  * to one TCP segment. After the last slice srucb gets the response code.
+  * @param channelNumber Channnel number
+  * @param suffixURL Raw URL to write to ThingSpeak as a String.  See the documentation at https://thingspeak.com/docs/channels#get_feed
+  * @param readAPIKey Read API key associated with the channel, or NULL for a public channel.  *If you share code with others, do _not_ share this key*
+  * @param sink User's callback function which receives the body slices.
+  * @param srucb User's callback function which receives the response code at the end.
+  * @return If false , client is busy or can't connect.
+ */
+bool AsyncTS::readRawStream(unsigned long channelNumber, String suffixURL, const char * readAPIKey, bodySinkUserCB sink, streamResponseUserCB srucb)
+{
+    if (!_isReady())
     {
-        _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
-        if (_writeResponseUserCB)
-        {
-            _writeResponseUserCB(_lastTSerrorcode);
-        }
+        DEBUG_ATS("ats::readRawStream Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-
-    // Max # bytes for ThingSpeak field is 255
-    if (value.length() > FIELDLENGTH_MAX)
+    if (!sink)
     {
-        _lastTSerrorcode = TS_ERR_OUT_OF_RANGE;
-        if (_writeResponseUserCB)
-        {
-            _writeResponseUserCB(_lastTSerrorcode);
-        }
+        DEBUG_ATS("ats::readRawStream sink is null.");
         return false;
     }
+    _bodySinkUserCB = sink;
+    _streamResponseUserCB = srucb;
+    _rawRequest = true;
+    bool queued = _readRaw(channelNumber, suffixURL.c_str(), readAPIKey);
+    _rawRequest = false;
+    _bodySinkUserCB = nullptr;
+    _streamResponseUserCB = nullptr;
+    return queued;
+}
 
-    DEBUG_ATS("ats::writeField (channelNumber: %lu  field: %i writeAPIkey: %s )\r\n", channelNumber, field, writeAPIKey);
-
-    String postMessage = String("field");
-    postMessage.concat(field);
-    postMessage.concat("=");
-    postMessage.concat(value);
+void AsyncTS::_readCreatedAtCB()
+{
+    if (_readCB())
+    {
+        std::any res = String("");
+        if (_lastTSerrorcode == TS_OK_SUCCESS)
+        {
+            res = jsonValue(_body, "created_at");
+        }
 
-    return _writeRaw(channelNumber, postMessage, writeAPIKey);
+        _readCB()(_lastTSerrorcode, &res);
+    }
 }
 /**
- * @brief Write a String value to a single field in a ThingSpeak channel
+ * @brief Read the created-at timestamp associated with the latest update to a private ThingSpeak channel
  * 
- * @param   channelNumber   Channel number.
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           String value.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @param   wrucb           User's callback function to process the server response.
+ * @post User's callback need process std::any<String>*.
+ * 
+ * @param channelNumber Channel number
+ * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
  * @retval false: AsyncTS client is busy. Couldn't send the request.
  * @retval true: request is under sending.
 */
-bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, String value, const char * writeAPIKey, writeResponseUserCB wrucb)
+bool AsyncTS::_readCreatedAt(unsigned long channelNumber, const char *readAPIKey)
 {
     if (!_isReady())
     {
-        DEBUG_ATS("ats::writeField Clinet is busy.");
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    if(wrucb)_writeResponseUserCB = wrucb;
-    else {DEBUG_ATS("ats::writeField wrucb is null.");}
-    return _writeField(channelNumber,field,value,writeAPIKey);
+    _retValueSelector = [this](){ this->_readCreatedAtCB();};
+    _request.flush();
+    return _readRaw(channelNumber, "/feeds/last.txt", readAPIKey);
 }
 
 /**
- * @brief Write an integer value to a single field in a ThingSpeak channel
- * 
+ * @brief Read the created-at timestamp associated with the latest update to a private ThingSpeak channel
  * 
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Integer value (from -32,768 to 32,767) to write.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param channelNumber Channel number
+ * @param readAPIKey Read API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param ruscb User's callback function to process the server response.
  * @retval false: AsyncTS client is busy. Couldn't send the request.
  * @retval true: request is under sending.
+ * @post User's callback need process std::any<String>*.
 */
-bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, int value, const char *writeAPIKey)
-{   
+bool AsyncTS::readCreatedAt(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb)
+{
     if (!_isReady())
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        DEBUG_ATS("ats::readCreatedAt Clinet is busy.");
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    char valueString[10]; // int range is -32768 to 32768, so 7 bytes including terminator, plus a little extra
-    itoa(value, valueString, 10);
-    return _writeField(channelNumber, field, String(valueString), writeAPIKey);
+    if(ruscb)_readResponseUserCB = ruscb;
+    else {DEBUG_ATS("ats::readCreatedAt ruscb is null.");}
+    return _readCreatedAt(channelNumber,readAPIKey);
 }
 
+
 /**
- * @brief Write an integer value to a single field in a ThingSpeak channel
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Integer value (from -32,768 to 32,767) to write.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @param   wrucb           User's callback function to process the server response.
+ * @brief Read the created-at timestamp associated with the latest update to a public ThingSpeak channel
+ * 
+ * 
+ * @param channelNumber Channel number
  * @retval false: AsyncTS client is busy. Couldn't send the request.
  * @retval true: request is under sending.
+ * @post User's callback need process std::any<String>*.
 */
-bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, int value, const char * writeAPIKey, writeResponseUserCB wrucb)
+bool AsyncTS::_readCreatedAt(unsigned long channelNumber)
 {
-    if (!_isReady())
-    {
-        DEBUG_ATS("ats::writeField Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
-    }
-    if(wrucb)_writeResponseUserCB = wrucb;
-    else {DEBUG_ATS("ats::writeField wrucb is null.");}
-    return _writeField(channelNumber, field, value, writeAPIKey);
+    return _readCreatedAt(channelNumber, NULL);
 }
 
 /**
- * @brief Write a long value to a single field in a ThingSpeak channel
- * 
+ * @brief Read the created-at timestamp associated with the latest update to a public ThingSpeak channel
  * 
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Long value (from -2,147,483,648 to 2,147,483,647) to write.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param channelNumber Channel number
+ * @param ruscb User's callback function to process the server response.
  * @retval false: AsyncTS client is busy. Couldn't send the request.
  * @retval true: request is under sending.
+ * @post User's callback need process std::any<String>*.
 */
-bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, long value, const char *writeAPIKey)
+bool AsyncTS::readCreatedAt(unsigned long channelNumber, readResponseUserCB ruscb)
 {
     if (!_isReady())
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        DEBUG_ATS("ats::readcreatedAt Clinet is busy.");
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    char valueString[15]; // long range is -2147483648 to 2147483647, so 12 bytes including terminator
-    ltoa(value, valueString, 10);
-    return _writeField(channelNumber, field, valueString, writeAPIKey);
+    if(ruscb)_readResponseUserCB = ruscb;
+    else {DEBUG_ATS("ats::readcreatedAt ruscb is null.");}
+    return _readCreatedAt(channelNumber,NULL);
+}
+/**
+ * @brief  Set AsyncClient.
+ * @param  &client AsynClient reference.
+*/
+void AsyncTS::setClient(AsyncClient &client)
+{
+    _client = &client;
 }
 
 /**
- * @brief Write a long value to a single field in a ThingSpeak channel
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Long value (from -2,147,483,648 to 2,147,483,647) to write.
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @param   wrucb           User's callback function to process the server response.
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * @brief Turn the persistent-connection mode on or off.
+ * 
+ * In keep-alive mode the connection stays open after a complete response, so the next
+ * request doesn't pay for a new TCP handshake. The connection is closed if the server asks
+ * for it, or after idleTimeout milliseconds without a request. If it was closed, the next
+ * request reconnects.
+ * @param keepAlive true/on , false/off
+ * @param idleTimeout Idle time in milliseconds after a kept-alive connection is closed.
+ * @note Use getConnectCount() and getReuseCount() to check the saving.
 */
-bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, long value, const char * writeAPIKey, writeResponseUserCB wrucb)
+void AsyncTS::setKeepAlive(bool keepAlive, uint32_t idleTimeout)
 {
-    if (!_isReady())
+    DEBUG_ATS("ats::setKeepAlive(%s, %u)\r\n", keepAlive ? "on" : "off", idleTimeout);
+    bool rerender = _keepAlive != keepAlive;
+    _keepAlive = keepAlive;
+    _keepAliveTimeout = idleTimeout;
+    for (tsChannelTemplate &entry : _templates)
     {
-        DEBUG_ATS("ats::writeField Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        // The Connection header is part of the pre-rendered heads.
+        if (entry.channelNumber && rerender)
+            _renderTemplate(entry);
+    }
+    if (!_keepAlive && _state == IDLE)
+    {
+        _setState(DISCONNECTING);
+        _client->close();
     }
-    if(wrucb)_writeResponseUserCB = wrucb;
-    else {DEBUG_ATS("ats::writeField wrucb is null.");}
-    return _writeField(channelNumber, field, value, writeAPIKey);
 }
 
 /**
- * @brief Write a floating point value to a single field in a ThingSpeak channel
+ * @brief Set what happens with a new request if the queue is full.
+ * 
+ * Up to ATS_QUEUE_SIZE requests can be waiting or in flight. They are sent one after the other.
+ * @param policy
+ * @arg QUEUE_REJECT               The new request is refused, the request function returns false. (default)
+ * @arg QUEUE_DROP_OLDEST          The oldest waiting request is dropped.
+ * @arg QUEUE_REPLACE_SAME_CHANNEL A waiting read (or write) request to the same channel is replaced with the new read (or write).
+ * @note A dropped or replaced request completes with -305 through its own callback.
+*/
+void AsyncTS::setQueuePolicy(queuePolicy policy)
+{
+    _queuePolicy = policy;
+}
+
+/**
+ * @brief Turn HTTP pipelining on or off.
  * 
+ * With pipelining the queued requests are written back-to-back on one kept-alive connection
+ * without waiting for the previous responses. The responses are matched to the requests in order.
+ * Turning it on also turns on setKeepAlive().
+ * @param pipelining true/on , false/off
+ * @param maxDepth Max number of requests in flight on the connection.
+ * @note If the connection is lost, every request in flight completes with -301.
+*/
+void AsyncTS::setPipelining(bool pipelining, uint8_t maxDepth)
+{
+    DEBUG_ATS("ats::setPipelining(%s, %u)\r\n", pipelining ? "on" : "off", maxDepth);
+    _pipelining = pipelining;
+    _pipelineDepth = maxDepth ? maxDepth : 1;
+    if (_pipelining && !_keepAlive)
+    {
+        setKeepAlive(true);
+    }
+}
+
+/**
+ * @brief Reset the statistics of getQueueStats(). The current depth is kept.
+*/
+void AsyncTS::resetQueueStats()
+{
+    _queueStats = {};
+    _queueStats.depth = _qCount;
+}
+
+/**
+ * @brief Set the retry policy of reads or writes.
  * 
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Floating point value (from -999999000000 to 999999000000) to write.  If you need more accuracy, or a wider range, you should format the number using <tt>dtostrf</tt> and writeField().
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * A failed request is scheduled again after a backoff instead of calling its callback.
+ * The backoff starts at baseBackoff and doubles at every attempt up to maxBackoff,
+ * jitter percent of it is random. Only the last attempt reaches the callback.
+ * Reads are retried after -301, -303, -304 and 5xx responses, except streamed reads
+ * whose body reached the sink already.
+ * Writes are retried only if no byte of the request was handed to the connection
+ * (-301, -304) or the server answered with 0 (-401), so a point is never written twice.
+ * @param cls READ_REQUESTS or WRITE_REQUESTS
+ * @param policy maxAttempts 1 turns retrying off (default).
+ * @note Retries share the queue with the new requests and keep their order.
 */
-bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, float value, const char *writeAPIKey)
+void AsyncTS::setRetryPolicy(requestClass cls, const tsRetryPolicy &policy)
 {
-    if (!_isReady())
+    _retryPolicy[cls] = policy;
+    if (_retryPolicy[cls].maxAttempts == 0)
+        _retryPolicy[cls].maxAttempts = 1;
+    if (_retryPolicy[cls].jitter > 100)
+        _retryPolicy[cls].jitter = 100;
+}
+
+/**
+ * @brief Reset the statistics of getRetryStats() and the retry budgets.
+*/
+void AsyncTS::resetRetryStats()
+{
+    for (uint8_t i = 0; i < 2; i++)
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        _retryStats[i] = {};
+        _budgetUsed[i] = 0;
+    }
+}
+
+/**
+ * @brief Set the min time between the writes of a channel, turning on the write scheduler.
+ * 
+ * ThingSpeak refuses the updates of a channel coming faster than the limit of the account (-401).
+ * The scheduler remembers when the last write of a channel was answered, and holds a writeFields()
+ * coming earlier (or while the previous one is on its way) until the next legal slot.
+ * The fields of further writeFields() calls are merged into the held one, the last value of a
+ * field wins, so each slot sends one request with the freshest data. Every merged call gets
+ * the result of that request through its own callback.
+ * @param interval Min time between writes in milli seconds, TS_FREE_UPDATE_INTERVAL for a free account.
+ * 0 turns the scheduler off (default), the held writes are sent right away.
+ * @note Up to ATS_SCHEDULED_CHANNELS channels are tracked, the writes of further channels are sent at once.
+ * writeRaw() and writeField() are not scheduled.
+*/
+void AsyncTS::setUpdateInterval(uint32_t interval)
+{
+    SEMAPHORE_TAKE();
+    _updateInterval = interval;
+    _armSchedule();
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Reset the counters of getConnectCount(), getReuseCount() and getTLSStats().
+*/
+void AsyncTS::resetConnectionStats()
+{
+    _connectCount = 0;
+    _reuseCount = 0;
+    _tlsStats = {};
+}
+
+/**
+ * @brief Turn the latency statistics on or off.
+ * 
+ * Every request is timestamped when it is queued, started, connected, and when the first byte,
+ * the end of the headers and the end of the response arrive. The time between the steps goes
+ * to a log-linear histogram of the step for writes, reads and raw requests, see latencySpan.
+ * Retried requests are measured from the start of their last attempt, except SPAN_QUEUE and
+ * SPAN_TOTAL which count from the first time they were queued.
+ * @param enable The histograms (3040 bytes, 1744 with ATS_HIST_SUB_BITS 1) are allocated when
+ * turned on and freed when turned off.
+*/
+void AsyncTS::setLatencyStats(bool enable)
+{
+    SEMAPHORE_TAKE();
+    if (enable && !_latency)
+    {
+        _latency = new tsLatencyStats();
+        // Requests queued before have no timestamps and are not counted.
+        for (uint8_t i = 0; i < ATS_QUEUE_SIZE; i++)
+            _queue[i].marks = 0;
+    }
+    else if (!enable)
+    {
+        delete _latency;
+        _latency = nullptr;
+    }
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Clear the latency histograms.
+*/
+void AsyncTS::resetLatencyStats()
+{
+    SEMAPHORE_TAKE();
+    if (_latency)
+        *_latency = {};
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Get a latency histogram for an own export or for merging histograms of several connections.
+ * @return nullptr if the latency statistics are off.
+*/
+const tsLatencyHistogram* AsyncTS::getLatencyHistogram(latencyApi api, latencySpan span)
+{
+    return _latency ? &_latency->histogram[api][span] : nullptr;
+}
+
+/**
+ * @brief Count, mean, max and percentiles of a step of the requests of an API.
+ * @return All zero if the latency statistics are off.
+*/
+latencySummary AsyncTS::getLatencySummary(latencyApi api, latencySpan span)
+{
+    latencySummary summary = {};
+    SEMAPHORE_TAKE();
+    if (_latency)
+    {
+        summary = summarizeLatency(_latency->histogram[api][span]);
+        summary.failures = _latency->failures[api];
+    }
+    SEMAPHORE_GIVE();
+    return summary;
+}
+
+/**
+ * @brief Count, mean, max and percentiles of a histogram. The failures are not known here, they are 0.
+*/
+latencySummary AsyncTS::summarizeLatency(const tsLatencyHistogram &histogram)
+{
+    latencySummary summary = {};
+    summary.count = histogram.count;
+    summary.max = histogram.max;
+    if (!histogram.count)
+        return summary;
+    summary.mean = histogram.sum / histogram.count;
+
+    // The buckets may be halved, the ranks are taken from their own total.
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < ATS_HIST_BUCKETS; i++)
+        total += histogram.bucket[i];
+
+    // Rank of each percentile, rounded up.
+    const uint32_t permille[4] = {500, 900, 990, 999};
+    uint32_t *result[4] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    uint8_t next = 0;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < ATS_HIST_BUCKETS && next < 4; i++)
+    {
+        seen += histogram.bucket[i];
+        while (next < 4 && (uint64_t)seen * 1000 >= (uint64_t)total * permille[next])
+        {
+            uint32_t limit = latencyBucketLimit(i);
+            *result[next++] = limit < histogram.max ? limit : histogram.max;
+        }
+    }
+    return summary;
+}
+
+/**
+ * @brief Upper limit of a bucket of the latency histograms, exclusive, in micro seconds.
+ * @return UINT32_MAX for the last bucket.
+*/
+uint32_t AsyncTS::latencyBucketLimit(uint8_t bucket)
+{
+    if (bucket == 0)
+        return 1UL << ATS_HIST_MIN_BITS;
+    if (bucket >= ATS_HIST_BUCKETS - 1)
+        return UINT32_MAX;
+    uint8_t exponent = ATS_HIST_MIN_BITS + ((bucket - 1) >> ATS_HIST_SUB_BITS);
+    uint32_t sub = (bucket - 1) & ((1 << ATS_HIST_SUB_BITS) - 1);
+    return (1UL << exponent) + ((sub + 1) << (exponent - ATS_HIST_SUB_BITS));
+}
+
+static uint8_t latencyBucket(uint32_t us)
+{
+    if (us < (1UL << ATS_HIST_MIN_BITS))
+        return 0;
+    uint8_t exponent = 31 - __builtin_clz(us);
+    if (exponent >= ATS_HIST_MAX_BITS)
+        return ATS_HIST_BUCKETS - 1;
+    uint32_t sub = (us >> (exponent - ATS_HIST_SUB_BITS)) & ((1 << ATS_HIST_SUB_BITS) - 1);
+    return 1 + ((exponent - ATS_HIST_MIN_BITS) << ATS_HIST_SUB_BITS) + sub;
+}
+
+// Halve the buckets, a bucket with requests in it keeps at least one.
+static void halveBuckets(tsLatencyHistogram &histogram)
+{
+    for (uint8_t i = 0; i < ATS_HIST_BUCKETS; i++)
+        histogram.bucket[i] -= histogram.bucket[i] / 2;
+}
+
+static void addLatency(tsLatencyHistogram &histogram, uint32_t us)
+{
+    histogram.count++;
+    histogram.sum += us;
+    if (us > histogram.max)
+        histogram.max = us;
+    uint16_t &bucket = histogram.bucket[latencyBucket(us)];
+    if (bucket == UINT16_MAX)
+        halveBuckets(histogram);
+    bucket++;
+}
+
+/**
+ * @brief Add a histogram to another one, e.g. to merge the histograms of several connections.
+ * If a bucket would overflow, both are halved until it fits, so they keep their weights.
+*/
+void AsyncTS::mergeLatency(tsLatencyHistogram &into, const tsLatencyHistogram &from)
+{
+    tsLatencyHistogram add = from;
+    for (uint8_t i = 0; i < ATS_HIST_BUCKETS; i++)
+    {
+        while ((uint32_t)into.bucket[i] + add.bucket[i] > UINT16_MAX)
+        {
+            halveBuckets(into);
+            halveBuckets(add);
+        }
+    }
+    into.count += add.count;
+    into.sum += add.sum;
+    if (add.max > into.max)
+        into.max = add.max;
+    for (uint8_t i = 0; i < ATS_HIST_BUCKETS; i++)
+        into.bucket[i] += add.bucket[i];
+}
+
+#if ATS_ALLOC_STATS
+/**
+ * @brief Heap allocations counted by the platform. This one counts nothing; the host build,
+ * or a sketch with its own malloc counting, defines the real one.
+*/
+__attribute__((weak)) atsHeapCount atsHeapCounter()
+{
+    return {0, 0};
+}
+
+/**
+ * @brief Get the allocation statistics of a request type.
+ * 
+ * Allocations are charged to a request type when a request is queued (building it), and when
+ * it completes (sending, receiving, parsing and the user's callback), so with one request at
+ * a time allocs / requests is the cost of a request. Requests of several instances or in
+ * parallel share the counters of the platform and can be charged to each other.
+*/
+allocStats AsyncTS::getAllocStats(latencyApi api)
+{
+    return _allocStats[api];
+}
+
+/**
+ * @brief Clear the allocation statistics.
+*/
+void AsyncTS::resetAllocStats()
+{
+    SEMAPHORE_TAKE();
+    for (uint8_t i = 0; i < ATS_LATENCY_APIS; i++)
+        _allocStats[i] = {};
+    _heapSeen = atsHeapCounter();
+    xbuf::resetPeakSegments();
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Charge the allocations since the last call to a request type.
+ * @param completed A request of the type completed, count it.
+*/
+void AsyncTS::_chargeAlloc(uint8_t api, bool completed)
+{
+    atsHeapCount now = atsHeapCounter();
+    allocStats &stats = _allocStats[api];
+    stats.allocs += now.allocs - _heapSeen.allocs;
+    stats.bytes += now.bytes - _heapSeen.bytes;
+    _heapSeen = now;
+    if (completed)
+        stats.requests++;
+    if (xbuf::peakSegments > stats.peakSegments)
+        stats.peakSegments = xbuf::peakSegments;
+    xbuf::resetPeakSegments();
+#if !defined(ATS_HOST) && (defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32))
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (!stats.minFreeHeap || freeHeap < stats.minFreeHeap)
+        stats.minFreeHeap = freeHeap;
+#endif
+}
+#endif
+
+/**
+ * @brief Timestamp a step of a request for the latency statistics.
+*/
+void AsyncTS::_mark(tsRequest *req, latencymark mark)
+{
+    if (!_latency || !req)
+        return;
+    req->stamp[mark] = micros();
+    req->marks |= 1 << mark;
+}
+
+/**
+ * @brief Add the steps of a completed request to the latency histograms.
+*/
+void AsyncTS::_recordLatency(tsRequest &req)
+{
+    if (!_latency || !(req.marks & (1 << MARK_ENQUEUED)))
+        return;
+    if (!(req.marks & (1 << MARK_COMPLETE)))
+    {
+        _latency->failures[req.api]++;
+        return;
+    }
+    tsLatencyHistogram *histogram = _latency->histogram[req.api];
+    for (uint8_t span = SPAN_QUEUE; span < SPAN_TOTAL; span++)
+    {
+        // A span is only known if both of its ends are.
+        if (((req.marks >> span) & 3) == 3)
+            addLatency(histogram[span], req.stamp[span + 1] - req.stamp[span]);
+    }
+    addLatency(histogram[SPAN_TOTAL], req.stamp[MARK_COMPLETE] - req.stamp[MARK_ENQUEUED]);
+}
+
+/**
+ * @brief Turn the HTTPS mode on or off.
+ * 
+ * In HTTPS mode the requests go to port 443 through TLS, so the API keys don't travel in
+ * cleartext. The certificate of the server is pinned: after the handshake its SHA-1 fingerprint
+ * is compared with fingerprint, and on a mismatch the connection is aborted before anything is
+ * sent; the requests in flight get -307. A full TLS handshake takes seconds on an ESP8266; turn
+ * on setKeepAlive() too, then the kept-alive connection serves the next requests without a
+ * handshake. getTLSStats() counts the handshakes and those requests. The handshake is part of
+ * the connect phase, see setTimeouts().
+ * @param secure true/on , false/off
+ * @param fingerprint ATS_FINGERPRINT_SIZE bytes of the SHA-1 fingerprint of the certificate of the server. Needed to turn the mode on.
+ * @retval false: the client library was built without TLS (ASYNC_TCP_SSL_ENABLED of ESPAsyncTCP), or there is no fingerprint. The mode is not changed.
+ * @retval true: the next connection uses the new mode.
+ * @note Update the fingerprint when ThingSpeak renews its certificate.
+*/
+bool AsyncTS::setSecure(bool secure, const uint8_t *fingerprint)
+{
+#if ASYNC_TCP_SSL_ENABLED
+    if (secure && !fingerprint)
+    {
+        DEBUG_ATS("ats::setSecure the fingerprint of the server is needed.\r\n");
+        return false;
+    }
+    SEMAPHORE_TAKE();
+    DEBUG_ATS("ats::setSecure(%s)\r\n", secure ? "on" : "off");
+    if (secure && memcmp(fingerprint, _fingerprint, ATS_FINGERPRINT_SIZE) && _secure && _state == IDLE)
+    {
+        // The kept-alive connection was verified with the old fingerprint.
+        _setState(DISCONNECTING);
+        _client->close();
+    }
+    if (secure)
+        memcpy(_fingerprint, fingerprint, ATS_FINGERPRINT_SIZE);
+    if (secure != _secure && _state == IDLE)
+    {
+        // The kept-alive connection belongs to the other port.
+        _setState(DISCONNECTING);
+        _client->close();
+    }
+    _secure = secure;
+    _setPort(_secure ? THINGSPEAK_HTTPS_PORT_NUMBER : THINGSPEAK_PORT_NUMBER);
+    SEMAPHORE_GIVE();
+    return true;
+#else
+    DEBUG_ATS("ats::setSecure TLS is not supported by the client.\r\n");
+    return !secure;
+#endif
+}
+/**
+ * @brief Set on or off the bebug messages.
+ * @param debug true/on , false/off
+ * @note If you define the option "DONT_COMPILE_DEBUG_LINES_AsyncTS" in the Async.hpp file,
+ * you can save extra flash memory, because the source file will not contain the error messages.
+*/
+void AsyncTS::setDebug(bool debug)
+{
+    if (_debug || debug)
+    {
+        DEBUG_ATS("ats::setDebug(%s) \r\n", debug ? "on" : "off");
+
+#ifdef DONT_COMPILE_DEBUG_LINES_AsyncTS
+        if (debug)
+        {
+            DEBUG_IOTA_PORT.printf("Sourcecode doesn't contain debug lines.");
+        }
+#endif
+    }
+    _debug = debug;
+}
+
+/**
+ * @brief Write a String value to a single field in a ThingSpeak channel.
+ * @param   channelNumber   Channel number.
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           String value.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, String value, const char *writeAPIKey)
+{
+    _lastTSerrorcode=TS_OK_SUCCESS;
+    DEBUG_ATS("ats::writeField begin \r\n")
+   if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    // Invalid field number specified
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+    {
+        _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
+        if (_writeResponseUserCB)
+        {
+            _writeResponseUserCB(_lastTSerrorcode);
+        }
+        return false;
+    }
+
+    // Max # bytes for ThingSpeak field is 255
+    if (value.length() > FIELDLENGTH_MAX)
+    {
+        _lastTSerrorcode = TS_ERR_OUT_OF_RANGE;
+        if (_writeResponseUserCB)
+        {
+            _writeResponseUserCB(_lastTSerrorcode);
+        }
+        return false;
+    }
+
+    DEBUG_ATS("ats::writeField (channelNumber: %lu  field: %i writeAPIkey: %s )\r\n", channelNumber, field, writeAPIKey);
+
+    return _writeFieldValue(channelNumber, field, value.c_str(), value.length(), writeAPIKey);
+}
+
+/**
+ * @brief Build and queue the request of a single field update, "fieldX=[value]&headers=false".
+ * @param field Field number, already checked.
+ * @param value Formatted value, at most FIELDLENGTH_MAX bytes.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeFieldValue(unsigned long channelNumber, unsigned int field, const char *value, size_t len, const char *writeAPIKey)
+{
+    _request.flush();
+    _writesession = true;
+    _writeFormHeader(channelNumber, writeAPIKey, 7 + len + 14);
+    _request.write("field");
+    _request.write((uint8_t)('0' + field));
+    _request.write((uint8_t)'=');
+    _request.write((const uint8_t *)value, len);
+    _request.write("&headers=false");
+
+    return _submit(channelNumber);
+}
+/**
+ * @brief Write a String value to a single field in a ThingSpeak channel
+ * 
+ * @param   channelNumber   Channel number.
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           String value.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param   wrucb           User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, String value, const char * writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeField Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if(wrucb)_writeResponseUserCB = wrucb;
+    else {DEBUG_ATS("ats::writeField wrucb is null.");}
+    return _writeField(channelNumber,field,value,writeAPIKey);
+}
+
+/**
+ * @brief Write an integer value to a single field in a ThingSpeak channel
+ * 
+ * 
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Integer value (from -32,768 to 32,767) to write.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, int value, const char *writeAPIKey)
+{   
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    return _writeField(channelNumber, field, (long)value, writeAPIKey);
+}
+
+/**
+ * @brief Write an integer value to a single field in a ThingSpeak channel
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Integer value (from -32,768 to 32,767) to write.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param   wrucb           User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, int value, const char * writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeField Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if(wrucb)_writeResponseUserCB = wrucb;
+    else {DEBUG_ATS("ats::writeField wrucb is null.");}
+    return _writeField(channelNumber, field, value, writeAPIKey);
+}
+
+/**
+ * @brief Write a long value to a single field in a ThingSpeak channel
+ * 
+ * 
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Long value (from -2,147,483,648 to 2,147,483,647) to write.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, long value, const char *writeAPIKey)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+    {
+        _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
+        if (_writeResponseUserCB)
+            _writeResponseUserCB(_lastTSerrorcode);
+        return false;
+    }
+    _lastTSerrorcode = TS_OK_SUCCESS;
+    char valueString[ATS_FORMAT_INT_SIZE];
+    size_t len = atsFormatLong(valueString, value);
+    return _writeFieldValue(channelNumber, field, valueString, len, writeAPIKey);
+}
+
+/**
+ * @brief Write a long value to a single field in a ThingSpeak channel
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Long value (from -2,147,483,648 to 2,147,483,647) to write.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param   wrucb           User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, long value, const char * writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeField Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if(wrucb)_writeResponseUserCB = wrucb;
+    else {DEBUG_ATS("ats::writeField wrucb is null.");}
+    return _writeField(channelNumber, field, value, writeAPIKey);
+}
+
+/**
+ * @brief Write a floating point value to a single field in a ThingSpeak channel
+ * 
+ * 
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Floating point value (from -999999000000 to 999999000000) to write, with the decimals of setFieldPrecision() (default 5).  For a wider range, format the number yourself and use writeField() with the resulting string.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeField(unsigned long channelNumber, unsigned int field, float value, const char *writeAPIKey)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+    {
+        _lastTSerrorcode = TS_ERR_INVALID_FIELD_NUM;
+        if (_writeResponseUserCB)
+            _writeResponseUserCB(_lastTSerrorcode);
+        return false;
+    }
+    char valueString[ATS_FORMAT_FLOAT_SIZE];
+    int status = _convertFloatToChar(value, _fieldPrecision[field - 1], valueString);
+    if (status != TS_OK_SUCCESS)
+    {
+        _lastTSerrorcode = status;
+        if (_writeResponseUserCB)
+            _writeResponseUserCB(_lastTSerrorcode);
+        return false;
+    }
+    return _writeFieldValue(channelNumber, field, valueString, strlen(valueString), writeAPIKey);
+}
+
+/**
+ * @brief Write a floating point value to a single field in a ThingSpeak channel
+ * @param   channelNumber   Channel number
+ * @param   field           Field number (1-8) within the channel to write to.
+ * @param   value           Floating point value (from -999999000000 to 999999000000) to write, with the decimals of setFieldPrecision() (default 5).  For a wider range, format the number yourself and use writeField() with the resulting string.
+ * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param   wrucb           User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, float value, const char * writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeField Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if(wrucb)_writeResponseUserCB = wrucb;
+    else {DEBUG_ATS("ats::writeField wrucb is null.");}
+    return _writeField(channelNumber, field, value, writeAPIKey);
+}
+
+/**
+ * @brief    Write a multi-field update.
+ * 
+ * Call  onWriteServerResponseUserCB(),setField(), setLatitude(), setLongitude(), setElevation()
+ * and/or setStatus() and then call writeFields()
+ * 
+ * @param    channelNumber Channel number
+ * @param    writeAPIKey Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending. 
+*/
+bool AsyncTS::_writeFields(unsigned long channelNumber, const char *writeAPIKey)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeRaw Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    _writesession = true;
+    if (!_nextWrite.set)
+    {
+        // setField was not called before writeFields
+        _lastTSerrorcode = TS_ERR_SETFIELD_NOT_CALLED;
+        if (_writeResponseUserCB)
+        {
+            _writeResponseUserCB(_lastTSerrorcode);
+        }
+        return false;
+    }
+
+    tsChannelSchedule *entry = _updateInterval ? _scheduleEntry(channelNumber) : nullptr;
+    if (entry && _writeResponseUserCB && entry->callbacks == ATS_HELD_CALLBACKS)
+    {
+        // No room for one more callback of the held write, like a full queue.
+        DEBUG_ATS("ats::writeFields too many writes of channel %lu are waiting.\r\n", channelNumber);
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (entry && _holdWrite(*entry, writeAPIKey))
+    {
+        _resetWriteFields();
+        return true;
+    }
+    _buildWriteFields(channelNumber, _nextWrite, writeAPIKey);
+    if (_spool)
+        _addSpoolRecord(channelNumber, writeAPIKey, _nextWrite);
+    _resetWriteFields();
+    if (!entry)
+        return _submit(channelNumber);
+    entry->busy = true;
+    if (_submit(channelNumber, true))
+        return true;
+    entry->busy = false;
+    return false;
+}
+
+/**
+ * @brief Queue an update with a form built by the caller, like the one of a ChannelSchema.
+ * @param form "fieldN=value&...headers=false"
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::_writeForm(unsigned long channelNumber, const char *form, size_t len, const char *writeAPIKey)
+{
+    _request.flush();
+    _writesession = true;
+    _writeFormHeader(channelNumber, writeAPIKey, len);
+    _request.write((const uint8_t *)form, len);
+    return _submit(channelNumber);
+}
+
+/**
+ * @brief Find the schedule entry of a channel, or take a free one.
+ * @return nullptr if every entry is taken by another channel.
+*/
+tsChannelSchedule* AsyncTS::_scheduleEntry(unsigned long channelNumber)
+{
+    tsChannelSchedule *free = nullptr;
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < ATS_SCHEDULED_CHANNELS; i++)
+    {
+        tsChannelSchedule &entry = _schedule[i];
+        if (entry.channelNumber == channelNumber)
+            return &entry;
+        if (!free && (entry.channelNumber == 0 ||
+                      (!entry.busy && !entry.held && (!entry.accepted || now - entry.lastAccepted >= _updateInterval))))
+            free = &entry; // Unused, or its slot is open anyway.
+    }
+    if (free)
+    {
+        free->channelNumber = channelNumber;
+        free->busy = false;
+        free->held = false;
+        free->accepted = false;
+        free->callbacks = 0;
+        free->sentCallbacks = 0;
+    }
+    return free;
+}
+
+/**
+ * @brief Hold the staged fields in the schedule entry if the channel can't be written now.
+ * @return False if the write can go right away.
+*/
+bool AsyncTS::_holdWrite(tsChannelSchedule &entry, const char *writeAPIKey)
+{
+    bool early = entry.accepted && millis() - entry.lastAccepted < _updateInterval;
+    if (!entry.held && !entry.busy && !early)
+        return false;
+
+    if (!entry.held)
+    {
+        entry.write.set = 0;
+        entry.held = true;
+    }
+    else
+    {
+        DEBUG_ATS("ats::_holdWrite merge into held write of channel %lu\r\n", entry.channelNumber);
+    }
+    _mergeWrite(entry.write, _nextWrite);
+    // writeFields() checked that there is room for the callback.
+    if (_writeResponseUserCB)
+        entry.writeCB[entry.callbacks++] = _writeResponseUserCB;
+    entry.writeAPIKey = writeAPIKey;
+    _armSchedule();
+    return true;
+}
+
+/**
+ * @brief Copy the set fields of from over to.
+*/
+void AsyncTS::_mergeWrite(tsWriteRecord &to, const tsWriteRecord &from)
+{
+    for (uint16_t bits = from.set; bits; bits &= bits - 1)
+    {
+        uint8_t item = __builtin_ctz(bits);
+        if (item >= WRITE_ITEM_LATITUDE && item <= WRITE_ITEM_ELEVATION)
+            setWriteLocation(to, item, from.location[item - WRITE_ITEM_LATITUDE]);
+        else
+        {
+            const tsWriteValue &value = from.value[valueIndex(item)];
+            setWriteValue(to, item, writeValueText(value), value.length);
+        }
+    }
+}
+
+/**
+ * @brief A scheduled write is completed. An answer of the server (accepted or refused by
+ * the rate limit) starts the interval of the channel.
+*/
+void AsyncTS::_writeDone(tsRequest &req)
+{
+    for (uint8_t i = 0; i < ATS_SCHEDULED_CHANNELS; i++)
+    {
+        tsChannelSchedule &entry = _schedule[i];
+        if (entry.channelNumber != req.channelNumber)
+            continue;
+        entry.busy = false;
+        if (_lastTSerrorcode == TS_OK_SUCCESS || _lastTSerrorcode == TS_ERR_NOT_INSERTED)
+        {
+            entry.accepted = true;
+            entry.lastAccepted = millis();
+        }
+        if (entry.held)
+            _armSchedule();
+        return;
+    }
+}
+
+/**
+ * @brief Call the callbacks of the writeFields() calls merged into the write sent by _runSchedule().
+ * The callbacks of the next held write stay.
+*/
+void AsyncTS::_heldDone(unsigned long channelNumber, int responsecode)
+{
+    for (uint8_t i = 0; i < ATS_SCHEDULED_CHANNELS; i++)
+    {
+        tsChannelSchedule &entry = _schedule[i];
+        if (entry.channelNumber != channelNumber)
+            continue;
+        // Taken out first: a callback may hold a new write of the channel.
+        uint8_t sent = entry.sentCallbacks;
+        writeResponseUserCB done[ATS_HELD_CALLBACKS];
+        for (uint8_t k = 0; k < sent; k++)
+            done[k] = std::move(entry.writeCB[k]);
+        for (uint8_t k = sent; k < entry.callbacks; k++)
+            entry.writeCB[k - sent] = std::move(entry.writeCB[k]);
+        entry.callbacks -= sent;
+        entry.sentCallbacks = 0;
+        for (uint8_t k = 0; k < sent; k++)
+            done[k](responsecode);
+        return;
+    }
+}
+
+/**
+ * @brief Arm the schedule timer for the earliest slot of the held writes.
+*/
+void AsyncTS::_armSchedule()
+{
+    uint32_t now = millis();
+    uint32_t wait = UINT32_MAX;
+    for (uint8_t i = 0; i < ATS_SCHEDULED_CHANNELS; i++)
+    {
+        tsChannelSchedule &entry = _schedule[i];
+        if (!entry.held || entry.busy)
+            continue;
+        uint32_t left = 0;
+        if (entry.accepted && now - entry.lastAccepted < _updateInterval)
+            left = _updateInterval - (now - entry.lastAccepted);
+        if (left < wait)
+            wait = left;
+    }
+    if (wait == UINT32_MAX)
+    {
+        _scheduleTimer.detach();
+        return;
+    }
+    // Sending from the timer keeps the user's callbacks out of the call chain.
+    _scheduleTimer.once_ms(wait ? wait : 1, &AsyncTS::_onScheduleTimer, this);
+}
+
+void AsyncTS::_onScheduleTimer(AsyncTS *self)
+{
+    self->_runSchedule();
+}
+
+/**
+ * @brief Send the held writes whose slot has come.
+*/
+void AsyncTS::_runSchedule()
+{
+    SEMAPHORE_TAKE();
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < ATS_SCHEDULED_CHANNELS; i++)
+    {
+        tsChannelSchedule &entry = _schedule[i];
+        if (!entry.held || entry.busy ||
+            (_updateInterval && entry.accepted && now - entry.lastAccepted < _updateInterval))
+            continue;
+
+        DEBUG_ATS("ats::_runSchedule send held write of channel %lu\r\n", entry.channelNumber);
+        // The request carries only the channel, _heldDone() calls the merged callbacks one by one.
+        unsigned long channelNumber = entry.channelNumber;
+        writeResponseUserCB writeCB = _writeResponseUserCB;
+        _writeResponseUserCB = nullptr;
+        if (entry.callbacks)
+        {
+            _writeResponseUserCB = [this, channelNumber](int responsecode)
+            { _heldDone(channelNumber, responsecode); };
+        }
+        entry.sentCallbacks = entry.callbacks;
+        _writesession = true;
+        _buildWriteFields(entry.channelNumber, entry.write, entry.writeAPIKey.c_str());
+        if (_spool)
+            _addSpoolRecord(entry.channelNumber, entry.writeAPIKey.c_str(), entry.write);
+        entry.held = false;
+        entry.busy = true;
+        bool ok = _submit(entry.channelNumber, true);
+        _writeResponseUserCB = writeCB;
+        if (!ok)
+        {
+            entry.busy = false;
+            _heldDone(channelNumber, _lastTSerrorcode);
+        }
+    }
+    _armSchedule();
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Build the request of a multi-field update into _request.
+ * 
+ * Only the set items are visited. The location is formatted once into a scratch buffer on
+ * the stack, the other items are written from the record as they are, so the form is
+ * serialized in one pass after its length is known, without String temporaries.
+ * @param channelNumber Channel number
+ * @param write Fields of the update. At least one of them is set.
+ * @param writeAPIKey Write API key associated with the channel.
+*/
+void AsyncTS::_buildWriteFields(unsigned long channelNumber, const tsWriteRecord &write, const char *writeAPIKey)
+{
+    // Names of the items after the fields, "fieldX=" is built from the number.
+    static const char *const itemName[WRITE_ITEMS - FIELDNUM_MAX] = {"lat=", "long=", "elevation=", "status=",
+                                                                     "twitter=", "tweet=", "created_at="};
+    char locationText[3][ATS_FORMAT_FLOAT_SIZE];
+    size_t locationLen[3];
+
+    // Every item is followed by '&', then comes "headers=false".
+    size_t contentLen = 13;
+    for (uint16_t bits = write.set; bits; bits &= bits - 1)
+    {
+        uint8_t item = __builtin_ctz(bits);
+        if (item < FIELDNUM_MAX)
+            contentLen += 8 + write.value[item].length; // fieldX=[value]&
+        else if (item <= WRITE_ITEM_ELEVATION)
+        {
+            uint8_t i = item - WRITE_ITEM_LATITUDE;
+            locationLen[i] = atsFormatFloat(locationText[i], write.location[i], ATS_LOCATION_DECIMALS);
+            contentLen += strlen(itemName[item - FIELDNUM_MAX]) + locationLen[i] + 1;
+        }
+        else
+            contentLen += strlen(itemName[item - FIELDNUM_MAX]) + write.value[valueIndex(item)].length + 1;
+    }
+
+    _request.flush();
+    _writeFormHeader(channelNumber, writeAPIKey, contentLen);
+
+    for (uint16_t bits = write.set; bits; bits &= bits - 1)
+    {
+        uint8_t item = __builtin_ctz(bits);
+        if (item < FIELDNUM_MAX)
+        {
+            _request.write("field");
+            _request.write((uint8_t)('1' + item));
+            _request.write((uint8_t)'=');
+        }
+        else
+            _request.write(itemName[item - FIELDNUM_MAX]);
+        if (item >= WRITE_ITEM_LATITUDE && item <= WRITE_ITEM_ELEVATION)
+            _request.write((const uint8_t *)locationText[item - WRITE_ITEM_LATITUDE], locationLen[item - WRITE_ITEM_LATITUDE]);
+        else
+        {
+            const tsWriteValue &value = write.value[valueIndex(item)];
+            _request.write((const uint8_t *)writeValueText(value), value.length);
+        }
+        _request.write((uint8_t)'&');
+    }
+    _request.write("headers=false");
+}
+
+/**
+  *@brief Write a multi-field update.
+  *@pre Call setField(), setLatitude(), setLongitude(), setElevation() and/or setStatus() and then call writeFields().
+  *@param channelNumber Channel number
+  *@param writeAPIKey   Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+  *@param wrucb         User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+bool AsyncTS::writeFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeFields Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if(wrucb)_writeResponseUserCB = wrucb;
+    else {DEBUG_ATS("ats::writeFields wrucb is null.");}
+    return _writeFields(channelNumber, writeAPIKey);
+}
+
+// Keys of the items of a batch sample, in the order of the bits of tsBatchSample::mask.
+static const char *const batchKeys[ATS_BATCH_ITEMS] = {
+    "field1", "field2", "field3", "field4", "field5", "field6", "field7", "field8",
+    "latitude", "longitude", "elevation", "status", "created_at"};
+#define BATCH_CREATED_AT 12
+
+static size_t peekAt(xbuf &buf, size_t offset, uint8_t *dst, size_t len)
+{
+    size_t copied = 0;
+    const uint8_t *span;
+    size_t supply;
+    while (copied < len && (supply = buf.peekSpan(&span, offset + copied)) > 0)
+    {
+        if (supply > len - copied)
+            supply = len - copied;
+        memcpy(dst + copied, span, supply);
+        copied += supply;
+    }
+    return copied;
+}
+
+/**
+ * @brief Add the staged fields to the batch of a bulk update as one sample.
+ * 
+ * Call setField(), setLatitude(), setLongitude(), setElevation(), setStatus() and/or
+ * setCreatedAt() and then batchFields(). The sample is kept in a compact store with the time
+ * it was batched, and sent with the others in one request to the bulk_update.json endpoint
+ * when the size, count or age limit of setBatchLimits() is hit, or when flushBatch() is called.
+ * Samples without created_at are sent with their time relative to the previous sample (delta_t).
+ * The wire format of the channel is set by setBatchFormat().
+ * @param channelNumber Channel number. A sample of another channel sends the batch first.
+ * @param writeAPIKey Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param wrucb User's callback function to process the server response of the bulk update, 202 on success.
+ * @retval false: setField() was not called, or the batch is full and couldn't be sent.
+ * @retval true: the sample is in the batch.
+ * @note Tweets are not supported by the bulk update.
+*/
+bool AsyncTS::batchFields(unsigned long channelNumber, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_nextWrite.set)
+    {
+        // setField was not called before batchFields
+        _lastTSerrorcode = TS_ERR_SETFIELD_NOT_CALLED;
+        if (wrucb)
+            wrucb(_lastTSerrorcode);
+        return false;
+    }
+    if (_batchCount && channelNumber != _batchChannel && !_sendBatch())
+        return false;
+    if (!_storeSample())
+        return false;
+    _batchChannel = channelNumber;
+    _batchAPIKey = writeAPIKey;
+    if (wrucb)
+        _batchCB = wrucb;
+    else {DEBUG_ATS("ats::batchFields wrucb is null.");}
+    _resetWriteFields();
+    DEBUG_ATS("ats::batchFields %u samples, %u bytes\r\n", _batchCount, _batch.available());
+
+    if ((_batchMaxCount && _batchCount >= _batchMaxCount) || (_batchMaxBytes && _batch.available() >= _batchMaxBytes))
+        _sendBatch(); // If the queue is full, the timer tries again.
+    return true;
+}
+
+/**
+ * @brief Send the samples of batchFields() now.
+ * @retval false: the request couldn't be queued, the samples are kept.
+ * @retval true: the request is queued, or there was nothing to send.
+*/
+bool AsyncTS::flushBatch()
+{
+    return _sendBatch();
+}
+
+/**
+ * @brief Set when the samples of batchFields() are sent.
+ * @param maxBytes Size of the sample store, about the sum of the lengths of the values. 0: no limit.
+ * @param maxCount Number of samples. 0: no limit.
+ * @param maxAge Age of the oldest sample in milli seconds. 0: no limit.
+*/
+void AsyncTS::setBatchLimits(size_t maxBytes, uint16_t maxCount, uint32_t maxAge)
+{
+    _batchMaxBytes = maxBytes;
+    _batchMaxCount = maxCount;
+    _batchMaxAge = maxAge;
+}
+
+/**
+ * @brief Select the wire format of the bulk updates of a channel.
+ * 
+ * The CSV format sends a row of values per sample without the keys, which is considerably
+ * smaller for dense numeric samples. Its rows are separated by '|' and the columns by ',',
+ * and the server splits them after decoding the form, so a batch with one of these
+ * characters in a value is sent as JSON.
+ * @param channelNumber Channel number
+ * @param format BATCH_JSON (default) or BATCH_CSV
+ * @retval false: ATS_CSV_CHANNELS channels are set to CSV already.
+*/
+bool AsyncTS::setBatchFormat(unsigned long channelNumber, batchFormat format)
+{
+    unsigned long *free = nullptr;
+    for (uint8_t i = 0; i < ATS_CSV_CHANNELS; i++)
+    {
+        if (_csvChannels[i] == channelNumber)
+        {
+            if (format == BATCH_JSON)
+                _csvChannels[i] = 0;
+            return true;
+        }
+        if (!free && _csvChannels[i] == 0)
+            free = &_csvChannels[i];
+    }
+    if (format == BATCH_JSON)
+        return true;
+    if (!free)
+        return false;
+    *free = channelNumber;
+    return true;
+}
+
+/**
+ * @brief Length of the body of the bulk update of the samples batched now.
+ * @param format Wire format to measure, whatever the format of the channel is.
+*/
+size_t AsyncTS::getBatchSize(batchFormat format)
+{
+    if (!_batchCount)
+        return 0;
+    return format == BATCH_CSV ? _encodeBatchCSV(false) : _encodeBatchJSON(false);
+}
+
+AsyncTS::batchFormat AsyncTS::_batchFormat(unsigned long channelNumber)
+{
+    for (uint8_t i = 0; i < ATS_CSV_CHANNELS; i++)
+    {
+        if (_csvChannels[i] == channelNumber)
+            return BATCH_CSV;
+    }
+    return BATCH_JSON;
+}
+
+/**
+ * @brief Append the staged fields to _batch as a sample.
+ * If there is no room for it, the batch is sent first.
+*/
+bool AsyncTS::_storeSample()
+{
+    size_t size = _encodeSample(nullptr, _nextWrite, 0, 0);
+    if (!size)
+    {
+        _lastTSerrorcode = TS_ERR_SETFIELD_NOT_CALLED;
+        return false;
+    }
+    if (_batchCount && _batchMaxBytes && _batch.available() + size > _batchMaxBytes && !_sendBatch())
+        return false;
+    _encodeSample(&_batch, _nextWrite, millis(), _clockEpoch());
+    if (++_batchCount == 1 && _batchMaxAge)
+        _batchTimer.once_ms(_batchMaxAge, &AsyncTS::_onBatchTimer, this);
+    return true;
+}
+
+/**
+ * @brief Encode fields as a sample: time (4 bytes), epoch (4 bytes), mask (2 bytes),
+ * then the length (1 byte) and the text of every item present.
+ * @param out Where to append it, nullptr to get the size only.
+ * @param time millis() of the sample.
+ * @param epoch Unix time of the sample, 0 if unknown.
+ * @return Size of the sample, 0 if no item is set.
+*/
+size_t AsyncTS::_encodeSample(xbuf *out, const tsWriteRecord &write, uint32_t time, uint32_t epoch)
+{
+    char locationText[3][ATS_FORMAT_FLOAT_SIZE];
+    const char *items[ATS_BATCH_ITEMS];
+    size_t lengths[ATS_BATCH_ITEMS];
+    uint16_t mask = 0;
+    size_t size = sizeof(time) + sizeof(epoch) + sizeof(mask);
+    for (uint16_t bits = write.set; bits; bits &= bits - 1)
+    {
+        // The batch items are the write items up to the status, then created_at.
+        uint8_t item = __builtin_ctz(bits);
+        if (item > WRITE_ITEM_STATUS && item != WRITE_ITEM_CREATED_AT)
+            continue; // Tweets are not batched
+        uint8_t i = item == WRITE_ITEM_CREATED_AT ? BATCH_CREATED_AT : item;
+        if (item >= WRITE_ITEM_LATITUDE && item <= WRITE_ITEM_ELEVATION)
+        {
+            items[i] = locationText[item - WRITE_ITEM_LATITUDE];
+            lengths[i] = atsFormatFloat(locationText[item - WRITE_ITEM_LATITUDE], write.location[item - WRITE_ITEM_LATITUDE], ATS_LOCATION_DECIMALS);
+        }
+        else
+        {
+            items[i] = writeValueText(write.value[valueIndex(item)]);
+            lengths[i] = write.value[valueIndex(item)].length;
+        }
+        mask |= 1 << i;
+        size += 1 + lengths[i];
     }
-    char valueString[20]; // range is -999999000000.00000 to 999999000000.00000, so 19 + 1 for the terminator
-    int status = _convertFloatToChar(value, valueString);
-    if (status != TS_OK_SUCCESS)
+    if (!mask)
+        return 0;
+    if (!out)
+        return size;
+
+    out->write((const uint8_t *)&time, sizeof(time));
+    out->write((const uint8_t *)&epoch, sizeof(epoch));
+    out->write((const uint8_t *)&mask, sizeof(mask));
+    for (uint16_t bits = mask; bits; bits &= bits - 1)
     {
-        _lastTSerrorcode = status;
-        if (_writeResponseUserCB)
-            _writeResponseUserCB(_lastTSerrorcode);
-        return false;
+        uint8_t i = __builtin_ctz(bits);
+        out->write((uint8_t)lengths[i]);
+        out->write((const uint8_t *)items[i], lengths[i]);
     }
-    return _writeField(channelNumber, field, valueString, writeAPIKey);
+    return size;
 }
 
 /**
- * @brief Write a floating point value to a single field in a ThingSpeak channel
- * @param   channelNumber   Channel number
- * @param   field           Field number (1-8) within the channel to write to.
- * @param   value           Floating point value (from -999999000000 to 999999000000) to write.  If you need more accuracy, or a wider range, you should format the number using <tt>dtostrf</tt> and writeField().
- * @param   writeAPIKey     Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @param   wrucb           User's callback function to process the server response.
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * @brief Decode the sample at offset of _batch and step offset to the next one.
+ * @return False at the end of the batch.
 */
-bool AsyncTS::writeField(unsigned long channelNumber, unsigned int field, float value, const char * writeAPIKey, writeResponseUserCB wrucb)
+bool AsyncTS::_nextSample(size_t &offset, tsBatchSample &sample)
 {
-    if (!_isReady())
-    {
-        DEBUG_ATS("ats::writeField Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+    if (offset >= _batch.available())
         return false;
+    peekAt(_batch, offset, (uint8_t *)&sample.time, sizeof(sample.time));
+    offset += sizeof(sample.time);
+    peekAt(_batch, offset, (uint8_t *)&sample.epoch, sizeof(sample.epoch));
+    offset += sizeof(sample.epoch);
+    peekAt(_batch, offset, (uint8_t *)&sample.mask, sizeof(sample.mask));
+    offset += sizeof(sample.mask);
+    for (uint8_t i = 0; i < ATS_BATCH_ITEMS; i++)
+    {
+        if (sample.mask & (1 << i))
+        {
+            peekAt(_batch, offset, &sample.len[i], 1);
+            sample.offset[i] = offset + 1;
+            offset += 1 + sample.len[i];
+        }
     }
-    if(wrucb)_writeResponseUserCB = wrucb;
-    else {DEBUG_ATS("ats::writeField wrucb is null.");}
-    return _writeField(channelNumber, field, value, writeAPIKey);
+    return true;
 }
 
 /**
- * @brief    Write a multi-field update.
- * 
- * Call  onWriteServerResponseUserCB(),setField(), setLatitude(), setLongitude(), setElevation()
- * and/or setStatus() and then call writeFields()
- * 
- * @param    channelNumber Channel number
- * @param    writeAPIKey Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending. 
+ * @brief Can the batch go as CSV? A ',' or '|' in a value would shift the columns after it.
 */
-bool AsyncTS::_writeFields(unsigned long channelNumber, const char *writeAPIKey)
+bool AsyncTS::_csvSafe()
 {
-    if (!_isReady())
+    tsBatchSample sample;
+    size_t offset = 0;
+    while (_nextSample(offset, sample))
     {
-        DEBUG_ATS("ats::writeRaw Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        for (uint16_t bits = sample.mask; bits; bits &= bits - 1)
+        {
+            uint8_t item = __builtin_ctz(bits);
+            size_t done = 0;
+            const uint8_t *span;
+            size_t supply;
+            while (done < sample.len[item] && (supply = _batch.peekSpan(&span, sample.offset[item] + done)) > 0)
+            {
+                if (supply > sample.len[item] - done)
+                    supply = sample.len[item] - done;
+                if (memchr(span, ',', supply) || memchr(span, '|', supply))
+                    return false;
+                done += supply;
+            }
+        }
     }
-    _response.flush();
+    return true;
+}
+
+/**
+ * @brief Build the bulk update of the batch into _request in the format of its channel, and queue it.
+*/
+bool AsyncTS::_sendBatch()
+{
+    if (!_batchCount)
+        return true;
+    _batchTimer.detach();
     _request.flush();
     _writesession = true;
-    // Get the content length of the payload
-    int contentLen = _getWriteFieldsContentLength();
-   
-    if (contentLen == 0)
+    bool csv = _batchFormat(_batchChannel) == BATCH_CSV;
+    if (csv && !_csvSafe())
     {
-        // setField was not called before writeFields
-        _lastTSerrorcode = TS_ERR_SETFIELD_NOT_CALLED;
-        if (_writeResponseUserCB)
+        DEBUG_ATS("ats::_sendBatch a value has ',' or '|', the batch goes as JSON.\r\n");
+        csv = false;
+    }
+    size_t contentLen = csv ? _encodeBatchCSV(false) : _encodeBatchJSON(false);
+    char number[ATS_FORMAT_INT_SIZE];
+
+    _request.write("POST /channels/");
+    _request.write((const uint8_t *)number, atsFormatULong(number, _batchChannel));
+    _request.write(csv ? "/bulk_update.csv HTTP/1.1\r\n" : "/bulk_update.json HTTP/1.1\r\n");
+    _writeHTTPHeader(NULL); // The key goes in the body.
+    _request.write(csv ? "Content-Type: application/x-www-form-urlencoded\r\n" : "Content-Type: application/json\r\n");
+    _request.write("Content-Length: ");
+    _request.write((const uint8_t *)number, atsFormatULong(number, contentLen));
+    _request.write("\r\n\r\n");
+    if (csv)
+        _encodeBatchCSV(true);
+    else
+        _encodeBatchJSON(true);
+
+    DEBUG_ATS("ats::_sendBatch %u samples, content length: %u\r\n", _batchCount, contentLen);
+    if (_spool && !_batchDrain)
+    {
+        tsBatchSample sample;
+        size_t start = 0, offset = 0;
+        while (_nextSample(offset, sample))
         {
-            _writeResponseUserCB(_lastTSerrorcode);
+            _addSpoolRecord(_batchChannel, _batchAPIKey.c_str(), start, offset - start);
+            start = offset;
         }
+    }
+    writeResponseUserCB writeCB = _writeResponseUserCB;
+    _writeResponseUserCB = _batchCB;
+    bool ok = _submit(_batchChannel);
+    _writeResponseUserCB = writeCB;
+    if (!ok)
+    {
+        _spoolRecords.flush();
+        _batchTimer.once_ms(ATS_BATCH_RESEND, &AsyncTS::_onBatchTimer, this);
         return false;
     }
-    _request.write("POST /update HTTP/1.1\r\n");
-    _writeHTTPHeader(writeAPIKey);
-    _request.write("Content-Type: application/x-www-form-urlencoded\r\n");
-    _request.write("Content-Length: ");
-    _request.write(String(contentLen));
-    _request.write("\r\n\r\n");
+    _batch.flush();
+    _batchCount = 0;
+    return true;
+}
+
+/**
+ * @brief Whole seconds from the sample at previous to the sample at time, rounded on the
+ * absolute times so the errors don't add up.
+ * A spooled sample without epoch may come from before a restart, its millis() can be
+ * smaller than the one of the sample before it. Such a sample goes with delta 0.
+*/
+static uint32_t batchDelta(uint32_t previous, uint32_t time)
+{
+    return time / 1000 < previous / 1000 ? 0 : time / 1000 - previous / 1000;
+}
 
-    bool fFirstItem = true;
-    for (size_t iField = 0; iField < FIELDNUM_MAX; iField++)
+/**
+ * @brief Encode the batch as the JSON body of the bulk update.
+ * @param write False: only count the bytes, true: write them into _request.
+ * @return Length of the body, the same in both modes.
+*/
+size_t AsyncTS::_encodeBatchJSON(bool write)
+{
+    size_t len = _emit("{\"write_api_key\":\"", write);
+    len += _emitJSONString((const uint8_t *)_batchAPIKey.c_str(), _batchAPIKey.length(), write);
+    len += _emit("\",\"updates\":[", write);
+
+    tsBatchSample sample;
+    size_t offset = 0;
+    uint32_t previous = 0;
+    bool first = true;
+    while (_nextSample(offset, sample))
     {
-        if (this->_nextWriteField[iField].length() > 0)
+        len += _emit(first ? "{" : ",{", write);
+        if (sample.mask & (1 << BATCH_CREATED_AT))
+        {
+            len += _emit("\"created_at\":\"", write);
+            len += _emitBatchValue(sample, BATCH_CREATED_AT, BATCH_JSON, write);
+            len += _emit("\"", write);
+        }
+        else if (_batchDrain && sample.epoch)
+        {
+            // Spooled sample, maybe from before a restart: its millis() means nothing now.
+            char createdAt[24];
+            formatEpoch(sample.epoch, createdAt);
+            len += _emit("\"created_at\":\"", write);
+            len += _emit(createdAt, write);
+            len += _emit("\"", write);
+        }
+        else
+        {
+            uint32_t delta = first ? 0 : batchDelta(previous, sample.time);
+            len += _emit("\"delta_t\":", write);
+            char number[ATS_FORMAT_INT_SIZE];
+            atsFormatULong(number, delta);
+            len += _emit(number, write);
+        }
+        for (uint8_t i = 0; i < BATCH_CREATED_AT; i++)
         {
-            if (!fFirstItem)
+            if (sample.mask & (1 << i))
             {
-                _request.write("&");
+                len += _emit(",\"", write);
+                len += _emit(batchKeys[i], write);
+                len += _emit("\":\"", write);
+                len += _emitBatchValue(sample, i, BATCH_JSON, write);
+                len += _emit("\"", write);
             }
-            _request.write("field");
-            _request.write(String(iField + 1));
-            _request.write("=");
-            _request.write(_nextWriteField[iField]);
-            fFirstItem = false;
         }
+        len += _emit("}", write);
+        previous = sample.time;
+        first = false;
     }
+    len += _emit("]}", write);
+    return len;
+}
 
-    if (!isnan(this->_nextWriteLatitude))
+/**
+ * @brief Encode the batch as the form encoded body of the CSV bulk update.
+ * 
+ * A row per sample: time, field1..8, latitude, longitude, elevation, status.
+ * The time is relative to the previous row, or created_at if every sample has one.
+ * @param write False: only count the bytes, true: write them into _request.
+ * @return Length of the body, the same in both modes.
+*/
+size_t AsyncTS::_encodeBatchCSV(bool write)
+{
+    tsBatchSample sample;
+    size_t offset = 0;
+    bool absolute = true;
+    while (absolute && _nextSample(offset, sample))
+        absolute = (sample.mask & (1 << BATCH_CREATED_AT)) || (_batchDrain && sample.epoch);
+
+    size_t len = _emit("write_api_key=", write);
+    len += _emitFormString((const uint8_t *)_batchAPIKey.c_str(), _batchAPIKey.length(), write);
+    len += _emit(absolute ? "&time_format=absolute&updates=" : "&time_format=relative&updates=", write);
+
+    offset = 0;
+    uint32_t previous = 0;
+    bool first = true;
+    while (_nextSample(offset, sample))
     {
-        if (!fFirstItem)
+        if (!first)
+            len += _emit("|", write);
+        if (absolute && !(sample.mask & (1 << BATCH_CREATED_AT)))
+        {
+            char createdAt[24];
+            formatEpoch(sample.epoch, createdAt);
+            len += _emitFormString((const uint8_t *)createdAt, strlen(createdAt), write);
+        }
+        else if (absolute)
+        {
+            len += _emitBatchValue(sample, BATCH_CREATED_AT, BATCH_CSV, write);
+        }
+        else
+        {
+            uint32_t delta = first ? 0 : batchDelta(previous, sample.time);
+            char number[ATS_FORMAT_INT_SIZE];
+            atsFormatULong(number, delta);
+            len += _emit(number, write);
+        }
+        for (uint8_t i = 0; i < BATCH_CREATED_AT; i++)
         {
-            _request.write("&");
+            len += _emit(",", write);
+            if (sample.mask & (1 << i))
+                len += _emitBatchValue(sample, i, BATCH_CSV, write);
         }
-        _request.write("lat=");
-        _request.write(String(_nextWriteLatitude,6));
-        fFirstItem = false;
+        previous = sample.time;
+        first = false;
     }
+    return len;
+}
+
+size_t AsyncTS::_emit(const char *text, bool write)
+{
+    size_t len = strlen(text);
+    if (write)
+        _request.write((const uint8_t *)text, len);
+    return len;
+}
 
-    if (!isnan(this->_nextWriteLongitude))
+/**
+ * @brief Emit data escaped for the inside of a JSON string.
+*/
+size_t AsyncTS::_emitJSONString(const uint8_t *data, size_t len, bool write)
+{
+    size_t out = 0;
+    size_t run = 0; // Bytes which go as they are
+    for (size_t i = 0; i < len; i++)
     {
-        if (!fFirstItem)
+        uint8_t c = data[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            run++;
+            continue;
+        }
+        if (write && run)
+            _request.write(data + i - run, run);
+        out += run;
+        run = 0;
+        char escape[7];
+        if (c == '"' || c == '\\')
+        {
+            escape[0] = '\\';
+            escape[1] = c;
+            escape[2] = 0;
+        }
+        else
         {
-             _request.write("&");
+            sprintf(escape, "\\u%04x", c);
         }
-        _request.write("long=");
-        _request.write(String(_nextWriteLongitude,6));
-        fFirstItem = false;
+        out += _emit(escape, write);
     }
+    if (write && run)
+        _request.write(data + len - run, run);
+    return out + run;
+}
 
-    if (!isnan(_nextWriteElevation))
+/**
+ * @brief Emit data percent-encoded for a form value.
+*/
+size_t AsyncTS::_emitFormString(const uint8_t *data, size_t len, bool write)
+{
+    size_t out = 0;
+    size_t run = 0; // Bytes which go as they are
+    for (size_t i = 0; i < len; i++)
     {
-        if (!fFirstItem)
+        uint8_t c = data[i];
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
         {
-            _request.write("&");
+            run++;
+            continue;
         }
-        _request.write("elevation=");
-        _request.write(String(_nextWriteElevation,6));
-        fFirstItem = false;
+        if (write && run)
+            _request.write(data + i - run, run);
+        out += run;
+        run = 0;
+        char escape[4];
+        sprintf(escape, "%%%02X", c);
+        out += _emit(escape, write);
     }
+    if (write && run)
+        _request.write(data + len - run, run);
+    return out + run;
+}
 
-    if (_nextWriteStatus.length() > 0)
+size_t AsyncTS::_emitBatchValue(const tsBatchSample &sample, uint8_t item, batchFormat format, bool write)
+{
+    size_t len = 0;
+    size_t done = 0;
+    const uint8_t *span;
+    size_t supply;
+    while (done < sample.len[item] && (supply = _batch.peekSpan(&span, sample.offset[item] + done)) > 0)
     {
-        if (!fFirstItem)
-        {
-            _request.write("&");    
-        }
-        _request.write("status=");
-        _request.write(_nextWriteStatus);
-        fFirstItem = false;
+        if (supply > sample.len[item] - done)
+            supply = sample.len[item] - done;
+        len += format == BATCH_JSON ? _emitJSONString(span, supply, write) : _emitFormString(span, supply, write);
+        done += supply;
+    }
+    return len;
+}
+
+void AsyncTS::_onBatchTimer(AsyncTS *self)
+{
+    self->_batchDue();
+}
+
+void AsyncTS::_batchDue()
+{
+    SEMAPHORE_TAKE();
+    DEBUG_ATS("ats::_batchDue\r\n");
+    _sendBatch();
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Keep the writes which can't reach the server in a persistent spool.
+ * 
+ * The writes of writeFields() and batchFields() which fail before any byte of them was sent
+ * (no network, connect failed or timed out) are appended to the spool, and their callback
+ * gets -306 instead of -301/-304. When a connection succeeds again, the spool is drained
+ * through the bulk update endpoint, see setSpoolDrain(). Samples taken after the first
+ * response of the server carry their absolute time, so they keep it over a restart.
+ * @param spool Spool, begin() it first. nullptr turns spooling off.
+ * @note writeRaw() and writeField() are not spooled.
+*/
+void AsyncTS::setSpool(AsyncTSSpool *spool)
+{
+    SEMAPHORE_TAKE();
+    _spool = spool;
+    _armDrain();
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Set how fast the spool is drained.
+ * @param maxRecords Max records sent in one bulk update.
+ * @param interval Min time between two bulk updates from the spool in milli seconds.
+*/
+void AsyncTS::setSpoolDrain(uint16_t maxRecords, uint32_t interval)
+{
+    _drainRecords = maxRecords ? maxRecords : 1;
+    _drainInterval = interval;
+}
+
+/**
+ * @brief Unix time now from the Date header of the last response, 0 if there was none.
+*/
+uint32_t AsyncTS::_clockEpoch()
+{
+    return _dateEpoch ? _dateEpoch + (millis() - _dateMillis) / 1000 : 0;
+}
+
+/**
+ * @brief Add a spool record of fields to _spoolRecords, which goes with the request.
+ * Record: length (2 bytes), channel (4 bytes), key length (1 byte), key, sample.
+*/
+void AsyncTS::_addSpoolRecord(unsigned long channelNumber, const char *writeAPIKey, const tsWriteRecord &write)
+{
+    uint8_t keyLen = writeAPIKey ? strnlen(writeAPIKey, 255) : 0;
+    uint16_t len = sizeof(uint32_t) + 1 + keyLen + _encodeSample(nullptr, write, 0, 0);
+    uint32_t channel = channelNumber;
+    _spoolRecords.write((const uint8_t *)&len, sizeof(len));
+    _spoolRecords.write((const uint8_t *)&channel, sizeof(channel));
+    _spoolRecords.write(keyLen);
+    _spoolRecords.write((const uint8_t *)writeAPIKey, keyLen);
+    _encodeSample(&_spoolRecords, write, millis(), _clockEpoch());
+}
+
+/**
+ * @brief Add a spool record of the sample at offset of _batch to _spoolRecords.
+*/
+void AsyncTS::_addSpoolRecord(unsigned long channelNumber, const char *writeAPIKey, size_t offset, size_t len)
+{
+    uint8_t keyLen = writeAPIKey ? strnlen(writeAPIKey, 255) : 0;
+    uint16_t recordLen = sizeof(uint32_t) + 1 + keyLen + len;
+    uint32_t channel = channelNumber;
+    _spoolRecords.write((const uint8_t *)&recordLen, sizeof(recordLen));
+    _spoolRecords.write((const uint8_t *)&channel, sizeof(channel));
+    _spoolRecords.write(keyLen);
+    _spoolRecords.write((const uint8_t *)writeAPIKey, keyLen);
+    const uint8_t *span;
+    size_t supply;
+    for (size_t done = 0; done < len && (supply = _batch.peekSpan(&span, offset + done)) > 0; done += supply)
+    {
+        if (supply > len - done)
+            supply = len - done;
+        _spoolRecords.write(span, supply);
     }
+}
 
-    if (_nextWriteTwitter.length() > 0)
+/**
+ * @brief Append the spool records of a request to the spool.
+ * @return True if every record is saved.
+*/
+bool AsyncTS::_saveToSpool(tsRequest &req)
+{
+    if (!_spool || !req.spool.available())
+        return false;
+    bool saved = true;
+    uint16_t len;
+    while (req.spool.read((uint8_t *)&len, sizeof(len)) == sizeof(len))
     {
-        if (!fFirstItem)
-        {
-            _request.write("&");
-        }
-        _request.write("twitter=");
-        _request.write(_nextWriteTwitter);
-        fFirstItem = false;
+        if (!_spool->append(req.spool, len))
+            saved = false;
     }
+    req.spool.flush();
+    DEBUG_ATS("ats::_saveToSpool %s\r\n", saved ? "saved" : "spool is full");
+    return saved;
+}
+
+/**
+ * @brief Arm the drain timer if there is something in the spool, keeping the drain interval.
+*/
+void AsyncTS::_armDrain()
+{
+    if (!_spool || _draining || !_spool->pending())
+        return;
+    uint32_t since = millis() - _lastDrain;
+    uint32_t wait = _lastDrain && since < _drainInterval ? _drainInterval - since : 1;
+    _drainTimer.once_ms(wait, &AsyncTS::_onDrainTimer, this);
+}
+
+void AsyncTS::_onDrainTimer(AsyncTS *self)
+{
+    self->_drainSpool();
+}
 
-    if (_nextWriteTweet.length() > 0)
+/**
+ * @brief Load the oldest spooled records of one channel into the batch and send them as a bulk update.
+*/
+void AsyncTS::_drainSpool()
+{
+    SEMAPHORE_TAKE();
+    if (!_spool || _draining || !_spool->pending())
     {
-        if (!fFirstItem)
-        {
-            _request.write("&");
-        }
-        _request.write("tweet=");
-        _request.write(this->_nextWriteTweet);
-        fFirstItem = false;
+        SEMAPHORE_GIVE();
+        return;
+    }
+    if (_batchCount)
+    {
+        // The batch of batchFields() is in use.
+        _drainTimer.once_ms(ATS_BATCH_RESEND, &AsyncTS::_onDrainTimer, this);
+        SEMAPHORE_GIVE();
+        return;
     }
 
-    if (_nextWriteCreatedAt.length() > 0)
+    size_t offset = _spool->head();
+    xbuf payload;
+    uint16_t count = 0;
+    while (count < _drainRecords)
     {
-        if (!fFirstItem)
+        size_t next = offset;
+        payload.flush();
+        if (!_spool->read(next, payload))
+            break;
+        uint32_t channel = 0;
+        uint8_t keyLen = 0;
+        payload.read((uint8_t *)&channel, sizeof(channel));
+        payload.read(&keyLen, 1);
+        String key = payload.readString(keyLen);
+        if (!count)
+        {
+            _batchChannel = channel;
+            _batchAPIKey = key;
+        }
+        else if (channel != _batchChannel || key != _batchAPIKey)
         {
-            _request.write("&");
+            break; // The next bulk update takes the other channel.
         }
-        _request.write("created_at=");
-        _request.write(_nextWriteCreatedAt);
-        fFirstItem = false;
+        _batch.write(&payload, payload.available());
+        count++;
+        offset = next;
     }
-
-     _request.write("&headers=false");
-
-    _resetWriteFields();
-   if (!_connectThingSpeak())
-        return false;
-    //_state = CONNECTING
-    return true;
+    if (!count)
+    {
+        SEMAPHORE_GIVE();
+        return;
+    }
+    DEBUG_ATS("ats::_drainSpool %u records of channel %lu\r\n", count, _batchChannel);
+
+    _batchCount = count;
+    _batchDrain = true;
+    _draining = true;
+    _lastDrain = millis();
+    writeResponseUserCB batchCB = _batchCB;
+    _batchCB = [this, offset](int responsecode)
+    { _drainDone(responsecode, offset); };
+    bool ok = _sendBatch();
+    _batchCB = batchCB;
+    _batchDrain = false;
+    if (!ok)
+    {
+        _batchTimer.detach();
+        _batch.flush();
+        _batchCount = 0;
+        _draining = false;
+        _armDrain();
+    }
+    SEMAPHORE_GIVE();
 }
 
 /**
-  *@brief Write a multi-field update.
-  *@pre Call setField(), setLatitude(), setLongitude(), setElevation() and/or setStatus() and then call writeFields().
-  *@param channelNumber Channel number
-  *@param writeAPIKey   Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
-  *@param wrucb         User's callback function to process the server response.
- * @retval false: AsyncTS client is busy. Couldn't send the request.
- * @retval true: request is under sending.
+ * @brief Completion of a bulk update from the spool. The records are kept for the
+ * next drain if the server couldn't be reached, was busy (429) or failed (5xx).
+ * @param offset Spool offset after the last record sent.
 */
-bool AsyncTS::writeFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb)
+void AsyncTS::_drainDone(int responsecode, size_t offset)
 {
-    if (!_isReady())
+    _draining = false;
+    if (responsecode == TS_OK_ACCEPTED)
+        _spool->commit(offset);
+    else if (responsecode >= 400 && responsecode < 500 && responsecode != 429)
     {
-        DEBUG_ATS("ats::writeFields Clinet is busy.");
-        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
-        return false;
+        // Bad row, revoked key or deleted channel: the records would get the same
+        // answer at every drain, and the ones behind them would wait until the spool is full.
+        DEBUG_ATS("ats::_drainDone bulk update refused with %d, the records are dropped.\r\n", responsecode);
+        _spool->commit(offset, true);
     }
-    if(wrucb)_writeResponseUserCB = wrucb;
-    else {DEBUG_ATS("ats::writeFields wrucb is null.");}
-    return _writeFields(channelNumber, writeAPIKey);
+    _armDrain();
 }
 
 void AsyncTS::_readStringFieldCB()
 {
-    if (_readResponseUserCB)
+    if (_readCB())
     {
-        std::any a = _response.readString();
-        _readResponseUserCB(_lastTSerrorcode, &a);
+        std::any a = _body.readString();
+        _readCB()(_lastTSerrorcode, &a);
     }
 }
 
@@ -1153,9 +3678,7 @@ bool AsyncTS::_readStringField(unsigned long channelNumber, unsigned int field,
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _retValueSelector = [this]()
-    { this->_readStringFieldCB(); };
-    return _readStringFieldInternal(channelNumber, field, readAPIKey);
+    return _readValue(channelNumber, field, readAPIKey, &AsyncTS::_dispatchAny<String>, nullptr, nullptr);
 }
 
 /**
@@ -1198,8 +3721,7 @@ bool AsyncTS::_readStringField(unsigned long channelNumber, unsigned int field)
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _retValueSelector = [this](){ this->_readStringFieldCB(); };
-    return _readStringFieldInternal(channelNumber, field, NULL);
+    return _readValue(channelNumber, field, NULL, &AsyncTS::_dispatchAny<String>, nullptr, nullptr);
 }
 /**
  * @brief Read the latest string from a public ThingSpeak channel.
@@ -1223,14 +3745,6 @@ bool AsyncTS::readStringField(unsigned long channelNumber, unsigned int field ,
     return _readStringField(channelNumber,field);   
 }
 
-void AsyncTS::_readFloatFieldCB()
-{
-    if (_readResponseUserCB)
-    {
-        std::any a = _convertStringToFloat(_response.readString());
-        _readResponseUserCB(_lastTSerrorcode, &a);
-    }
-}
 /**
  * @brief Read the latest floating point value from a private ThingSpeak channel
  * @post Through user' callback: std::any<float>* points a value or 0 if the field is
@@ -1249,9 +3763,7 @@ bool AsyncTS::_readFloatField(unsigned long channelNumber, unsigned int field, c
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _retValueSelector = [this]()
-    { this->_readFloatFieldCB(); };
-    return _readStringFieldInternal(channelNumber, field, readAPIKey);
+    return _readValue(channelNumber, field, readAPIKey, &AsyncTS::_dispatchAny<float>, nullptr, nullptr);
 }
 /**
  * @brief Read the latest floating point value from a private ThingSpeak channel
@@ -1311,17 +3823,9 @@ bool AsyncTS::readFloatField(unsigned long channelNumber, unsigned int field, re
     }
     if(ruscb)_readResponseUserCB = ruscb;
     else {DEBUG_ATS("ats::readFloatField ruscb is null.");}
-    return readFloatField(channelNumber , field, NULL);
+    return _readFloatField(channelNumber, field);
 }
 
-void AsyncTS::_readLongFieldCB()
-{
-    if (_readResponseUserCB)
-    {
-        std::any a = (long)_response.readString().toInt();
-        _readResponseUserCB(_lastTSerrorcode, &a);
-    }
-}
 
 /**
  * @brief Read the latest long value from a private ThingSpeak channel
@@ -1341,9 +3845,7 @@ bool AsyncTS::_readLongField(unsigned long channelNumber, unsigned int field, co
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _retValueSelector = [this]()
-    { this->_readLongFieldCB(); };
-    return _readStringFieldInternal(channelNumber, field, readAPIKey);
+    return _readValue(channelNumber, field, readAPIKey, &AsyncTS::_dispatchAny<long>, nullptr, nullptr);
 }
 
 /**
@@ -1404,17 +3906,9 @@ bool AsyncTS::readLongField(unsigned long channelNumber, unsigned int field, rea
     }
     if(ruscb)_readResponseUserCB = ruscb;
     else {DEBUG_ATS("ats::readLongField ruscb is null.");}
-    return readLongField(channelNumber,field, NULL);
+    return _readLongField(channelNumber, field);
 }
 
-void AsyncTS::_readIntFieldCB()
-{
-    if (_readResponseUserCB)
-    {
-        std::any a = (int)_response.readString().toInt();
-        _readResponseUserCB(_lastTSerrorcode, &a);
-    }
-}
 
 /**
  * @brief Read the latest int value from a private ThingSpeak channel.
@@ -1434,8 +3928,7 @@ bool AsyncTS::_readIntField(unsigned long channelNumber, unsigned int field, con
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    _retValueSelector = [this](){ this->_readIntFieldCB(); };
-    return _readStringFieldInternal(channelNumber, field, readAPIKey);
+    return _readValue(channelNumber, field, readAPIKey, &AsyncTS::_dispatchAny<int>, nullptr, nullptr);
 }
 
 /**
@@ -1496,30 +3989,23 @@ bool AsyncTS::readIntField(unsigned long channelNumber, unsigned int field, read
     }
     if(ruscb)_readResponseUserCB = ruscb;
     else {DEBUG_ATS("ats::readIntField ruscb is null.");}
-    return readIntField(channelNumber, field, NULL);
+    return _readIntField(channelNumber, field);
 }
 
 void AsyncTS::_readMultipleFieldsCB()
 {
-    if (_readResponseUserCB)
-    {
-        String multiContent = _response.readString();
-
-        this->lastFeed.nextReadField[0] = _parseValues(multiContent, "field1");
-        this->lastFeed.nextReadField[1] = _parseValues(multiContent, "field2");
-        this->lastFeed.nextReadField[2] = _parseValues(multiContent, "field3");
-        this->lastFeed.nextReadField[3] = _parseValues(multiContent, "field4");
-        this->lastFeed.nextReadField[4] = _parseValues(multiContent, "field5");
-        this->lastFeed.nextReadField[5] = _parseValues(multiContent, "field6");
-        this->lastFeed.nextReadField[6] = _parseValues(multiContent, "field7");
-        this->lastFeed.nextReadField[7] = _parseValues(multiContent, "field8");
-        this->lastFeed.nextReadCreatedAt = _parseValues(multiContent, "created_at");
-        this->lastFeed.nextReadLatitude = _parseValues(multiContent, "latitude");
-        this->lastFeed.nextReadLongitude = _parseValues(multiContent, "longitude");
-        this->lastFeed.nextReadElevation = _parseValues(multiContent, "elevation");
-        this->lastFeed.nextReadStatus = _parseValues(multiContent, "status");
+    if (_readCB())
+    {
+        this->lastFeed = feed();
+        if (_lastTSerrorcode == TS_OK_SUCCESS)
+        {
+            // One pass over the segments of the body for all the members.
+            AsyncTSJson json(feedMember, &this->lastFeed);
+            json.parse(_body);
+        }
+        _body.flush();
         std::any a = this;
-        _readResponseUserCB(_lastTSerrorcode, &a);
+        _readCB()(_lastTSerrorcode, &a);
     }
 }
 
@@ -1541,7 +4027,7 @@ bool AsyncTS::_readMultipleFields(unsigned long channelNumber, const char *readA
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    String readCondition = "/feeds/last.txt?status=true&location=true";
+    const char *readCondition = "/feeds/last.txt?status=true&location=true";
     _retValueSelector = [this]()
     { this->_readMultipleFieldsCB(); };
     return _readRaw(channelNumber, readCondition, readAPIKey);
@@ -1605,15 +4091,15 @@ bool AsyncTS::readMultipleFields(unsigned long channelNumber, readResponseUserCB
     }
     if(ruscb)_readResponseUserCB = ruscb;
     else {DEBUG_ATS("ats::readMultipleFields ruscb is null.");}
-    return  readMultipleFields(channelNumber, NULL);
+    return _readMultipleFields(channelNumber);
 }
 
 void AsyncTS::_readStatusCB()
 {
-    if (_readResponseUserCB)
+    if (_readCB())
     {
-        std::any a = _getJSONValueByKey(_response.readString(), "status");
-        _readResponseUserCB(_lastTSerrorcode, &a);
+        std::any a = jsonValue(_body, "status");
+        _readCB()(_lastTSerrorcode, &a);
     }
 }
 
@@ -1633,7 +4119,7 @@ bool AsyncTS::_readStatus(unsigned long channelNumber, const char *readAPIKey)
         _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
         return false;
     }
-    String content = "/feeds/last.txt?status=true&location=true";
+    const char *content = "/feeds/last.txt?status=true&location=true";
     _retValueSelector = [this]()
     { this->_readStatusCB(); };
     return _readRaw(channelNumber, content, readAPIKey);
@@ -1690,7 +4176,7 @@ bool AsyncTS::readStatus(unsigned long channelNumber, readResponseUserCB ruscb)
     }
     if(ruscb)_readResponseUserCB = ruscb;
     else {DEBUG_ATS("ats::readStatus ruscb is null.");}
-    return readStatus(channelNumber,NULL);
+    return _readStatus(channelNumber);
 }
 
 /**
@@ -1702,9 +4188,7 @@ bool AsyncTS::readStatus(unsigned long channelNumber, readResponseUserCB ruscb)
 */
 int AsyncTS::setField(unsigned int field, int value)
 {
-    char valueString[10]; // int range is -32768 to 32768, so 7 bytes including terminator
-    itoa(value, valueString, 10);
-    return setField(field, valueString);
+    return setField(field, (long)value);
 }
 
 /**
@@ -1716,27 +4200,28 @@ int AsyncTS::setField(unsigned int field, int value)
 */
 int AsyncTS::setField(unsigned int field, long value)
 {
-    char valueString[15]; // long range is -2147483648 to 2147483647, so 12 bytes including terminator
-    ltoa(value, valueString, 10);
-
-    return setField(field, valueString);
+    char valueString[ATS_FORMAT_INT_SIZE];
+    size_t len = atsFormatLong(valueString, value);
+    return _setField(field, valueString, len);
 }
 
 /**
  * @brief Set the value of a single field that will be part of a multi-field update.
  * @param field  Field number (1-8) within the channel to set.
- * @param value  Floating point value (from -999999000000 to 999999000000) to write.  If you need more accuracy, or a wider range, you should format the number yourself (using <tt>dtostrf</tt>) and setField() using the resulting string.
+ * @param value  Floating point value (from -999999000000 to 999999000000) to write, with the decimals of setFieldPrecision() (default 5).  For a wider range, format the number yourself and setField() using the resulting string.
  * @retval 200 if successful
  * @retval -101 if value is out of range or string is too long (> 255 bytes)
 */
 int AsyncTS::setField(unsigned int field, float value)
 {
-    char valueString[20]; // range is -999999000000.00000 to 999999000000.00000, so 19 + 1 for the terminator
-    int status = _convertFloatToChar(value, valueString);
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+        return TS_ERR_INVALID_FIELD_NUM;
+    char valueString[ATS_FORMAT_FLOAT_SIZE];
+    int status = _convertFloatToChar(value, _fieldPrecision[field - 1], valueString);
     if (status != TS_OK_SUCCESS)
         return status;
 
-    return setField(field, valueString);
+    return _setField(field, valueString, strlen(valueString));
 }
 
 /**
@@ -1747,18 +4232,56 @@ int AsyncTS::setField(unsigned int field, float value)
  * @retval -101 if value is out of range or string is too long (> 255 bytes)
 */
 int AsyncTS::setField(unsigned int field, String value)
+{
+    return _setField(field, value.c_str(), value.length());
+}
+
+/**
+ * @brief Stage a formatted field value. Values up to ATS_VALUE_INLINE bytes are copied into
+ * the write record without an allocation.
+*/
+int AsyncTS::_setField(unsigned int field, const char *value, size_t len)
 {
     DEBUG_ATS("ts::setField   (field: %u value: \"%s\")\r\n", field, value);
     if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
         return TS_ERR_INVALID_FIELD_NUM;
     // Max # bytes for ThingSpeak field is 255 (UTF-8)
-    if (value.length() > FIELDLENGTH_MAX)
+    if (len > FIELDLENGTH_MAX)
         return TS_ERR_OUT_OF_RANGE;
-    _nextWriteField[field - 1] = value;
+    setWriteValue(_nextWrite, field - 1, value, len);
+
+    return TS_OK_SUCCESS;
+}
 
+/**
+ * @brief Set the number of decimals of the float values of a field, for setField(), writeField() and the
+ * samples of batchFields(). The value is rounded half to even like printf("%.*f").
+ * @param field     Field number (1-8).
+ * @param decimals  Digits right of the decimal point, 0 to 7. Default is 5.
+ * @retval 200 if successful
+ * @retval -101 if decimals is more than 7
+ * @retval -201 if the field number is invalid
+*/
+int AsyncTS::setFieldPrecision(unsigned int field, uint8_t decimals)
+{
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+        return TS_ERR_INVALID_FIELD_NUM;
+    if (decimals > ATS_FLOAT_DECIMALS_MAX)
+        return TS_ERR_OUT_OF_RANGE;
+    _fieldPrecision[field - 1] = decimals;
     return TS_OK_SUCCESS;
 }
 
+/**
+ * @brief Get the number of decimals of the float values of a field, 0 if the field number is invalid.
+*/
+uint8_t AsyncTS::getFieldPrecision(unsigned int field)
+{
+    if (field < FIELDNUM_MIN || field > FIELDNUM_MAX)
+        return 0;
+    return _fieldPrecision[field - 1];
+}
+
 /**
  * @brief Set the latitude of a multi-field update.
  * @note To record latitude, longitude and elevation of a write, call setField() for each of the fields you want to write.
@@ -1769,7 +4292,7 @@ int AsyncTS::setField(unsigned int field, String value)
 int AsyncTS::setLatitude(float latitude)
 {
     DEBUG_ATS("ts::setLatitude(latitude: %f)\r\n", latitude);
-    _nextWriteLatitude = latitude;
+    setWriteLocation(_nextWrite, WRITE_ITEM_LATITUDE, latitude);
     return TS_OK_SUCCESS;
 }
 
@@ -1784,7 +4307,7 @@ int AsyncTS::setLongitude(float longitude)
 {
     DEBUG_ATS("ts::setLongitude(longitude: %f)\r\n", longitude);
 
-    _nextWriteLongitude = longitude;
+    setWriteLocation(_nextWrite, WRITE_ITEM_LONGITUDE, longitude);
 
     return TS_OK_SUCCESS;
 }
@@ -1799,7 +4322,7 @@ int AsyncTS::setLongitude(float longitude)
 int AsyncTS::setElevation(float elevation)
 {
     DEBUG_ATS("ts::setElevation(elevation: %f)\r\n", elevation);
-    _nextWriteElevation = elevation;
+    setWriteLocation(_nextWrite, WRITE_ITEM_ELEVATION, elevation);
 
     return TS_OK_SUCCESS;
 }
@@ -1823,7 +4346,7 @@ int AsyncTS::setStatus(String status)
     // Max # bytes for ThingSpeak field is 255 (UTF-8)
     if (status.length() > FIELDLENGTH_MAX)
         return TS_ERR_OUT_OF_RANGE;
-    _nextWriteStatus = status;
+    setWriteValue(_nextWrite, WRITE_ITEM_STATUS, status.c_str(), status.length());
 
     return TS_OK_SUCCESS;
 }
@@ -1844,8 +4367,8 @@ int AsyncTS::setTwitterTweet(String twitter, String tweet)
     if ((twitter.length() > FIELDLENGTH_MAX) || (tweet.length() > FIELDLENGTH_MAX))
         return TS_ERR_OUT_OF_RANGE;
 
-    _nextWriteTwitter = twitter;
-    _nextWriteTweet = tweet;
+    setWriteValue(_nextWrite, WRITE_ITEM_TWITTER, twitter.c_str(), twitter.length());
+    setWriteValue(_nextWrite, WRITE_ITEM_TWEET, tweet.c_str(), tweet.length());
 
     return TS_OK_SUCCESS;
 }
@@ -1866,7 +4389,7 @@ int AsyncTS::setCreatedAt(String createdAt)
     // Max # bytes for ThingSpeak field is 255 (UTF-8)
     if (createdAt.length() > FIELDLENGTH_MAX)
         return TS_ERR_OUT_OF_RANGE;
-    _nextWriteCreatedAt = createdAt;
+    setWriteValue(_nextWrite, WRITE_ITEM_CREATED_AT, createdAt.c_str(), createdAt.length());
 
     return TS_OK_SUCCESS;
 }
@@ -1897,7 +4420,7 @@ String AsyncTS::getFieldAsString(unsigned int field)
 */
 float AsyncTS::getFieldAsFloat(unsigned int field)
 {
-    return _convertStringToFloat(getFieldAsString(field));
+    return _convertStringToFloat(getFieldAsString(field).c_str());
 }
 
 /**
@@ -1970,4 +4493,13 @@ String AsyncTS::getElevation()
 String AsyncTS::getCreatedAt()
 {
     return this->lastFeed.nextReadCreatedAt;
+}
+
+/**
+ * @brief Fetch the entry ID of the latest stored feed record.
+ * @return Entry ID, 0 if there was no entry or in case of an error.
+*/
+unsigned long AsyncTS::getEntryId()
+{
+    return this->lastFeed.nextReadEntryId;
 }
\ No newline at end of file
@@ -40,7 +40,9 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #include <any>
 #include <pgmspace.h>
 #include "Arduino.h"
+#include <Ticker.h>
 #include "xbuf.h"
+#include "AsyncTSFormat.h"
 
 //#define DONT_COMPILE_DEBUG_LINES_AsyncTS
 
@@ -49,7 +51,12 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #define DEBUG_IOTA_PORT Serial
 #endif
 
-#ifdef ARDUINO_ARCH_ESP8266
+#ifdef ATS_HOST
+// Host (Linux) build, see extras/host. One thread runs every callback.
+#include <AsyncTCP.h>
+#define SEMAPHORE_TAKE()
+#define SEMAPHORE_GIVE()
+#elif defined(ARDUINO_ARCH_ESP8266)
 #include <ESPAsyncTCP.h>
 #ifndef SEMAPHORE_TAKE
 #define SEMAPHORE_TAKE(X)
@@ -59,13 +66,13 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #endif
 #endif
 
-#ifdef ARDUINO_ARCH_ESP32
+#if defined(ARDUINO_ARCH_ESP32) && !defined(ATS_HOST)
 #include <AsyncTCP.h>
 #ifndef SEMAPHORE_TAKE
-#define SEMAPHORE_TAKE() xSemaphoreTake(_xSemaphore, portMAX_DELAY)
+#define SEMAPHORE_TAKE() xSemaphoreTakeRecursive(_xSemaphore, portMAX_DELAY)
 #endif
 #ifndef SEMAPHORE_GIVE
-#define SEMAPHORE_GIVE() xSemaphoreGive(_xSemaphore)
+#define SEMAPHORE_GIVE() xSemaphoreGiveRecursive(_xSemaphore)
 #endif
 #endif
 
@@ -85,14 +92,77 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #define THINGSPEAK_URL "api.thingspeak.com"
 #define THINGSPEAK_PORT_NUMBER 80
 #define THINGSPEAK_HTTPS_PORT_NUMBER 443
+#define ATS_FINGERPRINT_SIZE 20 // SHA-1 fingerprint of the server certificate, see setSecure()
 
 #define DEFAULT_RX_TIMEOUT 30000
+#define DEFAULT_DNS_TIMEOUT 5000
+#define DEFAULT_CONNECT_TIMEOUT 10000
+#define ATS_WATCHDOG_PERIOD 250 // Period of the deadline check while there is no connection to poll, in milli seconds
+#define DEFAULT_KEEPALIVE_TIMEOUT 20000 // Idle time after a kept-alive connection is closed. Keep it below DEFAULT_RX_TIMEOUT.
+
+#define ATS_HEADER_LINE_MAX 64 // Only the beginning of the response header lines is kept, it is enough for the headers used.
+#define ATS_DATE_MAX 32
+
+#define DEFAULT_READ_RETRY_BACKOFF 1000   // First retry delay of reads in milli seconds
+#define DEFAULT_WRITE_RETRY_BACKOFF 15000 // First retry delay of writes, the rate limit of ThingSpeak
+#define DEFAULT_RETRY_MAX_BACKOFF 60000
+#define DEFAULT_RETRY_JITTER 25           // Percent
+#define DEFAULT_RETRY_BUDGET 10           // Retries per budget window
+#define DEFAULT_RETRY_BUDGET_WINDOW 60000
+
+#ifndef ATS_SCHEDULED_CHANNELS
+#define ATS_SCHEDULED_CHANNELS 2 // Channels tracked by the write scheduler, see setUpdateInterval()
+#endif
+#ifndef ATS_HELD_CALLBACKS
+#define ATS_HELD_CALLBACKS 4 // Callbacks of the writeFields() calls merged into a held write of a channel
+#endif
+#ifndef ATS_REGISTERED_CHANNELS
+#define ATS_REGISTERED_CHANNELS 4 // Channels with pre-rendered request heads, see registerChannel()
+#endif
+#define TS_FREE_UPDATE_INTERVAL 15000 // Min time between updates of a channel with a free ThingSpeak account, in milli seconds
+
+#define DEFAULT_BATCH_MAX_BYTES 2048  // Size of the sample store of batchFields() which triggers a bulk update
+#define DEFAULT_BATCH_MAX_COUNT 100
+#define DEFAULT_BATCH_MAX_AGE 60000   // Age of the oldest sample which triggers a bulk update, in milli seconds
+#define ATS_BATCH_RESEND 1000         // Delay before the next try if the bulk update couldn't be queued
+#define ATS_BATCH_ITEMS 13            // field1..8, latitude, longitude, elevation, status, created_at
+#ifndef ATS_CSV_CHANNELS
+#define ATS_CSV_CHANNELS 4            // Channels which can be set to the CSV bulk format
+#endif
+
+#define DEFAULT_DRAIN_RECORDS 100                     // Spooled records sent in one bulk update
+#define DEFAULT_DRAIN_INTERVAL TS_FREE_UPDATE_INTERVAL  // Min time between two bulk updates from the spool
+
+#ifndef ATS_QUEUE_SIZE
+#define ATS_QUEUE_SIZE 4 // Max number of requests waiting or in flight. Every slot is allocated with the AsyncTS object.
+#endif
+
+// Log-linear latency histograms of setLatencyStats(). Latencies are in micro seconds; every
+// power of two range is split into 2^ATS_HIST_SUB_BITS buckets, so a bucket is at most 25% wide.
+// The buckets count in 16 bits; when one is full, all of them are halved, so the percentiles
+// follow the recent requests. The histograms of setLatencyStats() take 3040 bytes.
+#ifndef ATS_HIST_SUB_BITS
+#define ATS_HIST_SUB_BITS 2
+#endif
+#define ATS_HIST_MIN_BITS 7  // Latencies under 2^7 us (128 us) fall in the first bucket
+#define ATS_HIST_MAX_BITS 25 // Latencies from 2^25 us (33.5 s) fall in the last bucket
+#define ATS_HIST_BUCKETS (((ATS_HIST_MAX_BITS - ATS_HIST_MIN_BITS) << ATS_HIST_SUB_BITS) + 2)
+#define ATS_LATENCY_APIS 3   // write, read, raw
+#define ATS_LATENCY_MARKS 6  // enqueued, start, connected, first byte, headers, complete
+#define ATS_LATENCY_SPANS 6  // Between the marks, and the total
+
+// Allocation statistics, see getAllocStats(). Build with -DATS_ALLOC_STATS=1 to turn them on.
+#ifndef ATS_ALLOC_STATS
+#define ATS_ALLOC_STATS 0
+#endif
 
 
 #ifdef ARDUINO_ARCH_ESP8266
 #define TS_USER_AGENT "atslib-arduino/" ATS_VER " (ESP8266)"
 #elif defined(ARDUINO_ARCH_ESP32)
 #define TS_USER_AGENT "atslib-arduino/" ATS_VER " (ESP32)"
+#elif defined(ATS_HOST)
+#define TS_USER_AGENT "atslib-arduino/" ATS_VER " (host)"
 #else
 #define TS_USER_AGENT "atslib-arduino/" ATS_VER " (unknown)"
 #endif
@@ -100,8 +170,25 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #define FIELDNUM_MIN 1
 #define FIELDNUM_MAX 8
 #define FIELDLENGTH_MAX 255 // Max length for a field in ThingSpeak is 255 bytes (UTF-8)
+#define DEFAULT_FIELD_DECIMALS 5 // Decimals of a float field, see setFieldPrecision()
+#define ATS_LOCATION_DECIMALS 6  // Decimals of the latitude, longitude and elevation
+
+// Items of a multi-field update, in the order of the form. Bit i of tsWriteRecord::set.
+#define WRITE_ITEM_LATITUDE   FIELDNUM_MAX
+#define WRITE_ITEM_LONGITUDE  (FIELDNUM_MAX + 1)
+#define WRITE_ITEM_ELEVATION  (FIELDNUM_MAX + 2)
+#define WRITE_ITEM_STATUS     (FIELDNUM_MAX + 3)
+#define WRITE_ITEM_TWITTER    (FIELDNUM_MAX + 4)
+#define WRITE_ITEM_TWEET      (FIELDNUM_MAX + 5)
+#define WRITE_ITEM_CREATED_AT (FIELDNUM_MAX + 6)
+#define WRITE_ITEMS           (FIELDNUM_MAX + 7)
+#define WRITE_TEXT_ITEMS      (WRITE_ITEMS - 3)
+#ifndef ATS_VALUE_INLINE
+#define ATS_VALUE_INLINE 20 // Staged values up to this size are kept in the write record, e.g. -999999000000.00000
+#endif
 
 #define TS_OK_SUCCESS 200               // OK / Success
+#define TS_OK_ACCEPTED 202              // Bulk update accepted
 #define TS_ERR_BADAPIKEY 400            // Incorrect API key (or invalid ThingSpeak server address)
 #define TS_ERR_BADURL 404               // Incorrect API key (or invalid ThingSpeak server address)
 #define TS_ERR_OUT_OF_RANGE -101        // Value is out of range or string is too long (> 255 bytes)
@@ -111,6 +198,9 @@ https://github.com/me-no-dev/ESPAsyncTCP
 #define TS_ERR_UNEXPECTED_FAIL -302     // Unexpected failure during write to ThingSpeak
 #define TS_ERR_BAD_RESPONSE -303        // Unable to parse response
 #define TS_ERR_TIMEOUT -304             // Timeout waiting for server to respond
+#define TS_ERR_QUEUE_DROPPED -305       // Request was dropped from the queue by the overflow policy
+#define TS_SPOOLED -306                 // Server couldn't be reached, the write is kept in the spool and sent later
+#define TS_ERR_TLS_FINGERPRINT -307     // Certificate of the server doesn't match the fingerprint given to setSecure()
 #define TS_ERR_NOT_INSERTED -401        // Point was not inserted (most probable cause is the rate limit of once every 15 seconds)
 
 // variables to store the values from the readMultipleFields functionality
@@ -123,6 +213,7 @@ typedef struct feedRecord
     String nextReadLongitude;
     String nextReadElevation;
     String nextReadCreatedAt;
+    unsigned long nextReadEntryId = 0;
 } feed;
 #endif
 
@@ -131,6 +222,7 @@ typedef struct feedRecord
  * User's callback function for any 'write' function. writeField(),writeFields(),writeRaw().
  * @param responsecode Server response can be one of these values:
  * @arg  200      OK / Success
+ * @arg  202      Bulk update accepted (flushBatch())
  * @arg  400      Incorrect API key (or invalid ThingSpeak server address)
  * @arg  404      Incorrect API key (or invalid ThingSpeak server address)
  * @arg -101      Value is out of range or string is too long (> 255 bytes)
@@ -140,6 +232,9 @@ typedef struct feedRecord
  * @arg -302      Unexpected failure during write to ThingSpeak
  * @arg -303      Unable to parse response
  * @arg -304      Timeout waiting for server to respond
+ * @arg -305      Request was dropped from the queue by the overflow policy
+ * @arg -306      Server couldn't be reached, the write is kept in the spool and sent later (setSpool())
+ * @arg -307      Certificate of the server doesn't match the fingerprint given to setSecure()
  * @arg -401      Point was not inserted (most probable cause is the rate limit of once every 15 seconds)
 */
 typedef std::function<void (int responsecode)> writeResponseUserCB;
@@ -165,16 +260,294 @@ typedef std::function<void (int responsecode)> writeResponseUserCB;
  * @arg -302  Unexpected failure during write to ThingSpeak
  * @arg -303  Unable to parse response
  * @arg -304  Timeout waiting for server to respond
+ * @arg -305  Request was dropped from the queue by the overflow policy
+ * @arg -307  Certificate of the server doesn't match the fingerprint given to setSecure()
  * @arg -401  Point was not inserted (most probable cause is the rate limit of once every 15 seconds)
  * @param answare A std::any* of type corresponding to the 'read' function.
 */
 typedef std::function<void (int responsecode, std::any* answare)> readResponseUserCB;
+/**
+ * @typedef void (*readValueUserCB<T>)(int responsecode, T value, void* arg);
+ * User's callback function of the typed reads, readField<T>(). A plain function or a lambda without
+ * captures; the state of the caller goes through arg.
+ * @param responsecode Server response, same values as at readResponseUserCB.
+ * @param value Value read as float, long, int or String; 0 or empty if the field is text or there is an error.
+ * @param arg As given to readField().
+*/
+template <typename T>
+using readValueUserCB = void (*)(int responsecode, T value, void* arg);
+class AsyncTS;
+/**
+ * @typedef void (*readDispatchCB)(AsyncTS* ats, int responsecode, xbuf* body, void (*fn)(), void* arg);
+ * Completion of a read request: decodes the body to the type of the read and calls fn with it.
+ * body is nullptr if the read failed before it was sent; the value is 0 or empty then.
+*/
+typedef void (*readDispatchCB)(AsyncTS* ats, int responsecode, xbuf* body, void (*fn)(), void* arg);
+/**
+ * @typedef std::function<void (const uint8_t* data, size_t len)> bodySinkUserCB;
+ * User's callback function which receives the body of a streamed read (readRawStream()) slice by slice,
+ * as the data arrives from the server. The data is valid only during the call.
+ * @param data Next slice of the response body.
+ * @param len  Length of the slice.
+*/
+typedef std::function<void (const uint8_t* data, size_t len)> bodySinkUserCB;
+/**
+ * @typedef std::function<void (int responsecode)> streamResponseUserCB;
+ * User's callback function called once after the last slice of a streamed read (readRawStream()).
+ * @param responsecode Server response, same values as at writeResponseUserCB.
+*/
+typedef std::function<void (int responsecode)> streamResponseUserCB;
 typedef std::function<void ()> returnValueCB;
 
+// A staged text value of a multi-field update. Values up to ATS_VALUE_INLINE bytes are stored
+// in text, so staging a number or a date doesn't touch the heap; longer ones go to spill.
+typedef struct writeValueRecord
+{
+    uint8_t length;
+    char    text[ATS_VALUE_INLINE + 1];
+    String  spill;
+} tsWriteValue;
+
+// Fields of a multi-field update. Bit i of set tells that item i (WRITE_ITEM_...) is set,
+// the values of the other items are stale.
+typedef struct writeRecord
+{
+    uint16_t     set;
+    tsWriteValue value[WRITE_TEXT_ITEMS];   // field1..8, status, twitter, tweet, created_at
+    float        location[3];               // latitude, longitude, elevation
+} tsWriteRecord;
+
+// A sample of the bulk update batch, decoded from the compact store.
+typedef struct batchSampleRecord
+{
+    uint32_t time;                          // millis() when it was batched
+    uint32_t epoch;                         // Unix time when it was batched, 0 if the server time was unknown
+    uint16_t mask;                          // Bit i: item i is present
+    size_t   offset[ATS_BATCH_ITEMS];       // Offset of the value of the item in the store
+    uint8_t  len[ATS_BATCH_ITEMS];
+} tsBatchSample;
+
+// A queued request with its own prebuilt HTTP request and completion.
+typedef struct requestRecord
+{
+    xbuf                request;            // Prebuilt HTTP request
+    bool                writesession;
+    unsigned long       channelNumber;
+    uint32_t            enqueued;           // millis() when it was queued
+    writeResponseUserCB writeCB;
+    readResponseUserCB  readCB;
+    returnValueCB       selector;           // Completion of read requests
+    readDispatchCB      dispatch;           // Typed completion of read requests, instead of selector
+    void                (*readFn)();        // readValueUserCB called by dispatch
+    void*               readArg;
+    bodySinkUserCB      bodySink;           // Body slices of streamed read requests
+    streamResponseUserCB streamCB;          // Completion of streamed read requests
+    bool                scheduled;          // Write sent by the update scheduler
+    size_t              sent;               // Bytes of the request handed to the client
+    bool                streamed;           // Some of the body went to bodySink already
+    uint8_t             attempts;           // Attempts started so far
+    uint32_t            notBefore;          // millis() before which a retry is not started
+    xbuf                spool;              // Spool records of a write, saved if it can't reach the server
+    uint8_t             api;                // latencyApi of the request
+    uint8_t             marks;              // Bit i: stamp[i] is set in the current attempt
+    uint32_t            stamp[ATS_LATENCY_MARKS]; // micros() at the steps of the request, see _mark()
+} tsRequest;
+
+// Write scheduler state of a channel.
+typedef struct channelScheduleRecord
+{
+    unsigned long       channelNumber;      // 0: unused entry
+    bool                busy;               // A scheduled write to the channel is queued or in flight
+    bool                held;               // write waits for the next slot
+    bool                accepted;           // lastAccepted is valid
+    uint32_t            lastAccepted;       // millis() when the server answered the last write
+    tsWriteRecord       write;              // Held fields, the last value of each field wins
+    String              writeAPIKey;
+    writeResponseUserCB writeCB[ATS_HELD_CALLBACKS]; // Callbacks of the writeFields() calls merged into write
+    uint8_t             callbacks;          // Used entries of writeCB
+    uint8_t             sentCallbacks;      // writeCB[0..sentCallbacks) wait for the write in flight
+} tsChannelSchedule;
+
+// Request heads of a channel rendered by registerChannel(), copied as a whole into the requests.
+typedef struct channelTemplateRecord
+{
+    unsigned long       channelNumber;      // 0: unused entry
+    String              readAPIKey;
+    String              writeAPIKey;
+    String              writeHead;          // Form POST to /update up to "Content-Length: "
+    String              readHead;           // "GET /channels/<channelNumber>", the suffix follows
+    String              readTail;           // " HTTP/1.1" and the headers after the suffix
+} tsChannelTemplate;
+
+// Deadlines of the phases of a request in milliseconds.
+typedef struct timeoutsRecord
+{
+    uint32_t dns;           // Name resolution
+    uint32_t connect;       // TCP connect, after the name resolution
+    uint32_t firstByte;     // From connected (or reused connection) to the first byte of the response
+    uint32_t body;          // From the first byte to the end of the response
+} tsTimeouts;
+
+// Statistics of the request queue. Times are in milliseconds.
+typedef struct queueStatsRecord
+{
+    uint16_t depth;         // Requests waiting or in flight now
+    uint16_t maxDepth;      // Highest depth seen
+    uint32_t enqueued;      // Accepted requests
+    uint32_t rejected;      // Requests refused because the queue was full
+    uint32_t dropped;       // Requests dropped or replaced by the overflow policy
+    uint32_t started;       // Requests which left the queue towards the server
+    uint32_t totalWait;     // Sum of the time spent in the queue by the started requests
+    uint32_t maxWait;       // Longest time spent in the queue
+} queueStats;
+
+// Retry policy of a class of requests. Times are in milliseconds.
+typedef struct retryPolicyRecord
+{
+    uint8_t  maxAttempts;   // Attempts including the first one, 1 turns retrying off
+    uint32_t baseBackoff;   // Delay before the first retry, doubled at every further one
+    uint32_t maxBackoff;    // Upper limit of the delay
+    uint8_t  jitter;        // Part of the delay randomized, in percent (0..100)
+    uint16_t budget;        // Max retries in a budget window, 0 means no limit
+    uint32_t budgetWindow;  // Length of the budget window
+} tsRetryPolicy;
+
+// TLS handshake statistics of the HTTPS mode. Times are in milliseconds.
+typedef struct tlsStatsRecord
+{
+    uint32_t fullHandshakes;    // New TLS sessions negotiated
+    uint32_t keptAliveRequests; // Requests sent on a kept-alive TLS connection, without handshake
+    uint32_t rejectedServers;   // Handshakes aborted because the certificate didn't match the fingerprint
+    uint32_t handshakeTime;     // Sum of the time from connect() to the end of the handshakes
+    uint32_t maxHandshakeTime;
+} tlsStats;
+
+// Statistics of the retries of a class of requests.
+typedef struct retryStatsRecord
+{
+    uint32_t retries;       // Failed attempts scheduled again
+    uint32_t giveUps;       // Retryable failures passed to the user because the attempts or the budget ran out
+} retryStats;
+
+// Latency histogram of a step of the requests of an API. Times are in micro seconds.
+typedef struct latencyHistogramRecord
+{
+    uint32_t count;
+    uint64_t sum;
+    uint32_t max;
+    uint16_t bucket[ATS_HIST_BUCKETS];  // See AsyncTS::latencyBucketLimit(), halved when one is full
+} tsLatencyHistogram;
+
+// Histograms of setLatencyStats(), indexed by latencyApi and latencySpan.
+typedef struct latencyStatsRecord
+{
+    tsLatencyHistogram histogram[ATS_LATENCY_APIS][ATS_LATENCY_SPANS];
+    uint32_t failures[ATS_LATENCY_APIS];    // Requests completed without a response
+} tsLatencyStats;
+
+// Summary of a latency histogram. Times are in micro seconds, the percentiles are
+// the upper limits of their buckets.
+typedef struct latencySummaryRecord
+{
+    uint32_t count;         // Requests with a complete response
+    uint32_t failures;      // Requests completed without a response (timeout, lost connection)
+    uint32_t mean;
+    uint32_t max;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t p999;
+} latencySummary;
+
+#if ATS_ALLOC_STATS
+// Heap allocations made so far. The platform counts them: the host build counts operator new,
+// elsewhere they stay 0 unless the sketch defines atsHeapCounter() with its own counting.
+typedef struct heapCountRecord
+{
+    uint32_t allocs;
+    uint32_t bytes;
+} atsHeapCount;
+
+atsHeapCount atsHeapCounter();
+
+// Allocations of a request type.
+typedef struct allocStatsRecord
+{
+    uint32_t requests;      // Completed requests
+    uint32_t allocs;        // Heap allocations while building, sending and completing them
+    uint32_t bytes;         // Bytes of those allocations
+    uint32_t peakSegments;  // Most xbuf segments alive at once (of every xbuf)
+    uint32_t minFreeHeap;   // Lowest free heap seen, 0 where the platform doesn't tell
+} allocStats;
+#endif
+
+class AsyncTSSpool;
+class AsyncTSPool;
 
 class AsyncTS
 {
+    friend class AsyncTSPool;  // Moves the staged fields between its connections
+#ifdef ATS_HOST
+    friend class AsyncTSProbe; // The host tools drive the response parser directly
+#endif
+
+    public:
+    /**
+     * @brief What happens with a new request if the queue is full.
+     */
+    enum queuePolicy{
+                QUEUE_REJECT,               ///< The new request is refused. (default)
+                QUEUE_DROP_OLDEST,          ///< The oldest waiting request is dropped.
+                QUEUE_REPLACE_SAME_CHANNEL  ///< A waiting request of the same kind to the same channel is replaced.
+    };
+
+    /**
+     * @brief Wire format of the bulk update of batchFields().
+     */
+    enum batchFormat{
+                BATCH_JSON,                 ///< bulk_update.json (default)
+                BATCH_CSV                   ///< bulk_update.csv, smaller for dense numeric samples
+    };
+
+    /**
+     * @brief Class of requests sharing a retry policy.
+     */
+    enum requestClass{
+                READ_REQUESTS,              ///< Every read function.
+                WRITE_REQUESTS              ///< Every write function.
+    };
+
+    /**
+     * @brief Request types of the latency and allocation statistics.
+     */
+    enum latencyApi{
+                LATENCY_WRITE,              ///< writeField(s), batchFields() and the spool
+                LATENCY_READ,               ///< Every read function except readRaw()
+                LATENCY_RAW                 ///< writeRaw(), readRaw() and readRawStream()
+    };
+
+    /**
+     * @brief Steps of a request measured by the latency statistics.
+     */
+    enum latencySpan{
+                SPAN_QUEUE,                 ///< Queued to started
+                SPAN_CONNECT,               ///< Started to connected, about 0 on a kept-alive connection
+                SPAN_FIRST_BYTE,            ///< Connected to the first byte of the response
+                SPAN_HEADERS,               ///< First byte to the end of the headers
+                SPAN_BODY,                  ///< End of the headers to the end of the response
+                SPAN_TOTAL                  ///< Queued to the end of the response
+    };
+
     private:
+    enum latencymark{
+                MARK_ENQUEUED,
+                MARK_START,
+                MARK_CONNECTED,     // Or the end of the previous response of a pipelined request
+                MARK_FIRST_BYTE,
+                MARK_HEADERS,
+                MARK_COMPLETE
+    };
+
      enum clientstate{
                 DISCONNECTED,
                 CONNECTING,
@@ -182,49 +555,194 @@ class AsyncTS
                 HEADERSRCVD,
                 RESONGOING,
                 RESCOMPLETE,
-                DISCONNECTING    
-     } _state;
+                DISCONNECTING,
+                IDLE            // Connection is kept alive, no request in flight.
+     } _state = DISCONNECTED;
 
-    AsyncClient*    _client;
+    enum requestphase{
+                PHASE_NONE,
+                PHASE_CONNECT,      // Name resolution and TCP connect
+                PHASE_FIRST_BYTE,
+                PHASE_BODY
+     } _phase = PHASE_NONE;
+
+    AsyncClient*    _client = nullptr;
     int             _lastTSerrorcode=TS_OK_SUCCESS; 
     bool            _debug = false;
     bool            _writesession;
+    bool            _keepAlive = false;            // Keep the connection open between requests
+    bool            _serverClose;                  // Server answered with "Connection: close"
+    bool            _chunked;                      // Server answered with "Transfer-Encoding: chunked"
+    bool            _bodyDone;                     // Whole body of the response is in
+    size_t          _bodyLeft;                     // Body bytes still expected (Content-Length framing)
+    size_t          _chunkLeft;                    // Bytes left of the current chunk (chunked framing)
+    enum chunkstate{
+                CHUNK_SIZE,
+                CHUNK_EXTENSION,
+                CHUNK_DATA,
+                CHUNK_DATA_END,
+                CHUNK_TRAILER
+     } _chunkState;
     unsigned int    _port = THINGSPEAK_PORT_NUMBER;     
     size_t          _contentLength;                // content-length
     uint32_t        _timeout=DEFAULT_RX_TIMEOUT;   // Default or user overide RxTimeout in milli seconds
     uint32_t        _lastActivity;                 // Time of last activity
+    uint32_t        _phaseStart;                   // Start of the current request phase
+    uint32_t        _phaseTimeout;                 // Deadline of the current request phase, relative to _phaseStart
+    tsTimeouts      _timeouts = {DEFAULT_DNS_TIMEOUT, DEFAULT_CONNECT_TIMEOUT, DEFAULT_RX_TIMEOUT, DEFAULT_RX_TIMEOUT};
+    Ticker          _watchdog;                     // Checks the deadline while there is no connection to poll
+    uint32_t        _keepAliveTimeout=DEFAULT_KEEPALIVE_TIMEOUT; // Idle timeout of a kept-alive connection in milli seconds
+    uint32_t        _connectCount=0;               // Requests which needed a new TCP connection
+    uint32_t        _reuseCount=0;                 // Requests sent on a kept-alive connection
+    bool            _secure = false;               // HTTPS mode
+    uint32_t        _connectStart;                 // millis() when the connection was started
+    tlsStats        _tlsStats = {};
+    uint8_t         _fingerprint[ATS_FINGERPRINT_SIZE] = {}; // Pinned SHA-1 fingerprint of the server certificate
 
     writeResponseUserCB _writeResponseUserCB;
     returnValueCB       _retValueSelector;
     readResponseUserCB  _readResponseUserCB;
+    readDispatchCB      _readDispatch = nullptr;
+    void                (*_readFn)() = nullptr;
+    void*               _readArg = nullptr;
+    bodySinkUserCB      _bodySinkUserCB;
+    streamResponseUserCB _streamResponseUserCB;
+
+    tsWriteRecord _nextWrite;                                  // Fields staged by setField(), setStatus() etc.
+    uint8_t    _fieldPrecision[FIELDNUM_MAX];                  // Decimals of the float values of the fields
 
-    String _nextWriteField[8];
-    float _nextWriteLatitude;
-    float _nextWriteLongitude;
-    float _nextWriteElevation;
-    String _nextWriteStatus;
-    String _nextWriteTwitter;
-    String _nextWriteTweet;
-    String _nextWriteCreatedAt;
+    xbuf       _request;                                       // Tx data buffer of the request under construction
+    xbuf       _body;                                          // Rx body of the response under parsing
 
-    xbuf       _request;                                       // Tx data buffer
-    xbuf       _response;                                      // Rx data buffer
+    char        _line[ATS_HEADER_LINE_MAX];                    // Header line under parsing, the rest of a longer line is dropped
+    uint8_t     _lineLen = 0;
+    char        _serverDate[ATS_DATE_MAX] = "";                // Date header of the last response
 
-    int     _getWriteFieldsContentLength();
-    int     _convertFloatToChar(float value, char *valueString);
+    tsRequest   _queue[ATS_QUEUE_SIZE];                        // Ring buffer of waiting and in flight requests
+    uint8_t     _qHead = 0;
+    uint8_t     _qCount = 0;
+    tsRequest*  _active = nullptr;                             // Request whose response is expected next
+    uint8_t     _inFlight = 0;                                 // Requests from the head of the queue under sending or waiting for response
+    bool        _pipelining = false;                           // Send queued requests without waiting for the responses
+    uint8_t     _pipelineDepth = ATS_QUEUE_SIZE;               // Max requests in flight with pipelining
+    tsRequest*  _dispatching = nullptr;                        // Request whose completion is running
+    queuePolicy _queuePolicy = QUEUE_REJECT;
+    queueStats  _queueStats = {};
+
+    tsRetryPolicy _retryPolicy[2] = {
+        {1, DEFAULT_READ_RETRY_BACKOFF, DEFAULT_RETRY_MAX_BACKOFF, DEFAULT_RETRY_JITTER, DEFAULT_RETRY_BUDGET, DEFAULT_RETRY_BUDGET_WINDOW},
+        {1, DEFAULT_WRITE_RETRY_BACKOFF, DEFAULT_RETRY_MAX_BACKOFF, DEFAULT_RETRY_JITTER, DEFAULT_RETRY_BUDGET, DEFAULT_RETRY_BUDGET_WINDOW}
+    };                                                         // Indexed by requestClass
+    retryStats  _retryStats[2] = {};
+    uint32_t    _budgetStart[2] = {};                          // Start of the current budget window
+    uint16_t    _budgetUsed[2] = {};                           // Retries in the current budget window
+    Ticker      _retryTimer;                                   // Starts the head of the queue after its backoff
+
+    uint32_t    _updateInterval = 0;                           // Min time between writes of a channel, 0: no scheduling
+    tsChannelSchedule _schedule[ATS_SCHEDULED_CHANNELS] = {};
+    Ticker      _scheduleTimer;                                // Sends the held writes in their slots
+    tsChannelTemplate _templates[ATS_REGISTERED_CHANNELS] = {};
+
+    xbuf        _batch;                                        // Compact store of the samples of batchFields()
+    uint16_t    _batchCount = 0;
+    unsigned long _batchChannel = 0;
+    String      _batchAPIKey;
+    writeResponseUserCB _batchCB;
+    size_t      _batchMaxBytes = DEFAULT_BATCH_MAX_BYTES;
+    uint16_t    _batchMaxCount = DEFAULT_BATCH_MAX_COUNT;
+    uint32_t    _batchMaxAge = DEFAULT_BATCH_MAX_AGE;
+    Ticker      _batchTimer;                                   // Sends the batch when the oldest sample gets too old
+    unsigned long _csvChannels[ATS_CSV_CHANNELS] = {};         // Channels whose batches go in CSV
+    bool        _batchDrain = false;                           // The batch is loaded from the spool
+
+    AsyncTSSpool* _spool = nullptr;
+    xbuf        _spoolRecords;                                 // Spool records of the request under construction
+    bool        _draining = false;                             // A bulk update from the spool is on its way
+    uint16_t    _drainRecords = DEFAULT_DRAIN_RECORDS;
+    uint32_t    _drainInterval = DEFAULT_DRAIN_INTERVAL;
+    uint32_t    _lastDrain = 0;
+    Ticker      _drainTimer;
+    uint32_t    _dateEpoch = 0;                                // Unix time of the last Date header, 0 if none yet
+    uint32_t    _dateMillis = 0;                               // millis() when it arrived
+    tsLatencyStats* _latency = nullptr;                        // Allocated by setLatencyStats(true)
+    bool        _rawRequest = false;                           // The request under construction is a raw one
+#if ATS_ALLOC_STATS
+    allocStats  _allocStats[ATS_LATENCY_APIS] = {};
+    atsHeapCount _heapSeen = {};                               // Heap count at the last _chargeAlloc()
+#endif
+
+    void    _buildWriteFields(unsigned long channelNumber, const tsWriteRecord& write, const char * writeAPIKey);
+    void    _writeFormHeader(unsigned long channelNumber, const char * writeAPIKey, size_t contentLen);
+    bool    _writeFieldValue(unsigned long channelNumber, unsigned int field, const char * value, size_t len, const char * writeAPIKey);
+    int     _convertFloatToChar(float value, uint8_t decimals, char *valueString);
+    int     _setField(unsigned int field, const char * value, size_t len);
     bool    _connectThingSpeak();
     bool    _writeHTTPHeader(const char * APIKey);
+    bool    _writeHTTPHeader(xbuf& out, const char * APIKey);
+    tsChannelTemplate* _channelTemplate(unsigned long channelNumber);
+    void    _renderTemplate(tsChannelTemplate& entry);
     void    _resetWriteFields();
     void    _setState(clientstate newState);
     void    _setPort(unsigned int port);
     bool    _readStringFieldInternal(unsigned long channelNumber, unsigned int field, const char * readAPIKey);
-    float   _convertStringToFloat(String value);
-    String  _getJSONValueByKey(String textToSearch, String key);
-    String  _parseValues(String & multiContent, String key);
+    static float _convertStringToFloat(const char * value);
     unsigned int  _send();
     bool    _isReady();
+    bool    _submit(unsigned long channelNumber, bool scheduled = false);
+    bool    _startNext();
+    void    _startQueued();
+    void    _countStart(tsRequest& req);
+    void    _finishActive();
+    void    _dropRequest(tsRequest& req);
+    void    _popRequest();
+    void    _moveRequest(tsRequest& to, tsRequest& from);
+    tsRequest* _findWaiting(unsigned long channelNumber, bool writesession);
+    bool    _retryable(tsRequest& req);
+    bool    _scheduleRetry(tsRequest& req);
+    bool    _laterWrite(tsRequest& req);
+    void    _retryDue();
+    tsChannelSchedule* _scheduleEntry(unsigned long channelNumber);
+    bool    _holdWrite(tsChannelSchedule& entry, const char * writeAPIKey);
+    void    _mergeWrite(tsWriteRecord& to, const tsWriteRecord& from);
+    void    _writeDone(tsRequest& req);
+    void    _heldDone(unsigned long channelNumber, int responsecode);
+    void    _armSchedule();
+    void    _runSchedule();
+    static void _onScheduleTimer(AsyncTS* self);
+
+    bool    _storeSample();
+    size_t  _encodeSample(xbuf* out, const tsWriteRecord& write, uint32_t time, uint32_t epoch);
+    bool    _nextSample(size_t& offset, tsBatchSample& sample);
+    bool    _sendBatch();
+    bool    _csvSafe();
+    size_t  _encodeBatchJSON(bool write);
+    size_t  _encodeBatchCSV(bool write);
+    batchFormat _batchFormat(unsigned long channelNumber);
+    size_t  _emit(const char* text, bool write);
+    size_t  _emitJSONString(const uint8_t* data, size_t len, bool write);
+    size_t  _emitFormString(const uint8_t* data, size_t len, bool write);
+    size_t  _emitBatchValue(const tsBatchSample& sample, uint8_t item, batchFormat format, bool write);
+    void    _batchDue();
+    static void _onBatchTimer(AsyncTS* self);
+
+    uint32_t _clockEpoch();
+    void    _addSpoolRecord(unsigned long channelNumber, const char * writeAPIKey, const tsWriteRecord& write);
+    void    _addSpoolRecord(unsigned long channelNumber, const char * writeAPIKey, size_t offset, size_t len);
+    bool    _saveToSpool(tsRequest& req);
+    void    _armDrain();
+    void    _drainSpool();
+    void    _drainDone(int responsecode, size_t offset);
+    static void _onDrainTimer(AsyncTS* self);
+    static void _onRetryTimer(AsyncTS* self);
+    void    _dispatchResponse(tsRequest& req);
+    void    _mark(tsRequest* req, latencymark mark);
+    void    _recordLatency(tsRequest& req);
+#if ATS_ALLOC_STATS
+    void    _chargeAlloc(uint8_t api, bool completed);
+#endif
+    readResponseUserCB& _readCB();
 
-    bool _readRaw(unsigned long channelNumber, String suffixURL, const char * readAPIKey);
+    bool _readRaw(unsigned long channelNumber, const char * suffixURL, const char * readAPIKey);
     bool _writeRaw(unsigned long channelNumber, String postMessage, const char *writeAPIKey);
 
     bool _writeField(unsigned long channelNumber, unsigned int field, String value, const char * writeAPIKey);
@@ -232,6 +750,7 @@ class AsyncTS
     bool _writeField(unsigned long channelNumber, unsigned int field, long value, const char * writeAPIKey);
     bool _writeField(unsigned long channelNumber, unsigned int field, float value, const char * writeAPIKey);
     bool _writeFields(unsigned long channelNumber, const char * writeAPIKey);
+    bool _writeForm(unsigned long channelNumber, const char * form, size_t len, const char * writeAPIKey);
 
     bool _readStringField(unsigned long channelNumber, unsigned int field, const char * readAPIKey);
     bool _readStringField(unsigned long channelNumber, unsigned int field);
@@ -241,6 +760,16 @@ class AsyncTS
     bool _readLongField(unsigned long channelNumber, unsigned int field);
     bool _readIntField(unsigned long channelNumber, unsigned int field, const char * readAPIKey);
     bool _readIntField(unsigned long channelNumber, unsigned int field);
+    bool _readValue(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readDispatchCB dispatch, void (*fn)(), void* arg);
+    static size_t _bodyText(xbuf* body, char* text, size_t size);
+    static void _decodeValue(xbuf* body, float& value);
+    static void _decodeValue(xbuf* body, long& value);
+    static void _decodeValue(xbuf* body, int& value);
+    static void _decodeValue(xbuf* body, String& value);
+    template <typename T>
+    static void _dispatchValue(AsyncTS* ats, int responsecode, xbuf* body, void (*fn)(), void* arg);
+    template <typename T>
+    static void _dispatchAny(AsyncTS* ats, int responsecode, xbuf* body, void (*fn)(), void* arg);
     
     bool _readMultipleFields(unsigned long channelNumber, const char * readAPIKey);
     bool _readMultipleFields(unsigned long channelNumber);
@@ -251,6 +780,18 @@ class AsyncTS
     bool _readStatus(unsigned long channelNumber, const char * readAPIKey);
     bool _readStatus(unsigned long channelNumber);
 
+    void    _setPhase(requestphase phase);
+    void    _checkDeadline();
+    void    _expire(int errorcode);
+    static void _onWatchdog(AsyncTS* self);
+
+    void    _resetParser();
+    size_t  _parseHeaders(const uint8_t* data, size_t len);
+    bool    _parseHeaderLine();
+    size_t  _parseBody(const uint8_t* data, size_t len);
+    size_t  _parseChunked(const uint8_t* data, size_t len);
+    void    _deliverBody(const uint8_t* data, size_t len);
+
     void    _onConnect(AsyncClient*);
     void    _onDisconnect(AsyncClient*);
     void    _onData(void* Vbuf, size_t len);
@@ -259,9 +800,6 @@ class AsyncTS
     void    _onAck( size_t len, uint32_t time);
 
     void    _readStringFieldCB();
-    void    _readFloatFieldCB();
-    void    _readLongFieldCB();
-    void    _readIntFieldCB();
     void    _readCreatedAtCB();
     void    _readMultipleFieldsCB();
     void    _readStatusCB();
@@ -298,6 +836,8 @@ public:
      * @arg -302  Unexpected failure during write to ThingSpeak
      * @arg -303  Unable to parse response
      * @arg -304  Timeout waiting for server to respond
+     * @arg -305  Request was dropped from the queue by the overflow policy
+     * @arg -307  Certificate of the server doesn't match the fingerprint given to setSecure()
      * @arg -401  Point was not inserted (most probable cause is the rate limit of once every 15 seconds)
     */
     int getLastTSErrorCode(){return _lastTSerrorcode;};
@@ -306,6 +846,8 @@ public:
     int setField(unsigned int field, long value);
     int setField(unsigned int field, float value);
     int setField(unsigned int field, String value);
+    int setFieldPrecision(unsigned int field, uint8_t decimals);
+    uint8_t getFieldPrecision(unsigned int field);
     int setStatus(String status);
     int setLatitude(float latitude);
     int setLongitude(float longitude);
@@ -315,7 +857,91 @@ public:
     int setTwitterTweet(String twitter, String tweet);
     long getFieldAsLong(unsigned int field);
     void setTimeout(int milliseconds);           // Default or user overide RxTimeout in milliseconds
+    void setTimeouts(uint32_t dnsMs, uint32_t connectMs, uint32_t firstByteMs, uint32_t bodyMs);
+
+    /**
+     * @brief Get the deadlines of the request phases.
+     */
+    tsTimeouts getTimeouts(){ return _timeouts; };
     void setClient(AsyncClient& client);
+    void setKeepAlive(bool keepAlive, uint32_t idleTimeout = DEFAULT_KEEPALIVE_TIMEOUT);
+    bool registerChannel(unsigned long channelNumber, const char * readAPIKey, const char * writeAPIKey);
+    void unregisterChannel(unsigned long channelNumber);
+
+    /**
+     * @brief Is the persistent-connection mode ON or OFF?
+     * @return True or false.
+     */
+    bool keepAlive            (){ return _keepAlive; };
+
+    /**
+     * @brief Number of requests which had to open a new TCP connection.
+     */
+    uint32_t getConnectCount  (){ return _connectCount; };
+
+    /**
+     * @brief Number of requests which were sent on a kept-alive connection.
+     */
+    uint32_t getReuseCount    (){ return _reuseCount; };
+    void resetConnectionStats ();
+    bool setSecure            (bool secure, const uint8_t* fingerprint = nullptr);
+
+    /**
+     * @brief Is the HTTPS mode ON or OFF?
+     */
+    bool secure               (){ return _secure; };
+
+    /**
+     * @brief Get the TLS handshake statistics of the HTTPS mode.
+     */
+    tlsStats getTLSStats      (){ return _tlsStats; };
+
+    /**
+     * @brief Value of the Date header of the last response, or empty string.
+     */
+    const char* getServerDate (){ return _serverDate; };
+    void setQueuePolicy       (queuePolicy policy);
+    void setPipelining        (bool pipelining, uint8_t maxDepth = ATS_QUEUE_SIZE);
+
+    /**
+     * @brief Get the statistics of the request queue.
+     */
+    queueStats getQueueStats  (){ return _queueStats; };
+    void resetQueueStats      ();
+    void setRetryPolicy       (requestClass cls, const tsRetryPolicy& policy);
+    void setUpdateInterval    (uint32_t interval);
+
+    /**
+     * @brief Min time between writes of a channel used by the write scheduler, 0 if it is off.
+     */
+    uint32_t getUpdateInterval(){ return _updateInterval; };
+
+    /**
+     * @brief Get the retry policy of reads or writes.
+     */
+    tsRetryPolicy getRetryPolicy(requestClass cls){ return _retryPolicy[cls]; };
+
+    /**
+     * @brief Get the retry statistics of reads or writes.
+     */
+    retryStats getRetryStats  (requestClass cls){ return _retryStats[cls]; };
+    void resetRetryStats      ();
+    void setLatencyStats      (bool enable);
+
+    /**
+     * @brief Are the latency statistics ON or OFF?
+     */
+    bool latencyStats         (){ return _latency != nullptr; };
+    latencySummary getLatencySummary(latencyApi api, latencySpan span);
+    const tsLatencyHistogram* getLatencyHistogram(latencyApi api, latencySpan span);
+    void resetLatencyStats    ();
+    static latencySummary summarizeLatency(const tsLatencyHistogram& histogram);
+    static void mergeLatency  (tsLatencyHistogram& into, const tsLatencyHistogram& from);
+    static uint32_t latencyBucketLimit(uint8_t bucket);
+#if ATS_ALLOC_STATS
+    allocStats getAllocStats  (latencyApi api);
+    void resetAllocStats      ();
+#endif
     float getFieldAsFloat(unsigned int field);
     String getFieldAsString(unsigned int field);
     
@@ -324,10 +950,12 @@ public:
     String getLongitude();
     String getElevation();
     String getCreatedAt();
+    unsigned long getEntryId();
 
     
     bool writeRaw(unsigned long channelNumber, String postMessage, const char *writeAPIKey, writeResponseUserCB wrucb);
     bool readRaw(unsigned long channelNumber, String suffixURL, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readRawStream(unsigned long channelNumber, String suffixURL, const char * readAPIKey, bodySinkUserCB sink, streamResponseUserCB srucb);
 
     
     bool writeField(unsigned long channelNumber, unsigned int field, String value, const char * writeAPIKey, writeResponseUserCB wrucb);
@@ -335,6 +963,20 @@ public:
     bool writeField(unsigned long channelNumber, unsigned int field, long value, const char * writeAPIKey, writeResponseUserCB wrucb);
     bool writeField(unsigned long channelNumber, unsigned int field, float value, const char * writeAPIKey, writeResponseUserCB wrucb);
     bool writeFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb);
+    template <typename Schema>
+    bool writeSchema(unsigned long channelNumber, const Schema& record, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool batchFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool flushBatch();
+    void setBatchLimits(size_t maxBytes, uint16_t maxCount, uint32_t maxAge);
+    bool setBatchFormat(unsigned long channelNumber, batchFormat format);
+    void setSpool(AsyncTSSpool* spool);
+    void setSpoolDrain(uint16_t maxRecords, uint32_t interval);
+    size_t getBatchSize(batchFormat format);
+
+    /**
+     * @brief Number of samples waiting in the batch.
+     */
+    uint16_t getBatchCount(){ return _batchCount; };
 
     
     bool readStringField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
@@ -345,9 +987,15 @@ public:
     bool readLongField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
     bool readIntField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
     bool readIntField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
+    template <typename T>
+    bool readField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readValueUserCB<T> cb, void* arg = nullptr);
+    template <typename T>
+    bool readField(unsigned long channelNumber, unsigned int field, readValueUserCB<T> cb, void* arg = nullptr);
 
     bool readMultipleFields(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb);
     bool readMultipleFields(unsigned long channelNumber, readResponseUserCB ruscb);
+    template <typename Schema>
+    bool readSchema(unsigned long channelNumber, Schema& record, const char * readAPIKey, readResponseUserCB ruscb);
   
     bool readCreatedAt(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb);
     bool readCreatedAt(unsigned long channelNumber, readResponseUserCB ruscb);
@@ -356,4 +1004,48 @@ public:
     bool readStatus(unsigned long channelNumber, readResponseUserCB ruscb);
 
 };
+
+/**
+ * @brief Read the latest value of a field from a private ThingSpeak channel, as T.
+ * @tparam T float, long, int or String. Other types don't compile.
+ * @param channelNumber Channel number
+ * @param field Field number (1-8) within the channel to read from.
+ * @param readAPIKey Read API key associated with the channel, NULL for a public channel.
+ * @param cb User's callback function, it gets the value itself; no std::function or std::any is made for the response.
+ * @param arg Passed to cb.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+ * @note  NAN, INFINITY, and -INFINITY are valid float results.
+*/
+template <typename T>
+bool AsyncTS::readField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readValueUserCB<T> cb, void* arg)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::readField Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (!cb) {DEBUG_ATS("ats::readField cb is null.");}
+    return _readValue(channelNumber, field, readAPIKey, &AsyncTS::_dispatchValue<T>, (void (*)())cb, arg);
+}
+
+/**
+ * @brief Read the latest value of a field from a public ThingSpeak channel, as T.
+ * @see readField(channelNumber, field, readAPIKey, cb, arg)
+*/
+template <typename T>
+bool AsyncTS::readField(unsigned long channelNumber, unsigned int field, readValueUserCB<T> cb, void* arg)
+{
+    return readField<T>(channelNumber, field, NULL, cb, arg);
+}
+
+template <typename T>
+void AsyncTS::_dispatchValue(AsyncTS* ats, int responsecode, xbuf* body, void (*fn)(), void* arg)
+{
+    T value;
+    _decodeValue(body, value);
+    if (fn)
+        ((readValueUserCB<T>)fn)(responsecode, std::move(value), arg);
+}
 #endif /* ASYNCTS_HPP */
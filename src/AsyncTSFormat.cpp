@@ -0,0 +1,155 @@
+#include "AsyncTSFormat.h"
+
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t pow10[ATS_FLOAT_DECIMALS_MAX + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+
+// Write the digits of value backwards, ending before end. Return the first digit.
+static char *digits32(char *end, uint32_t value)
+{
+    while (value >= 100)
+    {
+        uint32_t rest = value % 100;
+        value /= 100;
+        end -= 2;
+        memcpy(end, digitPairs + 2 * rest, 2);
+    }
+    if (value >= 10)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + 2 * value, 2);
+    }
+    else
+        *--end = '0' + value;
+    return end;
+}
+
+// Same for 64 bits. The 64-bit divisions only run for values over 2^32.
+static char *digits64(char *end, uint64_t value)
+{
+    while (value > UINT32_MAX)
+    {
+        uint64_t high = value / 1000000000;
+        char *start = digits32(end, (uint32_t)(value - high * 1000000000));
+        while (start > end - 9)
+            *--start = '0'; // The lower parts have exactly 9 digits.
+        end = start;
+        value = high;
+    }
+    return digits32(end, (uint32_t)value);
+}
+
+/**
+ * @brief Write the decimal digits of value and a terminator.
+ * @param out At least ATS_FORMAT_INT_SIZE bytes.
+ * @return Number of characters written, without the terminator.
+*/
+size_t atsFormatULong(char *out, unsigned long value)
+{
+    char buf[ATS_FORMAT_INT_SIZE];
+    char *end = buf + sizeof(buf);
+    char *start = digits64(end, value);
+    size_t len = end - start;
+    memcpy(out, start, len);
+    out[len] = 0;
+    return len;
+}
+
+/**
+ * @brief Write value in decimal and a terminator, like ltoa(value, out, 10).
+ * @param out At least ATS_FORMAT_INT_SIZE bytes.
+ * @return Number of characters written, without the terminator.
+*/
+size_t atsFormatLong(char *out, long value)
+{
+    if (value >= 0)
+        return atsFormatULong(out, value);
+    *out = '-';
+    return 1 + atsFormatULong(out + 1, 0 - (unsigned long)value);
+}
+
+/**
+ * @brief Write value with a fixed number of decimals and a terminator, like printf("%.*f").
+ * @param out At least ATS_FORMAT_FLOAT_SIZE bytes.
+ * @param decimals 0 .. ATS_FLOAT_DECIMALS_MAX, larger values are limited.
+ * @return Number of characters written, without the terminator.
+*/
+size_t atsFormatFloat(char *out, float value, uint8_t decimals)
+{
+    if (decimals > ATS_FLOAT_DECIMALS_MAX)
+        decimals = ATS_FLOAT_DECIMALS_MAX;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool negative = bits >> 31;
+    int exponent = (bits >> 23) & 0xff;
+    uint64_t mantissa = bits & 0x7fffff;
+    uint32_t scale = pow10[decimals];
+
+    if (exponent == 0xff || exponent >= 150 + 40)
+    {
+        // Infinity, NaN or too large for 64 bits.
+        dtostrf(value, 1, decimals, out);
+        return strlen(out);
+    }
+    if (exponent)
+        mantissa |= 1UL << 23;
+    else
+        exponent = 1; // Subnormal
+    exponent -= 150;  // value = mantissa * 2^exponent
+
+    uint64_t scaled; // |value| * 10^decimals, rounded
+    if (exponent >= 0)
+    {
+        if ((mantissa << exponent) > UINT64_MAX / scale)
+        {
+            dtostrf(value, 1, decimals, out);
+            return strlen(out);
+        }
+        scaled = (mantissa << exponent) * scale;
+    }
+    else
+    {
+        uint64_t product = mantissa * scale; // Less than 2^48
+        unsigned shift = -exponent;
+        if (shift >= 64)
+            scaled = 0; // Less than half of the last decimal.
+        else
+        {
+            scaled = product >> shift;
+            uint64_t rest = product & ((1ULL << shift) - 1);
+            uint64_t half = 1ULL << (shift - 1);
+            if (rest > half || (rest == half && (scaled & 1)))
+                scaled++;
+        }
+    }
+
+    char buf[ATS_FORMAT_FLOAT_SIZE];
+    char *end = buf + sizeof(buf);
+    char *start = end;
+    if (decimals)
+    {
+        uint64_t whole = scaled / scale;
+        start = digits32(end, (uint32_t)(scaled - whole * scale));
+        while (start > end - decimals)
+            *--start = '0';
+        *--start = '.';
+        scaled = whole;
+    }
+    start = digits64(start, scaled);
+    if (negative)
+        *--start = '-';
+    size_t len = end - start;
+    memcpy(out, start, len);
+    out[len] = 0;
+    return len;
+}
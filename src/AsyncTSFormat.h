@@ -0,0 +1,48 @@
+/*
+AsyncTSFormat - number formatting of the field values of AsyncTS.
+
+MIT License
+
+Copyright (c) 2023 János Füleki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-----------------------------------------------------------------------------
+Integers are written two digits at a time from a table. Floats are written
+with a fixed number of decimals using integer arithmetic only: the float is
+m * 2^e exactly, so value * 10^decimals is rounded from m * 10^decimals
+shifted by e, half to even like printf(). The result is the same as
+printf("%.*f", decimals, value), without the soft-float dtostrf() of the
+ESP8266. Values whose scaled form doesn't fit 64 bits (about 1.8e12 with 7
+decimals), infinity and NaN fall back to dtostrf().
+*/
+
+#ifndef ASYNCTSFORMAT_H
+#define ASYNCTSFORMAT_H
+
+#include "Arduino.h"
+
+#define ATS_FLOAT_DECIMALS_MAX 7    // Most decimals of atsFormatFloat()
+#define ATS_FORMAT_INT_SIZE 21      // Buffer of atsFormatLong(), with the terminator
+#define ATS_FORMAT_FLOAT_SIZE 49    // Buffer of atsFormatFloat(), with the terminator
+
+size_t atsFormatULong(char *out, unsigned long value);
+size_t atsFormatLong(char *out, long value);
+size_t atsFormatFloat(char *out, float value, uint8_t decimals);
+
+#endif /* ASYNCTSFORMAT_H */
@@ -0,0 +1,224 @@
+#include "AsyncTSJson.h"
+
+AsyncTSJson::AsyncTSJson(jsonMemberCB member, void *context) : _member(member), _context(context)
+{
+}
+
+/**
+ * @brief Tokenize the next slice of the input.
+*/
+void AsyncTSJson::parse(const char *data, size_t len)
+{
+    for (const char *end = data + len; data < end; data++)
+    {
+        char c = *data;
+        switch (_state)
+        {
+        case KEY_EXPECTED:
+            if (c == '"' && _started)
+            {
+                _state = KEY;
+                _keyLen = 0;
+                _keyTooLong = false;
+            }
+            else if (c == '{' && !_started)
+                _started = true;
+            else if (c == '}' && _started)
+                _state = DONE;
+            break;
+
+        case KEY:
+            if (c == '"' && !_escape)
+            {
+                _key[_keyLen] = 0;
+                _state = COLON;
+            }
+            else
+            {
+                _escape = !_escape && c == '\\';
+                if (_keyLen < ATS_JSON_KEY_MAX)
+                    _key[_keyLen++] = c;
+                else
+                    _keyTooLong = true;
+            }
+            break;
+
+        case COLON:
+            if (c == ':')
+                _state = VALUE_EXPECTED;
+            break;
+
+        case VALUE_EXPECTED:
+            _valueLen = 0;
+            if (c == '"')
+                _state = STRING;
+            else if (c == '{' || c == '[')
+            {
+                _state = NESTED;
+                _depth = 1;
+            }
+            else if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            {
+                _state = BARE;
+                _put(c);
+            }
+            break;
+
+        case STRING:
+            if (_surrogate && !_hex && !(_escape ? c == 'u' : c == '\\'))
+                _flushSurrogate(); // A high surrogate without its low half
+            if (_hex)
+            {
+                uint8_t digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+                _code = (_code << 4) | (digit & 0x0f);
+                if (--_hex == 0)
+                    _putCode(_code);
+            }
+            else if (_escape)
+            {
+                _escape = false;
+                switch (c)
+                {
+                case 'b': _put('\b'); break;
+                case 'f': _put('\f'); break;
+                case 'n': _put('\n'); break;
+                case 'r': _put('\r'); break;
+                case 't': _put('\t'); break;
+                case 'u':
+                    _hex = 4;
+                    _code = 0;
+                    break;
+                default: _put(c); break; // " \ /
+                }
+            }
+            else if (c == '\\')
+                _escape = true;
+            else if (c == '"')
+            {
+                _emit(false);
+                _state = KEY_EXPECTED;
+            }
+            else
+                _put(c);
+            break;
+
+        case BARE:
+            if (c == ',' || c == '}' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            {
+                _emit(_valueLen == 4 && !memcmp(_value, "null", 4));
+                _state = c == '}' ? DONE : KEY_EXPECTED;
+            }
+            else
+                _put(c);
+            break;
+
+        case NESTED:
+            if (c == '"')
+                _state = NESTED_STRING;
+            else if (c == '{' || c == '[')
+                _depth++;
+            else if ((c == '}' || c == ']') && --_depth == 0)
+                _state = KEY_EXPECTED;
+            break;
+
+        case NESTED_STRING:
+            if (_escape)
+                _escape = false;
+            else if (c == '\\')
+                _escape = true;
+            else if (c == '"')
+                _state = NESTED;
+            break;
+
+        case DONE:
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Tokenize the content of buf. The content is left in buf.
+*/
+void AsyncTSJson::parse(xbuf &buf)
+{
+    const uint8_t *span;
+    size_t offset = 0;
+    size_t len;
+    while (_state != DONE && (len = buf.peekSpan(&span, offset)) > 0)
+    {
+        parse((const char *)span, len);
+        offset += len;
+    }
+}
+
+void AsyncTSJson::_put(char c)
+{
+    if (_valueLen < ATS_JSON_VALUE_MAX)
+        _value[_valueLen++] = c;
+}
+
+void AsyncTSJson::_flushSurrogate()
+{
+    _surrogate = 0;
+    _putCode(0xfffd);
+}
+
+// Append a code point of \uXXXX as UTF-8.
+void AsyncTSJson::_putCode(uint32_t code)
+{
+    if (code >= 0xdc00 && code < 0xe000 && _surrogate)
+    {
+        code = 0x10000 + ((uint32_t)(_surrogate - 0xd800) << 10) + (code - 0xdc00);
+        _surrogate = 0;
+    }
+    else if (code >= 0xd800 && code < 0xdc00)
+    {
+        if (_surrogate)
+            _flushSurrogate();
+        _surrogate = code;
+        return;
+    }
+    else if (code >= 0xdc00 && code < 0xe000)
+        code = 0xfffd;
+
+    char utf8[4];
+    uint8_t n;
+    if (code < 0x80)
+    {
+        utf8[0] = code;
+        n = 1;
+    }
+    else if (code < 0x800)
+    {
+        utf8[0] = 0xc0 | (code >> 6);
+        utf8[1] = 0x80 | (code & 0x3f);
+        n = 2;
+    }
+    else if (code < 0x10000)
+    {
+        utf8[0] = 0xe0 | (code >> 12);
+        utf8[1] = 0x80 | ((code >> 6) & 0x3f);
+        utf8[2] = 0x80 | (code & 0x3f);
+        n = 3;
+    }
+    else
+    {
+        utf8[0] = 0xf0 | (code >> 18);
+        utf8[1] = 0x80 | ((code >> 12) & 0x3f);
+        utf8[2] = 0x80 | ((code >> 6) & 0x3f);
+        utf8[3] = 0x80 | (code & 0x3f);
+        n = 4;
+    }
+    for (uint8_t i = 0; i < n; i++)
+        _put(utf8[i]);
+}
+
+void AsyncTSJson::_emit(bool null)
+{
+    _value[_valueLen] = 0;
+    if (_keyTooLong)
+        return;
+    _members++;
+    if (_member)
+        _member(_context, _key, null ? nullptr : _value, _valueLen);
+}
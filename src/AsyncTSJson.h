@@ -0,0 +1,104 @@
+/*
+AsyncTSJson - single pass tokenizer of the JSON responses of ThingSpeak.
+
+MIT License
+
+Copyright (c) 2023 János Füleki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-----------------------------------------------------------------------------
+The feed entries of ThingSpeak are flat JSON objects:
+
+    {"created_at":"2024-01-31T10:20:30Z","entry_id":42,"field1":"21.5","field2":null}
+
+AsyncTSJson reads such an object byte by byte and calls back with every
+member of the top level: the key, and the value with its escapes decoded
+(\" \\ \/ \b \f \n \r \t and \uXXXX to UTF-8), or nullptr for null. Numbers,
+true and false come as their text. Nested objects and arrays are skipped.
+The input may arrive in any number of slices, e.g. the segments of an xbuf,
+so the body is never copied into one String. Keys longer than
+ATS_JSON_KEY_MAX are skipped, values are cut at ATS_JSON_VALUE_MAX bytes.
+*/
+
+#ifndef ASYNCTSJSON_H
+#define ASYNCTSJSON_H
+
+#include "Arduino.h"
+#include "xbuf.h"
+
+#define ATS_JSON_KEY_MAX 15
+#define ATS_JSON_VALUE_MAX 255 // The longest value of ThingSpeak (FIELDLENGTH_MAX)
+
+/**
+ * @typedef void (*jsonMemberCB)(void *context, const char *key, const char *value, size_t len);
+ * A member of the top level object.
+ * @param context As given to AsyncTSJson.
+ * @param key Terminated key.
+ * @param value Terminated value of len bytes, nullptr if the value is null.
+*/
+typedef void (*jsonMemberCB)(void *context, const char *key, const char *value, size_t len);
+
+class AsyncTSJson
+{
+public:
+    AsyncTSJson(jsonMemberCB member, void *context);
+    void parse(const char *data, size_t len);
+    void parse(xbuf &buf);
+
+    /**
+     * @brief Number of the members reported so far.
+     */
+    uint16_t members() { return _members; };
+
+private:
+    enum jsonstate{
+                KEY_EXPECTED,   // Before a key of the top level
+                KEY,
+                COLON,
+                VALUE_EXPECTED,
+                STRING,
+                BARE,           // Number, true, false or null
+                NESTED,         // Object or array in a value, skipped
+                NESTED_STRING,
+                DONE            // After the top level object
+    };
+
+    void _put(char c);
+    void _putCode(uint32_t code);
+    void _flushSurrogate();
+    void _emit(bool null);
+
+    jsonMemberCB _member;
+    void*       _context;
+    jsonstate   _state = KEY_EXPECTED;
+    bool        _started = false;       // The top level '{' was seen
+    bool        _escape = false;        // After a backslash
+    uint8_t     _hex = 0;               // Hex digits of \uXXXX still to come
+    uint32_t    _code = 0;              // Code point under decoding
+    uint16_t    _surrogate = 0;         // High surrogate waiting for its low half
+    uint8_t     _depth = 0;             // Nesting of a skipped value
+    uint16_t    _members = 0;
+    uint8_t     _keyLen = 0;
+    bool        _keyTooLong = false;
+    uint16_t    _valueLen = 0;
+    char        _key[ATS_JSON_KEY_MAX + 1];
+    char        _value[ATS_JSON_VALUE_MAX + 1];
+};
+
+#endif /* ASYNCTSJSON_H */
@@ -0,0 +1,563 @@
+#include "AsyncTSPool.h"
+
+AsyncTSPool::AsyncTSPool()
+{
+    #ifdef ARDUINO_ARCH_ESP32
+    _xSemaphore = xSemaphoreCreateRecursiveMutex();
+    #endif
+}
+
+AsyncTSPool::~AsyncTSPool()
+{
+    // The clients go first: closing them still calls back into their AsyncTS.
+    for (uint8_t i = 0; i < _size; i++)
+        delete _clients[i];
+    for (uint8_t i = 0; i < _size; i++)
+        delete _lanes[i];
+}
+
+/**
+ * @brief Create the connections of the pool.
+ *
+ * Every connection gets its own AsyncClient and AsyncTS. Set them up after begin() with
+ * connection(), e.g. setKeepAlive() on each to save the TCP handshakes.
+ * @param connections Number of sockets, 1..ATS_POOL_MAX_CONNECTIONS.
+ * @retval false: begin() was called already.
+ * @retval true: the pool is ready.
+*/
+bool AsyncTSPool::begin(uint8_t connections)
+{
+    if (_size)
+        return false;
+    if (connections < 1)
+        connections = 1;
+    if (connections > ATS_POOL_MAX_CONNECTIONS)
+        connections = ATS_POOL_MAX_CONNECTIONS;
+    DEBUG_ATS("atspool::begin %u connections\r\n", connections);
+    for (uint8_t i = 0; i < connections; i++)
+    {
+        _clients[i] = new AsyncClient();
+        _lanes[i] = new AsyncTS();
+        _lanes[i]->setDebug(_debug);
+        _lanes[i]->begin(*_clients[i]);
+    }
+    _size = connections;
+    _statsStart = millis();
+    return true;
+}
+
+/**
+ * @brief Turn debug messages of the pool and of every connection on or off.
+ * @param debug true/on , false/off
+*/
+void AsyncTSPool::setDebug(bool debug)
+{
+    _debug = debug;
+    for (uint8_t i = 0; i < _size; i++)
+        _lanes[i]->setDebug(debug);
+}
+
+/**
+ * @brief Get the utilization counters of a connection.
+ * @param index Connection, 0..size()-1.
+*/
+poolConnStats AsyncTSPool::getConnStats(uint8_t index)
+{
+    SEMAPHORE_TAKE();
+    poolConnStats stats = _stats[index];
+    if (stats.outstanding)
+        stats.busyTime += millis() - _busySince[index];
+    SEMAPHORE_GIVE();
+    stats.connects = _lanes[index]->getConnectCount();
+    stats.reuses = _lanes[index]->getReuseCount();
+    return stats;
+}
+
+/**
+ * @brief Part of the time since begin() or resetStats() the connection had outstanding requests.
+ * @param index Connection, 0..size()-1.
+ * @return Percent, 0..100.
+*/
+uint8_t AsyncTSPool::getUtilization(uint8_t index)
+{
+    uint32_t elapsed = millis() - _statsStart;
+    if (!elapsed)
+        return 0;
+    return (uint64_t)getConnStats(index).busyTime * 100 / elapsed;
+}
+
+/**
+ * @brief Reset the utilization counters of every connection.
+*/
+void AsyncTSPool::resetStats()
+{
+    SEMAPHORE_TAKE();
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < _size; i++)
+    {
+        uint16_t outstanding = _stats[i].outstanding;
+        _stats[i] = {};
+        _stats[i].outstanding = outstanding;
+        _stats[i].maxOutstanding = outstanding;
+        _busySince[i] = now;
+        _lanes[i]->resetConnectionStats();
+    }
+    _statsStart = now;
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief Choose the connection of a request.
+ * @param flow Set to the flow entry of the request, nullptr if the flow table is full.
+*/
+uint8_t AsyncTSPool::_pick(unsigned long channelNumber, bool writesession, poolFlow *&flow)
+{
+    poolFlow *free = nullptr;
+    flow = nullptr;
+    for (uint8_t i = 0; i < ATS_POOL_FLOWS; i++)
+    {
+        poolFlow &entry = _flows[i];
+        if (entry.channelNumber == channelNumber && entry.writesession == writesession)
+        {
+            flow = &entry;
+            return entry.lane;
+        }
+        if (!free && entry.channelNumber == 0)
+            free = &entry;
+    }
+    uint8_t home = channelNumber % _size;
+    if (!free)
+    {
+        // No room to remember the flow, the home connection keeps its order.
+        if (writesession)
+            _overflowWrites |= 1 << home; // The batch and the schedule of the channel live there now.
+        DEBUG_ATS("atspool::_pick flow table full, channel %lu -> connection %u\r\n", channelNumber, home);
+        return home;
+    }
+
+    uint8_t lane = 0;
+    if (_untracked[home] || (writesession && (_overflowWrites & (1 << home))))
+    {
+        // Requests of the flow may be outstanding there without an entry.
+        lane = home;
+    }
+    else
+    {
+        for (uint8_t i = 1; i < _size; i++)
+        {
+            bool idle = _lanes[i]->_state == AsyncTS::IDLE;
+            bool bestIdle = _lanes[lane]->_state == AsyncTS::IDLE;
+            if (_stats[i].outstanding < _stats[lane].outstanding ||
+                (_stats[i].outstanding == _stats[lane].outstanding && idle && !bestIdle))
+                lane = i;
+        }
+    }
+    free->channelNumber = channelNumber;
+    free->writesession = writesession;
+    free->lane = lane;
+    free->outstanding = 0;
+    flow = free;
+    DEBUG_ATS("atspool::_pick channel %lu %s -> connection %u\r\n", channelNumber, writesession ? "write" : "read", lane);
+    return lane;
+}
+
+/**
+ * @brief Count a request on its connection before it is handed over.
+*/
+AsyncTSPool::poolTicket AsyncTSPool::_open(unsigned long channelNumber, bool writesession)
+{
+    poolTicket ticket;
+    SEMAPHORE_TAKE();
+    ticket.lane = _pick(channelNumber, writesession, ticket.flow);
+    for (ticket.slot = 0; ticket.slot < ATS_POOL_TICKETS && _slots[ticket.lane][ticket.slot].inUse; ticket.slot++)
+        ;
+    if (ticket.slot == ATS_POOL_TICKETS)
+    {
+        // The queue of the connection is full anyway, the request is refused.
+        DEBUG_ATS("atspool::_open no free ticket on connection %u\r\n", ticket.lane);
+        SEMAPHORE_GIVE();
+        return ticket;
+    }
+    poolSlot &slot = _slots[ticket.lane][ticket.slot];
+    slot.inUse = true;
+    ticket.generation = ++slot.generation;
+    slot.flow = ticket.flow;
+    slot.copyFeed = false;
+    poolConnStats &stats = _stats[ticket.lane];
+    if (stats.outstanding++ == 0)
+        _busySince[ticket.lane] = millis();
+    if (stats.outstanding > stats.maxOutstanding)
+        stats.maxOutstanding = stats.outstanding;
+    stats.requests++;
+    if (ticket.flow)
+        ticket.flow->outstanding++;
+    else
+        _untracked[ticket.lane]++;
+    SEMAPHORE_GIVE();
+    return ticket;
+}
+
+/**
+ * @brief Finish the hand-over of a request.
+ * @param queued Return value of the AsyncTS function, false if it wasn't called because there was no free ticket.
+ * @return queued
+*/
+bool AsyncTSPool::_close(const poolTicket &ticket, bool queued)
+{
+    if (!queued)
+        _complete(ticket, false); // No callback will come, unless it has come already.
+    return queued;
+}
+
+/**
+ * @brief Uncount a request, only the first call of a ticket counts.
+ * @param served The callback of the request has run.
+*/
+void AsyncTSPool::_complete(const poolTicket &ticket, bool served)
+{
+    SEMAPHORE_TAKE();
+    if (ticket.slot == ATS_POOL_TICKETS || !_slots[ticket.lane][ticket.slot].inUse ||
+        _slots[ticket.lane][ticket.slot].generation != ticket.generation)
+    {
+        SEMAPHORE_GIVE();
+        return;
+    }
+    poolSlot &slot = _slots[ticket.lane][ticket.slot];
+    slot.inUse = false;
+    slot.writeCB = nullptr;
+    slot.readCB = nullptr;
+    poolConnStats &stats = _stats[ticket.lane];
+    if (--stats.outstanding == 0)
+        stats.busyTime += millis() - _busySince[ticket.lane];
+    if (served)
+        stats.completed++;
+    else
+        stats.requests--;
+    if (!ticket.flow)
+        _untracked[ticket.lane]--;
+    else if (--ticket.flow->outstanding == 0 && !ticket.flow->writesession)
+        ticket.flow->channelNumber = 0; // Reads may move to another connection from now.
+    SEMAPHORE_GIVE();
+}
+
+/**
+ * @brief The connection of the ticket, with the fields staged by setField() etc.
+*/
+AsyncTS &AsyncTSPool::_stage(const poolTicket &ticket)
+{
+    AsyncTS &lane = *_lanes[ticket.lane];
+    if (ticket.lane != 0)
+    {
+        // The setters store into the first connection.
+        lane._nextWrite.set = 0;
+        lane._mergeWrite(lane._nextWrite, _lanes[0]->_nextWrite);
+        _lanes[0]->_resetWriteFields();
+    }
+    return lane;
+}
+
+/**
+ * @brief The ticket of a slot whose callback has come.
+ * @param id Connection and slot, as packed by _wrap().
+*/
+AsyncTSPool::poolTicket AsyncTSPool::_served(uint16_t id)
+{
+    poolTicket ticket;
+    ticket.lane = id >> 8;
+    ticket.slot = id & 0xff;
+    poolSlot &slot = _slots[ticket.lane][ticket.slot];
+    ticket.generation = slot.generation;
+    ticket.flow = slot.flow;
+    return ticket;
+}
+
+// The callback is moved out of the slot before it runs: it may queue a new request into the same slot.
+void AsyncTSPool::_onWrite(uint16_t id, int responsecode)
+{
+    poolTicket ticket = _served(id);
+    writeResponseUserCB wrucb = std::move(_slots[ticket.lane][ticket.slot].writeCB);
+    _complete(ticket, true);
+    if (wrucb)
+        wrucb(responsecode);
+}
+
+void AsyncTSPool::_onRead(uint16_t id, int responsecode, std::any *answare)
+{
+    poolTicket ticket = _served(id);
+    readResponseUserCB ruscb = std::move(_slots[ticket.lane][ticket.slot].readCB);
+    bool copyFeed = _slots[ticket.lane][ticket.slot].copyFeed;
+    _complete(ticket, true);
+    if (copyFeed)
+        lastFeed = _lanes[ticket.lane]->lastFeed;
+    if (ruscb)
+        ruscb(responsecode, answare);
+}
+
+/**
+ * @brief Keep the callback of the user in the slot of the ticket, and give AsyncTS one which
+ * only holds the pool and the number of the slot. That fits in std::function without allocation.
+*/
+writeResponseUserCB AsyncTSPool::_wrap(const poolTicket &ticket, writeResponseUserCB wrucb)
+{
+    _slots[ticket.lane][ticket.slot].writeCB = std::move(wrucb);
+    uint16_t id = ticket.lane << 8 | ticket.slot;
+    return [this, id](int responsecode)
+    { _onWrite(id, responsecode); };
+}
+
+readResponseUserCB AsyncTSPool::_wrap(const poolTicket &ticket, readResponseUserCB ruscb, bool copyFeed)
+{
+    _slots[ticket.lane][ticket.slot].readCB = std::move(ruscb);
+    _slots[ticket.lane][ticket.slot].copyFeed = copyFeed;
+    uint16_t id = ticket.lane << 8 | ticket.slot;
+    return [this, id](int responsecode, std::any *answare)
+    { _onRead(id, responsecode, answare); };
+}
+
+/**
+ * @brief Set the value of a single field that will be part of a multi-field update, see AsyncTS::setField().
+ * @note Call begin() before.
+*/
+int AsyncTSPool::setField(unsigned int field, int value)
+{
+    return _lanes[0]->setField(field, value);
+}
+
+int AsyncTSPool::setField(unsigned int field, long value)
+{
+    return _lanes[0]->setField(field, value);
+}
+
+int AsyncTSPool::setField(unsigned int field, float value)
+{
+    return _lanes[0]->setField(field, value);
+}
+
+int AsyncTSPool::setField(unsigned int field, String value)
+{
+    return _lanes[0]->setField(field, value);
+}
+
+/**
+ * @brief Set the decimals of the float values of a field on every connection, see AsyncTS::setFieldPrecision().
+ * @note Call begin() before.
+*/
+int AsyncTSPool::setFieldPrecision(unsigned int field, uint8_t decimals)
+{
+    int status = TS_ERR_INVALID_FIELD_NUM;
+    for (uint8_t i = 0; i < _size; i++)
+        status = _lanes[i]->setFieldPrecision(field, decimals);
+    return status;
+}
+
+/**
+ * @brief Register the API keys of a channel on every connection, see AsyncTS::registerChannel().
+ * @note Call begin() before.
+*/
+bool AsyncTSPool::registerChannel(unsigned long channelNumber, const char *readAPIKey, const char *writeAPIKey)
+{
+    bool registered = _size > 0;
+    for (uint8_t i = 0; i < _size; i++)
+        registered = _lanes[i]->registerChannel(channelNumber, readAPIKey, writeAPIKey) && registered;
+    return registered;
+}
+
+int AsyncTSPool::setStatus(String status)
+{
+    return _lanes[0]->setStatus(status);
+}
+
+int AsyncTSPool::setLatitude(float latitude)
+{
+    return _lanes[0]->setLatitude(latitude);
+}
+
+int AsyncTSPool::setLongitude(float longitude)
+{
+    return _lanes[0]->setLongitude(longitude);
+}
+
+int AsyncTSPool::setElevation(float elevation)
+{
+    return _lanes[0]->setElevation(elevation);
+}
+
+int AsyncTSPool::setCreatedAt(String createdAt)
+{
+    return _lanes[0]->setCreatedAt(createdAt);
+}
+
+int AsyncTSPool::setTwitterTweet(String twitter, String tweet)
+{
+    return _lanes[0]->setTwitterTweet(twitter, tweet);
+}
+
+/**
+ * @brief Write a raw POST to a ThingSpeak channel on the connection of the channel's writes.
+ * @note The functions of the pool work like the same functions of AsyncTS, but a null callback
+ * is not replaced by the previous one.
+*/
+bool AsyncTSPool::writeRaw(unsigned long channelNumber, String postMessage, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->writeRaw(channelNumber, postMessage, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+bool AsyncTSPool::readRaw(unsigned long channelNumber, String suffixURL, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readRaw(channelNumber, suffixURL, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readRawStream(unsigned long channelNumber, String suffixURL, const char *readAPIKey, bodySinkUserCB sink, streamResponseUserCB srucb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readRawStream(channelNumber, suffixURL, readAPIKey, sink, _wrap(ticket, srucb)));
+}
+
+bool AsyncTSPool::writeField(unsigned long channelNumber, unsigned int field, String value, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->writeField(channelNumber, field, value, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+bool AsyncTSPool::writeField(unsigned long channelNumber, unsigned int field, int value, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->writeField(channelNumber, field, value, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+bool AsyncTSPool::writeField(unsigned long channelNumber, unsigned int field, long value, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->writeField(channelNumber, field, value, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+bool AsyncTSPool::writeField(unsigned long channelNumber, unsigned int field, float value, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->writeField(channelNumber, field, value, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+/**
+ * @brief Write the fields staged by setField() etc. on the connection of the channel's writes.
+*/
+bool AsyncTSPool::writeFields(unsigned long channelNumber, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolTicket ticket = _open(channelNumber, true);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _stage(ticket).writeFields(channelNumber, writeAPIKey, _wrap(ticket, wrucb)));
+}
+
+/**
+ * @brief Add the staged fields to the batch of the connection of the channel's writes.
+ * @note The bulk updates are not counted in the utilization of the connections,
+ * their single callback belongs to many batchFields() calls.
+*/
+bool AsyncTSPool::batchFields(unsigned long channelNumber, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    poolFlow *flow;
+    SEMAPHORE_TAKE();
+    uint8_t lane = _pick(channelNumber, true, flow);
+    SEMAPHORE_GIVE();
+    poolTicket ticket = {lane, ATS_POOL_TICKETS, 0, flow};
+    return _stage(ticket).batchFields(channelNumber, writeAPIKey, wrucb);
+}
+
+/**
+ * @brief Send the batches of every connection now.
+ * @return False if any of them couldn't be queued.
+*/
+bool AsyncTSPool::flushBatch()
+{
+    bool ok = true;
+    for (uint8_t i = 0; i < _size; i++)
+        ok = _lanes[i]->flushBatch() && ok;
+    return ok;
+}
+
+bool AsyncTSPool::readStringField(unsigned long channelNumber, unsigned int field, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readStringField(channelNumber, field, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readStringField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readStringField(channelNumber, field, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readFloatField(unsigned long channelNumber, unsigned int field, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readFloatField(channelNumber, field, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readFloatField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readFloatField(channelNumber, field, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readLongField(unsigned long channelNumber, unsigned int field, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readLongField(channelNumber, field, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readLongField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readLongField(channelNumber, field, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readIntField(unsigned long channelNumber, unsigned int field, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readIntField(channelNumber, field, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readIntField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readIntField(channelNumber, field, _wrap(ticket, ruscb)));
+}
+
+/**
+ * @brief Read the fields of the latest entry, the result is copied into lastFeed before the callback.
+*/
+bool AsyncTSPool::readMultipleFields(unsigned long channelNumber, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readMultipleFields(channelNumber, readAPIKey, _wrap(ticket, ruscb, true)));
+}
+
+bool AsyncTSPool::readMultipleFields(unsigned long channelNumber, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readMultipleFields(channelNumber, _wrap(ticket, ruscb, true)));
+}
+
+bool AsyncTSPool::readCreatedAt(unsigned long channelNumber, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readCreatedAt(channelNumber, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readCreatedAt(unsigned long channelNumber, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readCreatedAt(channelNumber, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readStatus(unsigned long channelNumber, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readStatus(channelNumber, readAPIKey, _wrap(ticket, ruscb)));
+}
+
+bool AsyncTSPool::readStatus(unsigned long channelNumber, readResponseUserCB ruscb)
+{
+    poolTicket ticket = _open(channelNumber, false);
+    return _close(ticket, ticket.slot < ATS_POOL_TICKETS && _lanes[ticket.lane]->readStatus(channelNumber, _wrap(ticket, ruscb)));
+}
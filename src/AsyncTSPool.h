@@ -0,0 +1,191 @@
+/*
+AsyncTSPool - a pool of AsyncTS connections.
+
+MIT License
+
+Copyright (c) 2023 János Füleki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-----------------------------------------------------------------------------
+The pool owns up to ATS_POOL_MAX_CONNECTIONS AsyncClient sockets, each driven
+by its own AsyncTS. A request goes to a connection picked by its flow: the
+channel number and the kind (read or write).
+
+ - Requests of one flow stay on one connection while any of them is
+   outstanding, so their order is kept.
+ - Write flows are pinned to their connection for good, so the update
+   scheduler and the batch of the channel live in one AsyncTS.
+ - A new flow goes to the connection with the fewest outstanding requests,
+   a kept-alive idle connection first.
+ - If the flow table is full, a request goes to the home connection of its
+   channel (channel number % connections). A flow which gets an entry while
+   requests without one are outstanding there starts on its home connection.
+
+Every socket takes a TCP PCB of lwIP (MEMP_NUM_TCP_PCB, 5 by default on the
+ESP8266), leave some for the rest of the sketch.
+*/
+
+#ifndef ASYNCTSPOOL_H
+#define ASYNCTSPOOL_H
+
+#include "AsyncTS.hpp"
+
+#ifndef ATS_POOL_MAX_CONNECTIONS
+#define ATS_POOL_MAX_CONNECTIONS 4  // Upper limit of the sockets of a pool
+#endif
+#define ATS_POOL_CONNECTIONS 2      // Default number of sockets
+#ifndef ATS_POOL_FLOWS
+#define ATS_POOL_FLOWS 8            // Flows tracked for the connection affinity
+#endif
+#define ATS_POOL_TICKETS (ATS_QUEUE_SIZE + 1) // Requests of a connection counted at once: its queue, and one being handed over
+
+// Utilization of a connection of the pool. Times are in milliseconds.
+typedef struct poolConnStatsRecord
+{
+    uint32_t requests;          // Requests dispatched to the connection
+    uint32_t completed;         // Requests whose callback has run
+    uint16_t outstanding;       // Requests dispatched and not completed now
+    uint16_t maxOutstanding;    // Highest outstanding seen
+    uint32_t busyTime;          // Time with at least one outstanding request
+    uint32_t connects;          // Requests which needed a new TCP connection
+    uint32_t reuses;            // Requests sent on a kept-alive connection
+} poolConnStats;
+
+class AsyncTSPool
+{
+    private:
+    // Requests of one channel and kind, kept on one connection.
+    typedef struct poolFlowRecord
+    {
+        unsigned long   channelNumber;  // 0: unused entry
+        bool            writesession;
+        uint8_t         lane;
+        uint16_t        outstanding;
+    } poolFlow;
+
+    // A dispatched request, completed once by its callback or by a failed dispatch.
+    typedef struct poolTicketRecord
+    {
+        uint8_t     lane;
+        uint8_t     slot;           // In _slots of the lane, ATS_POOL_TICKETS if none was free
+        uint8_t     generation;     // Of the slot when the ticket was opened
+        poolFlow*   flow;           // nullptr if the flow table was full
+    } poolTicket;
+
+    // The state of a ticket until its completion. The callbacks given to AsyncTS only
+    // carry the pool and the number of the slot, so wrapping a request allocates nothing.
+    typedef struct poolSlotRecord
+    {
+        bool                inUse;
+        uint8_t             generation;     // Counts the uses, a late _close() of a reused slot is ignored
+        bool                copyFeed;       // Copy lastFeed of the connection before the callback
+        poolFlow*           flow;
+        writeResponseUserCB writeCB;        // Also streamResponseUserCB
+        readResponseUserCB  readCB;
+    } poolSlot;
+
+    uint8_t         _size = 0;
+    AsyncClient*    _clients[ATS_POOL_MAX_CONNECTIONS] = {};
+    AsyncTS*        _lanes[ATS_POOL_MAX_CONNECTIONS] = {};
+    poolConnStats   _stats[ATS_POOL_MAX_CONNECTIONS] = {};
+    uint32_t        _busySince[ATS_POOL_MAX_CONNECTIONS] = {};
+    uint32_t        _statsStart = 0;
+    poolFlow        _flows[ATS_POOL_FLOWS] = {};
+    uint16_t        _untracked[ATS_POOL_MAX_CONNECTIONS] = {};  // Outstanding requests without a flow entry
+    uint8_t         _overflowWrites = 0;                        // Connections which took writes without a flow entry, as bits
+    poolSlot        _slots[ATS_POOL_MAX_CONNECTIONS][ATS_POOL_TICKETS];
+    bool            _debug = false;
+
+    poolTicket  _open(unsigned long channelNumber, bool writesession);
+    bool        _close(const poolTicket& ticket, bool queued);
+    void        _complete(const poolTicket& ticket, bool served);
+    poolTicket  _served(uint16_t id);
+    void        _onWrite(uint16_t id, int responsecode);
+    void        _onRead(uint16_t id, int responsecode, std::any* answare);
+    uint8_t     _pick(unsigned long channelNumber, bool writesession, poolFlow*& flow);
+    AsyncTS&    _stage(const poolTicket& ticket);
+    writeResponseUserCB  _wrap(const poolTicket& ticket, writeResponseUserCB wrucb);  // Also streamResponseUserCB
+    readResponseUserCB   _wrap(const poolTicket& ticket, readResponseUserCB ruscb, bool copyFeed = false);
+#if defined(ARDUINO_ARCH_ESP32)
+    SemaphoreHandle_t _xSemaphore = nullptr;
+#endif
+
+    public:
+    feed lastFeed;      // Result of the last readMultipleFields()
+
+    AsyncTSPool();
+    ~AsyncTSPool();
+    bool begin(uint8_t connections = ATS_POOL_CONNECTIONS);
+    void setDebug(bool debug);
+
+    /**
+     * @brief Number of connections of the pool.
+     */
+    uint8_t size(){ return _size; };
+
+    /**
+     * @brief The AsyncTS of a connection, for its settings (keep-alive, timeouts, retry policy etc.).
+     */
+    AsyncTS& connection(uint8_t index){ return *_lanes[index]; };
+
+    poolConnStats getConnStats(uint8_t index);
+    uint8_t getUtilization(uint8_t index);
+    void resetStats();
+
+    int setField(unsigned int field, int value);
+    int setField(unsigned int field, long value);
+    int setField(unsigned int field, float value);
+    int setField(unsigned int field, String value);
+    int setFieldPrecision(unsigned int field, uint8_t decimals);
+    bool registerChannel(unsigned long channelNumber, const char * readAPIKey, const char * writeAPIKey);
+    int setStatus(String status);
+    int setLatitude(float latitude);
+    int setLongitude(float longitude);
+    int setElevation(float elevation);
+    int setCreatedAt(String createdAt);
+    int setTwitterTweet(String twitter, String tweet);
+
+    bool writeRaw(unsigned long channelNumber, String postMessage, const char *writeAPIKey, writeResponseUserCB wrucb);
+    bool readRaw(unsigned long channelNumber, String suffixURL, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readRawStream(unsigned long channelNumber, String suffixURL, const char * readAPIKey, bodySinkUserCB sink, streamResponseUserCB srucb);
+
+    bool writeField(unsigned long channelNumber, unsigned int field, String value, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool writeField(unsigned long channelNumber, unsigned int field, int value, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool writeField(unsigned long channelNumber, unsigned int field, long value, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool writeField(unsigned long channelNumber, unsigned int field, float value, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool writeFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool batchFields(unsigned long channelNumber, const char * writeAPIKey, writeResponseUserCB wrucb);
+    bool flushBatch();
+
+    bool readStringField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readStringField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
+    bool readFloatField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readFloatField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
+    bool readLongField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readLongField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
+    bool readIntField(unsigned long channelNumber, unsigned int field, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readIntField(unsigned long channelNumber, unsigned int field, readResponseUserCB ruscb);
+    bool readMultipleFields(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readMultipleFields(unsigned long channelNumber, readResponseUserCB ruscb);
+    bool readCreatedAt(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readCreatedAt(unsigned long channelNumber, readResponseUserCB ruscb);
+    bool readStatus(unsigned long channelNumber, const char * readAPIKey, readResponseUserCB ruscb);
+    bool readStatus(unsigned long channelNumber, readResponseUserCB ruscb);
+};
+#endif /* ASYNCTSPOOL_H */
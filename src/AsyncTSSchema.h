@@ -0,0 +1,434 @@
+/*
+AsyncTSSchema - compile-time typed field layout of a ThingSpeak channel.
+
+MIT License
+
+Copyright (c) 2023 János Füleki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-----------------------------------------------------------------------------
+A ChannelSchema lists the fields of a channel with their types:
+
+    typedef ChannelSchema<Float<1>, Int<2>, Float<3, 2>, Str<5, 32>> Weather;
+    Weather w;
+    w.set<1>(21.5f);
+    w.set<5>("sunny");
+    ats.writeSchema(channel, w, writeAPIKey, wrucb);
+
+The values are stored inline in the record, with a bit per field telling
+which ones are set. The field numbers are template arguments, so set<N>()
+and get<N>() of a field which is not in the schema don't compile, and the
+form encoder is unrolled for the fields of the schema. FORM_SIZE is the
+size of the longest form, writeSchema() builds it in a stack buffer of that
+size without any allocation.
+
+readSchema() decodes the last entry of the channel into a record. Fields
+which are null or missing in the response are not set.
+*/
+
+#ifndef ASYNCTSSCHEMA_H
+#define ASYNCTSSCHEMA_H
+
+#include "AsyncTS.hpp"
+#include "AsyncTSJson.h"
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+/**
+ * @brief A float field with a fixed number of decimals, from -999999000000 to 999999000000.
+ * @tparam N Field number (1-8).
+ * @tparam Decimals Digits right of the decimal point, 0 to 7.
+*/
+template <uint8_t N, uint8_t Decimals = DEFAULT_FIELD_DECIMALS>
+struct Float
+{
+    static_assert(N >= FIELDNUM_MIN && N <= FIELDNUM_MAX, "The field number is 1..8");
+    static_assert(Decimals <= ATS_FLOAT_DECIMALS_MAX, "At most 7 decimals");
+    typedef float type;
+    static constexpr uint8_t field = N;
+    static constexpr size_t maxLength = 13 + (Decimals ? 1 + Decimals : 0); // -999999000000.ddddd
+
+    static int assign(type &to, float value)
+    {
+        if (0 == isinf(value) && (value > 999999000000 || value < -999999000000))
+            return TS_ERR_OUT_OF_RANGE;
+        to = value;
+        return TS_OK_SUCCESS;
+    }
+    static size_t encode(char *out, const type &value) { return atsFormatFloat(out, value, Decimals); }
+    static bool decode(type &to, const char *text) { return assign(to, strtof(text, nullptr)) == TS_OK_SUCCESS; }
+};
+
+/**
+ * @brief An integer field.
+ * @tparam N Field number (1-8).
+*/
+template <uint8_t N>
+struct Int
+{
+    static_assert(N >= FIELDNUM_MIN && N <= FIELDNUM_MAX, "The field number is 1..8");
+    typedef long type;
+    static constexpr uint8_t field = N;
+    static constexpr size_t maxLength = ATS_FORMAT_INT_SIZE - 1;
+
+    static int assign(type &to, long value)
+    {
+        to = value;
+        return TS_OK_SUCCESS;
+    }
+    static size_t encode(char *out, const type &value) { return atsFormatLong(out, value); }
+    static bool decode(type &to, const char *text) { to = strtol(text, nullptr, 10); return true; }
+};
+
+/**
+ * @brief Text of at most Len bytes, stored inline.
+*/
+template <size_t Len>
+struct tsText
+{
+    char    text[Len + 1];
+    uint8_t length;
+
+    const char *c_str() const { return text; }
+};
+
+/**
+ * @brief A text field of at most Len bytes (UTF-8).
+ * @tparam N Field number (1-8).
+ * @tparam Len Longest value, up to the 255 bytes of ThingSpeak.
+*/
+template <uint8_t N, size_t Len>
+struct Str
+{
+    static_assert(N >= FIELDNUM_MIN && N <= FIELDNUM_MAX, "The field number is 1..8");
+    static_assert(Len > 0 && Len <= FIELDLENGTH_MAX, "A field has at most 255 bytes");
+    typedef tsText<Len> type;
+    static constexpr uint8_t field = N;
+    static constexpr size_t maxLength = Len;
+
+    static int assign(type &to, const char *value, size_t len)
+    {
+        if (len > Len)
+            return TS_ERR_OUT_OF_RANGE;
+        memcpy(to.text, value, len);
+        to.text[len] = 0;
+        to.length = len;
+        return TS_OK_SUCCESS;
+    }
+    static int assign(type &to, const char *value) { return assign(to, value, strlen(value)); }
+    static int assign(type &to, const String &value) { return assign(to, value.c_str(), value.length()); }
+    static size_t encode(char *out, const type &value)
+    {
+        memcpy(out, value.text, value.length);
+        return value.length;
+    }
+    static bool decode(type &to, const char *text) { return assign(to, text) == TS_OK_SUCCESS; }
+};
+
+/**
+ * @brief Typed record of the fields of a channel.
+ * @tparam Fields Float<N>, Int<N> and Str<N, Len> of different field numbers.
+*/
+template <typename... Fields>
+class ChannelSchema
+{
+    static_assert(sizeof...(Fields) > 0 && sizeof...(Fields) <= FIELDNUM_MAX, "A channel has 1..8 fields");
+
+    typedef std::tuple<Fields...> fieldList;
+    template <size_t I>
+    using fieldAt = typename std::tuple_element<I, fieldList>::type;
+
+    static constexpr uint8_t _mask(uint8_t n) { return 1 << (n - 1); }
+    static constexpr bool _unique()
+    {
+        constexpr uint8_t numbers[] = {Fields::field...};
+        uint8_t seen = 0;
+        for (uint8_t n : numbers)
+        {
+            if (seen & _mask(n))
+                return false;
+            seen |= _mask(n);
+        }
+        return true;
+    }
+    static_assert(_unique(), "A field number is used twice");
+
+    // Index of field number N in Fields.
+    template <uint8_t N>
+    static constexpr size_t _index()
+    {
+        constexpr uint8_t numbers[] = {Fields::field...};
+        for (size_t i = 0; i < sizeof...(Fields); i++)
+        {
+            if (numbers[i] == N)
+                return i;
+        }
+        return sizeof...(Fields);
+    }
+    template <uint8_t N>
+    static constexpr size_t _checkedIndex()
+    {
+        static_assert(_index<N>() < sizeof...(Fields), "The field is not in the schema");
+        return _index<N>();
+    }
+
+public:
+    // Longest form of writeSchema(): "fieldN=value&" of every field and "headers=false", with the terminator.
+    static constexpr size_t FORM_SIZE = ((7 + Fields::maxLength + 1) + ... + 0) + 14;
+    // Bit N-1 of every field of the schema.
+    static constexpr uint8_t FIELDS = (_mask(Fields::field) | ...);
+
+    /**
+     * @brief Type of the value of field N.
+     */
+    template <uint8_t N>
+    using valueType = typename fieldAt<_checkedIndex<N>()>::type;
+
+    ChannelSchema() : _values(), _set(0) {}
+
+    /**
+     * @brief Set the value of field N.
+     * @retval 200 if successful
+     * @retval -101 if the value is out of range or the text is too long
+     */
+    template <uint8_t N, typename... Value>
+    int set(Value &&...value)
+    {
+        constexpr size_t i = _checkedIndex<N>();
+        int status = fieldAt<i>::assign(std::get<i>(_values), std::forward<Value>(value)...);
+        if (status == TS_OK_SUCCESS)
+            _set |= _mask(N);
+        return status;
+    }
+
+    /**
+     * @brief Value of field N. Only valid if has<N>().
+     */
+    template <uint8_t N>
+    const valueType<N> &get() const { return std::get<_checkedIndex<N>()>(_values); }
+
+    /**
+     * @brief Is field N set?
+     */
+    template <uint8_t N>
+    bool has() const
+    {
+        static_assert(_index<N>() < sizeof...(Fields), "The field is not in the schema");
+        return _set & _mask(N);
+    }
+
+    /**
+     * @brief Unset field N, it is left out of the next write.
+     */
+    template <uint8_t N>
+    void unset()
+    {
+        static_assert(_index<N>() < sizeof...(Fields), "The field is not in the schema");
+        _set &= ~_mask(N);
+    }
+
+    /**
+     * @brief Unset every field.
+     */
+    void clear() { _set = 0; }
+
+    /**
+     * @brief Bit N-1 is set if field N is set.
+     */
+    uint8_t setMask() const { return _set; }
+
+    /**
+     * @brief Write the form of the set fields, "fieldN=value&...headers=false", and a terminator.
+     * @param out At least FORM_SIZE bytes.
+     * @return Length of the form, 0 if no field is set.
+     */
+    size_t encodeForm(char *out) const
+    {
+        if (!_set)
+            return 0;
+        size_t len = 0;
+        _encodeForm(out, len, std::index_sequence_for<Fields...>());
+        memcpy(out + len, "headers=false", 14);
+        return len + 13;
+    }
+
+    /**
+     * @brief Decode a member of the JSON response of the channel.
+     * @param key Name of the member, like "field3".
+     * @param value Text of the value, without the quotes; nullptr if the value is null.
+     * @return True if the key is a field of the schema and the value was stored.
+     */
+    bool decodeMember(const char *key, size_t keyLen, const char *value)
+    {
+        if (keyLen != 6 || memcmp(key, "field", 5) || key[5] < '1' || key[5] > '8')
+            return false;
+        return _decodeMember(key[5] - '0', value, std::index_sequence_for<Fields...>());
+    }
+
+    /**
+     * @brief Decode the fields of the schema from the JSON object of a feed entry.
+     *
+     * The fields missing from the object or null are unset.
+     * @param json Body of the response, a flat JSON object.
+     * @return Number of the fields decoded.
+     */
+    uint8_t decodeJson(const char *json, size_t len)
+    {
+        _set = 0;
+        _decoded = 0;
+        AsyncTSJson tokenizer(_jsonMember, this);
+        tokenizer.parse(json, len);
+        return _decoded;
+    }
+
+    /**
+     * @brief Same as decodeJson(json, len), over the segments of the body. The body is left in buf.
+     */
+    uint8_t decodeJson(xbuf &buf)
+    {
+        _set = 0;
+        _decoded = 0;
+        AsyncTSJson tokenizer(_jsonMember, this);
+        tokenizer.parse(buf);
+        return _decoded;
+    }
+
+private:
+    static void _jsonMember(void *context, const char *key, const char *value, size_t len)
+    {
+        ChannelSchema *schema = (ChannelSchema *)context;
+        if (schema->decodeMember(key, strlen(key), value))
+            schema->_decoded++;
+    }
+
+    template <size_t... I>
+    void _encodeForm(char *out, size_t &len, std::index_sequence<I...>) const
+    {
+        (_encodeField<I>(out, len), ...);
+    }
+
+    template <size_t I>
+    void _encodeField(char *out, size_t &len) const
+    {
+        typedef fieldAt<I> F;
+        if (!(_set & _mask(F::field)))
+            return;
+        memcpy(out + len, "field", 5);
+        out[len + 5] = '0' + F::field;
+        out[len + 6] = '=';
+        len += 7;
+        len += F::encode(out + len, std::get<I>(_values));
+        out[len++] = '&';
+    }
+
+    template <size_t... I>
+    bool _decodeMember(uint8_t n, const char *value, std::index_sequence<I...>)
+    {
+        return (_decodeField<I>(n, value) || ...);
+    }
+
+    template <size_t I>
+    bool _decodeField(uint8_t n, const char *value)
+    {
+        typedef fieldAt<I> F;
+        if (n != F::field)
+            return false;
+        _set &= ~_mask(F::field);
+        if (!value || !F::decode(std::get<I>(_values), value))
+            return false;
+        _set |= _mask(F::field);
+        return true;
+    }
+
+    std::tuple<typename Fields::type...> _values;
+    uint8_t _set; // Bit N-1: field N is set
+    uint8_t _decoded = 0; // Fields decoded by the running decodeJson()
+};
+
+/**
+ * @brief Write the set fields of a ChannelSchema record in one update.
+ * @note The update goes out at once, like writeRaw(); it is not held by setUpdateInterval() nor spooled.
+ * @param channelNumber Channel number
+ * @param record Fields to write. At least one of them is set.
+ * @param writeAPIKey Write API key associated with the channel.  *If you share code with others, do _not_ share this key*
+ * @param wrucb User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy, or no field is set (-210). Couldn't send the request.
+ * @retval true: request is under sending.
+*/
+template <typename Schema>
+bool AsyncTS::writeSchema(unsigned long channelNumber, const Schema &record, const char *writeAPIKey, writeResponseUserCB wrucb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::writeSchema Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (wrucb)
+        _writeResponseUserCB = wrucb;
+    char form[Schema::FORM_SIZE];
+    size_t len = record.encodeForm(form);
+    if (!len)
+    {
+        _lastTSerrorcode = TS_ERR_SETFIELD_NOT_CALLED;
+        if (_writeResponseUserCB)
+            _writeResponseUserCB(_lastTSerrorcode);
+        return false;
+    }
+    _lastTSerrorcode = TS_OK_SUCCESS;
+    return _writeForm(channelNumber, form, len, writeAPIKey);
+}
+
+/**
+ * @brief Read the fields of a ChannelSchema record from the last entry of a channel.
+ * @param channelNumber Channel number
+ * @param record Where to decode the fields. It must live until the callback.
+ * @param readAPIKey Read API key associated with the channel, NULL for a public channel.
+ * @param ruscb User's callback function to process the server response.
+ * @retval false: AsyncTS client is busy. Couldn't send the request.
+ * @retval true: request is under sending.
+ * @post Through ruscb: std::any<Schema*>* points the record. The fields which were null or missing are not set.
+*/
+template <typename Schema>
+bool AsyncTS::readSchema(unsigned long channelNumber, Schema &record, const char *readAPIKey, readResponseUserCB ruscb)
+{
+    if (!_isReady())
+    {
+        DEBUG_ATS("ats::readSchema Clinet is busy.");
+        _lastTSerrorcode = TS_ERR_CONNECT_FAILED;
+        return false;
+    }
+    if (ruscb)
+        _readResponseUserCB = ruscb;
+    Schema *target = &record;
+    _retValueSelector = [this, target]()
+    {
+        if (_readCB())
+        {
+            target->decodeJson(_body);
+            _body.flush();
+            std::any a = target;
+            _readCB()(_lastTSerrorcode, &a);
+        }
+    };
+    return _readRaw(channelNumber, "/feeds/last.txt", readAPIKey);
+}
+
+#endif /* ASYNCTSSCHEMA_H */
@@ -0,0 +1,406 @@
+#include "AsyncTSSpool.h"
+
+#define SPOOL_MAGIC 0xA5
+#define SPOOL_FRAME 8       // magic, type, length, CRC-32
+#define SPOOL_CHUNK 64      // Buffer of the copy and CRC loops
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Create the spool. Nothing is touched until begin().
+ * @param path Path of the log file.
+ * @param maxSize Max size of the log file in bytes.
+*/
+AsyncTSSpool::AsyncTSSpool(const char *path, size_t maxSize)
+    : _path(path), _maxSize(maxSize)
+{
+}
+
+/**
+ * @brief Recover the spool after a restart or crash.
+ *
+ * The valid records are kept, a torn or corrupted tail is dropped, and the unsent
+ * records are compacted into a fresh log. On the device mount LittleFS before.
+ * @return False if the log couldn't be rewritten, the spool can't be used.
+*/
+bool AsyncTSSpool::begin()
+{
+    _ready = false;
+    _size = 0;
+    _head = 0;
+    _dataEnd = 0;
+    size_t fileSize = _fileSize();
+    if (fileSize)
+    {
+        spoolFile file;
+        if (!_open(file, _path, 'r'))
+            return false;
+        uint8_t type;
+        uint16_t len;
+        size_t frame;
+        while (_size < fileSize && (frame = _checkRecord(file, _size, fileSize, type, len)) > 0)
+        {
+            if (type == SPOOL_COMMIT)
+            {
+                uint32_t head = 0;
+                _readAt(file, _size + 4, (uint8_t *)&head, sizeof(head));
+                _head = head;
+            }
+            else
+            {
+                _dataEnd = _size + frame;
+            }
+            _size += frame;
+        }
+        if (_head > _dataEnd)
+            _head = _dataEnd;
+        size_t offset = _head;
+        while (offset < _dataEnd && (frame = _checkRecord(file, offset, _size, type, len)) > 0)
+        {
+            if (type == SPOOL_DATA)
+                _stats.recovered++;
+            offset += frame;
+        }
+        _close(file);
+        _stats.corrupt += fileSize - _size;
+    }
+
+    _ready = true;
+    if (!pending())
+    {
+        if (fileSize)
+            _remove(_path);
+        _size = _head = _dataEnd = 0;
+        return true;
+    }
+    if (_head || _size < fileSize)
+        return _ready = _compact();
+    return true;
+}
+
+/**
+ * @brief Append a data record.
+ * @param data Payload of the record. len bytes are consumed from it, even if the append fails.
+ * @param len At most ATS_SPOOL_RECORD_MAX bytes.
+ * @return False if the spool is full (even after compaction) or the write failed.
+*/
+bool AsyncTSSpool::append(xbuf &data, size_t len)
+{
+    if (len > data.available())
+        len = data.available();
+    size_t frame = SPOOL_FRAME + len;
+    bool ok = _ready && len <= ATS_SPOOL_RECORD_MAX;
+    if (ok && _size + frame > _maxSize && _head)
+        _compact();
+    if (ok && _size + frame > _maxSize)
+    {
+        _stats.dropped++;
+        ok = false;
+    }
+    if (ok && !_appendRecord(SPOOL_DATA, data, len))
+    {
+        // A partial record may be left at the end, rewrite the valid part.
+        ok = false;
+        _ready = _compact();
+    }
+    data.consume(len);
+    if (!ok)
+        return false;
+    _size += frame;
+    _dataEnd = _size;
+    _stats.appended++;
+    return true;
+}
+
+/**
+ * @brief Read the next data record.
+ * @param offset Where to start, head() for the first unsent record. Stepped past the record.
+ * @param payload The payload is appended to it.
+ * @return False at the end of the log.
+*/
+bool AsyncTSSpool::read(size_t &offset, xbuf &payload)
+{
+    if (!_ready || offset >= _dataEnd)
+        return false;
+    spoolFile file;
+    if (!_open(file, _path, 'r'))
+        return false;
+    bool found = false;
+    uint8_t type;
+    uint16_t len;
+    size_t frame;
+    while (!found && offset < _dataEnd && (frame = _checkRecord(file, offset, _size, type, len)) > 0)
+    {
+        if (type == SPOOL_DATA)
+        {
+            uint8_t chunk[SPOOL_CHUNK];
+            for (size_t done = 0; done < len;)
+            {
+                size_t part = len - done < SPOOL_CHUNK ? len - done : SPOOL_CHUNK;
+                _readAt(file, offset + 4 + done, chunk, part);
+                payload.write(chunk, part);
+                done += part;
+            }
+            found = true;
+        }
+        offset += frame;
+    }
+    _close(file);
+    return found;
+}
+
+/**
+ * @brief Mark the records before offset as sent.
+ * @param offset Offset returned by read() after the last sent record.
+ * @param rejected The server refused the records, they are counted as rejected instead of sent.
+*/
+bool AsyncTSSpool::commit(size_t offset, bool rejected)
+{
+    if (!_ready || offset <= _head)
+        return false;
+    spoolFile file;
+    if (_open(file, _path, 'r'))
+    {
+        uint8_t type;
+        uint16_t len;
+        size_t frame;
+        for (size_t at = _head; at < offset && (frame = _checkRecord(file, at, _size, type, len)) > 0; at += frame)
+        {
+            if (type == SPOOL_DATA)
+            {
+                if (rejected)
+                    _stats.rejected++;
+                else
+                    _stats.sent++;
+            }
+        }
+        _close(file);
+    }
+    if (offset >= _dataEnd)
+    {
+        // Everything is sent.
+        _remove(_path);
+        _size = _head = _dataEnd = 0;
+        return true;
+    }
+    uint32_t head = offset;
+    xbuf record(16);
+    record.write((const uint8_t *)&head, sizeof(head));
+    if (!_appendRecord(SPOOL_COMMIT, record, sizeof(head)))
+        return false;
+    _size += SPOOL_FRAME + sizeof(head);
+    _head = offset;
+    return true;
+}
+
+void AsyncTSSpool::resetStats()
+{
+    _stats = {};
+}
+
+bool AsyncTSSpool::_appendRecord(uint8_t type, xbuf &data, size_t len)
+{
+    uint8_t header[4] = {SPOOL_MAGIC, type, (uint8_t)len, (uint8_t)(len >> 8)};
+    uint32_t crc = crc32(0, header + 1, 3);
+    const uint8_t *span;
+    size_t supply;
+    for (size_t done = 0; done < len && (supply = data.peekSpan(&span, done)) > 0; done += supply)
+    {
+        if (supply > len - done)
+            supply = len - done;
+        crc = crc32(crc, span, supply);
+    }
+
+    // One open-append-close per record: a crash leaves at most a torn last record.
+    spoolFile file;
+    if (!_open(file, _path, 'a'))
+        return false;
+    bool ok = _write(file, header, sizeof(header));
+    for (size_t done = 0; ok && done < len && (supply = data.peekSpan(&span, done)) > 0; done += supply)
+    {
+        if (supply > len - done)
+            supply = len - done;
+        ok = _write(file, span, supply);
+    }
+    ok = ok && _write(file, (const uint8_t *)&crc, sizeof(crc));
+    _close(file);
+    return ok;
+}
+
+/**
+ * @brief Check the record at offset.
+ * @return Length of the whole frame, 0 if the record is torn or corrupted.
+*/
+size_t AsyncTSSpool::_checkRecord(spoolFile &file, size_t offset, size_t limit, uint8_t &type, uint16_t &len)
+{
+    uint8_t header[4];
+    if (offset + SPOOL_FRAME > limit || !_readAt(file, offset, header, sizeof(header)) || header[0] != SPOOL_MAGIC)
+        return 0;
+    type = header[1];
+    len = header[2] | (header[3] << 8);
+    if ((type != SPOOL_DATA && type != SPOOL_COMMIT) || len > ATS_SPOOL_RECORD_MAX || offset + SPOOL_FRAME + len > limit)
+        return 0;
+
+    uint32_t crc = crc32(0, header + 1, 3);
+    uint8_t chunk[SPOOL_CHUNK];
+    for (size_t done = 0; done < len;)
+    {
+        size_t part = len - done < SPOOL_CHUNK ? len - done : SPOOL_CHUNK;
+        if (!_readAt(file, offset + 4 + done, chunk, part))
+            return 0;
+        crc = crc32(crc, chunk, part);
+        done += part;
+    }
+    uint32_t stored;
+    if (!_readAt(file, offset + 4 + len, (uint8_t *)&stored, sizeof(stored)) || stored != crc)
+        return 0;
+    return SPOOL_FRAME + len;
+}
+
+/**
+ * @brief Copy the unsent data records into a temporary file and rename it over the log.
+ * A crash in between leaves the old log in place.
+*/
+bool AsyncTSSpool::_compact()
+{
+    String temp = _path + ".tmp";
+    spoolFile from, to;
+    if (!_open(from, _path, 'r'))
+        return false;
+    if (!_open(to, temp, 'w'))
+    {
+        _close(from);
+        return false;
+    }
+    bool ok = true;
+    size_t size = 0;
+    uint8_t type;
+    uint16_t len;
+    size_t frame;
+    for (size_t at = _head; ok && at < _dataEnd && (frame = _checkRecord(from, at, _size, type, len)) > 0; at += frame)
+    {
+        if (type != SPOOL_DATA)
+            continue;
+        uint8_t chunk[SPOOL_CHUNK];
+        for (size_t done = 0; ok && done < frame;)
+        {
+            size_t part = frame - done < SPOOL_CHUNK ? frame - done : SPOOL_CHUNK;
+            ok = _readAt(from, at + done, chunk, part) && _write(to, chunk, part);
+            done += part;
+        }
+        size += frame;
+    }
+    _close(from);
+    _close(to);
+    if (!ok || !_rename(temp, _path))
+    {
+        _remove(temp);
+        return false;
+    }
+    _size = size;
+    _head = 0;
+    _dataEnd = size;
+    return true;
+}
+
+#ifdef ATS_HOST
+
+bool AsyncTSSpool::_open(spoolFile &file, const String &path, char mode)
+{
+    file = fopen(path.c_str(), mode == 'r' ? "rb" : mode == 'w' ? "wb" : "ab");
+    return file != nullptr;
+}
+
+void AsyncTSSpool::_close(spoolFile &file)
+{
+    fclose(file);
+    file = nullptr;
+}
+
+bool AsyncTSSpool::_readAt(spoolFile &file, size_t offset, uint8_t *data, size_t len)
+{
+    return fseek(file, offset, SEEK_SET) == 0 && fread(data, 1, len, file) == len;
+}
+
+bool AsyncTSSpool::_write(spoolFile &file, const uint8_t *data, size_t len)
+{
+    return fwrite(data, 1, len, file) == len;
+}
+
+void AsyncTSSpool::_remove(const String &path)
+{
+    ::remove(path.c_str());
+}
+
+bool AsyncTSSpool::_rename(const String &from, const String &to)
+{
+    return ::rename(from.c_str(), to.c_str()) == 0;
+}
+
+size_t AsyncTSSpool::_fileSize()
+{
+    spoolFile file;
+    if (!_open(file, _path, 'r'))
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    _close(file);
+    return size > 0 ? size : 0;
+}
+
+#else
+
+bool AsyncTSSpool::_open(spoolFile &file, const String &path, char mode)
+{
+    file = LittleFS.open(path, mode == 'r' ? "r" : mode == 'w' ? "w" : "a");
+    return (bool)file;
+}
+
+void AsyncTSSpool::_close(spoolFile &file)
+{
+    file.close();
+}
+
+bool AsyncTSSpool::_readAt(spoolFile &file, size_t offset, uint8_t *data, size_t len)
+{
+    return file.seek(offset) && file.read(data, len) == len;
+}
+
+bool AsyncTSSpool::_write(spoolFile &file, const uint8_t *data, size_t len)
+{
+    return file.write(data, len) == len;
+}
+
+void AsyncTSSpool::_remove(const String &path)
+{
+    LittleFS.remove(path);
+}
+
+bool AsyncTSSpool::_rename(const String &from, const String &to)
+{
+    return LittleFS.rename(from, to);
+}
+
+size_t AsyncTSSpool::_fileSize()
+{
+    if (!LittleFS.exists(_path))
+        return 0;
+    spoolFile file;
+    if (!_open(file, _path, 'r'))
+        return 0;
+    size_t size = file.size();
+    _close(file);
+    return size;
+}
+
+#endif
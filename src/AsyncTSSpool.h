@@ -0,0 +1,126 @@
+/*
+AsyncTSSpool - persistent store-and-forward spool of AsyncTS.
+
+MIT License
+
+Copyright (c) 2023 János Füleki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+-----------------------------------------------------------------------------
+The spool is an append-only log file: LittleFS on the device, a regular file
+with the host build (ATS_HOST). Every record is framed as
+
+    magic (1) | type (1) | length (2) | payload (length) | CRC-32 (4)
+
+where the CRC covers type, length and payload. Data records hold the writes
+which couldn't reach the server. Sent records are not removed one by one,
+a commit record stores the offset of the first unsent one instead. When
+everything is sent, the file is removed.
+
+begin() scans the log and drops a torn or corrupted tail (e.g. power loss
+during an append), then compacts the unsent records into a fresh file by
+writing a temporary file and renaming it over the log.
+*/
+
+#ifndef ASYNCTSSPOOL_H
+#define ASYNCTSSPOOL_H
+
+#include "Arduino.h"
+#include "xbuf.h"
+
+#ifdef ATS_HOST
+#include <cstdio>
+#else
+#include <LittleFS.h>
+#endif
+
+#define ATS_SPOOL_PATH "/ats_spool.log"
+#define ATS_SPOOL_MAX_SIZE 65536        // Max size of the log file in bytes
+#define ATS_SPOOL_RECORD_MAX 1024       // Max payload of a record
+
+// Statistics of the spool.
+typedef struct spoolStatsRecord
+{
+    uint32_t appended;      // Records written
+    uint32_t sent;          // Records committed as sent
+    uint32_t rejected;      // Records committed as rejected by the server, they are not sent again
+    uint32_t dropped;       // Records refused because the spool was full
+    uint32_t recovered;     // Unsent records found by begin()
+    uint32_t corrupt;       // Bytes of torn or corrupted tail dropped by begin()
+} spoolStats;
+
+#ifdef ATS_HOST
+typedef FILE* spoolFile;
+#else
+typedef File spoolFile;
+#endif
+
+class AsyncTSSpool
+{
+    private:
+    enum recordtype{
+                SPOOL_DATA = 1,
+                SPOOL_COMMIT = 2    // Payload: offset of the first unsent record (4 bytes)
+    };
+
+    String      _path;
+    size_t      _maxSize;
+    size_t      _size = 0;          // Valid part of the log
+    size_t      _head = 0;          // First unsent data record
+    size_t      _dataEnd = 0;       // End of the last data record
+    bool        _ready = false;
+    spoolStats  _stats = {};
+
+    bool    _open(spoolFile& file, const String& path, char mode);
+    void    _close(spoolFile& file);
+    bool    _readAt(spoolFile& file, size_t offset, uint8_t* data, size_t len);
+    bool    _write(spoolFile& file, const uint8_t* data, size_t len);
+    bool    _appendRecord(uint8_t type, xbuf& data, size_t len);
+    size_t  _checkRecord(spoolFile& file, size_t offset, size_t limit, uint8_t& type, uint16_t& len);
+    bool    _compact();
+    void    _remove(const String& path);
+    bool    _rename(const String& from, const String& to);
+    size_t  _fileSize();
+
+    public:
+    AsyncTSSpool(const char* path = ATS_SPOOL_PATH, size_t maxSize = ATS_SPOOL_MAX_SIZE);
+
+    bool begin();
+    bool append(xbuf& data, size_t len);
+    bool read(size_t& offset, xbuf& payload);
+    bool commit(size_t offset, bool rejected = false);
+
+    /**
+     * @brief Are there unsent records?
+     */
+    bool pending(){ return _head < _dataEnd; };
+
+    /**
+     * @brief Offset of the first unsent record, the start of read().
+     */
+    size_t head(){ return _head; };
+
+    /**
+     * @brief Size of the log file in bytes.
+     */
+    size_t size(){ return _size; };
+    spoolStats getStats(){ return _stats; };
+    void resetStats();
+};
+#endif /* ASYNCTSSPOOL_H */
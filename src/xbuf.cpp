@@ -1,5 +1,10 @@
 #include <xbuf.h>
 
+#if ATS_ALLOC_STATS
+uint32_t xbuf::liveSegments = 0;
+uint32_t xbuf::peakSegments = 0;
+#endif
+
 xbuf::xbuf(const uint16_t segSize)
     : _head(nullptr)
     , _tail(nullptr)
@@ -124,6 +129,47 @@ size_t      xbuf::peek(uint8_t* buf, const size_t len){
     return read;
 }
 
+//*******************************************************************************************************************
+size_t      xbuf::peekSpan(const uint8_t** data, const size_t offset){
+    *data = nullptr;
+    if(offset >= _used){
+        return 0;
+    }
+    size_t pos = _offset + offset;
+    xseg* seg = _head;
+    while(pos >= _segSize){
+        seg = seg->next;
+        pos -= _segSize;
+    }
+    size_t span = _segSize - pos;
+    if(span > _used - offset){
+        span = _used - offset;
+    }
+    *data = seg->data + pos;
+    return span;
+}
+
+//*******************************************************************************************************************
+size_t      xbuf::consume(const size_t len){
+    size_t consumed = 0;
+    while(consumed < len && _used){
+        size_t supply = (_offset + _used) > _segSize ? _segSize - _offset : _used;
+        size_t demand = len - consumed;
+        size_t chunk = supply < demand ? supply : demand;
+        _offset += chunk;
+        _used -= chunk;
+        consumed += chunk;
+        if(_offset == _segSize){
+            remSeg();
+            _offset = 0;        
+        }
+    }
+    if( ! _used){
+        flush();
+    }
+    return consumed;
+}
+
 //*******************************************************************************************************************
 size_t      xbuf::available(){
     return _used;
@@ -238,17 +284,30 @@ void        xbuf::flush(){
     _free = 0;
 }
 
+//*******************************************************************************************************************
+void        xbuf::swap(xbuf& other){
+    xseg* head = _head; _head = other._head; other._head = head;
+    xseg* tail = _tail; _tail = other._tail; other._tail = tail;
+    uint16_t used = _used; _used = other._used; other._used = used;
+    uint16_t free = _free; _free = other._free; other._free = free;
+    uint16_t offset = _offset; _offset = other._offset; other._offset = offset;
+    uint16_t segSize = _segSize; _segSize = other._segSize; other._segSize = segSize;
+}
+
 //*******************************************************************************************************************
 void        xbuf::addSeg(){
     if(_tail){
-        _tail->next = (xseg*) new uint32_t[_segSize / 4 + 1];
+        _tail->next = (xseg*) new uint32_t[(sizeof(xseg) + _segSize + 3) / 4];
         _tail = _tail->next;
     }
     else {
-        _tail = _head = (xseg*) new uint32_t[_segSize / 4 + 1];
+        _tail = _head = (xseg*) new uint32_t[(sizeof(xseg) + _segSize + 3) / 4];
     }
     _tail->next = nullptr;
     _free += _segSize;
+#if ATS_ALLOC_STATS
+    if(++liveSegments > peakSegments) peakSegments = liveSegments;
+#endif
 }
 
 //*******************************************************************************************************************
@@ -256,6 +315,9 @@ void        xbuf::remSeg(){
     if(_head){
         xseg *next = _head->next;
         delete[] (uint32_t*) _head;
+#if ATS_ALLOC_STATS
+        liveSegments--;
+#endif
         _head = next;
         if( ! _head){
             _tail = nullptr;
@@ -29,6 +29,11 @@
     The segment size defaults to 64 but can be dynamically set in the constructor at creation.   
     The inclusion of indexOf and read/peek until functions make it useful for handling
     data streams like HTTP, and in fact is why it was created.
+    peekSpan() exposes the contiguous bytes of a segment in place, so they can be handed
+    to a consumer (like AsyncClient::add) without an intermediate copy. consume() then
+    drops the number of bytes actually taken.
+    swap() exchanges the segment chains of two xbufs, so the content changes hands
+    without allocating or copying.
 
     NOTE: The size of the indexOf() search string is limited to the segment size.
           It could be extended but didn't seem to be a practical consideration.    
@@ -62,14 +67,24 @@ class xbuf: public Print {
         String      readString(int);
         String      readString(){return readString(available());}
         void        flush();
+        void        swap(xbuf&);
 
         uint8_t     peek();
         size_t      peek(uint8_t*, const size_t);
+        size_t      peekSpan(const uint8_t**, const size_t offset=0);
+        size_t      consume(const size_t);
         String      peekStringUntil(const char target) {return peekString(indexOf(target, 0));}
         String      peekStringUntil(const char* target) {return peekString(indexOf(target, 0));}
         String      peekString() {return peekString(_used);}
         String      peekString(int);
 
+#if ATS_ALLOC_STATS
+        // Segments of every xbuf, for the allocation statistics.
+        static uint32_t liveSegments;
+        static uint32_t peakSegments;
+        static void     resetPeakSegments() {peakSegments = liveSegments;}
+#endif
+
 /*      In addition to the above functions, 
         the following inherited functions from the Print class are available.  
 